@@ -37,6 +37,8 @@
  * the include of your alternate allocator if needed (not needed in order
  * to use the default libc allocator). */
 
-#define s_malloc malloc
-#define s_realloc realloc
-#define s_free free
+/* chirc: account for sds memory by subsystem, see src/alloc.h */
+#include "alloc.h"
+#define s_malloc chirc_malloc
+#define s_realloc chirc_realloc
+#define s_free chirc_free
@@ -0,0 +1,218 @@
+#include "alloc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+#define NO_SIZE_CLASS UINT32_MAX
+
+/**
+ * @brief in front of every block, padded so that the memory handed out
+ * keeps malloc()'s alignment
+ */
+union alloc_header {
+    struct {
+        size_t size;
+        uint32_t tag;
+        // the pool the block goes back to, NO_SIZE_CLASS if it came from malloc()
+        uint32_t size_class;
+    };
+    max_align_t align;
+};
+
+#define HEADER(ptr) ((union alloc_header *) (ptr) - 1)
+
+static const char *tag_names[ALLOC_NTAGS] = {
+    [ALLOC_OTHER] = "other",
+    [ALLOC_REPLY] = "reply",
+    [ALLOC_SENDQ] = "sendq",
+    [ALLOC_USER] = "user",
+    [ALLOC_CHANNEL] = "channel",
+    [ALLOC_ARENA] = "arena",
+};
+
+static _Thread_local alloc_tag_t current_tag = ALLOC_OTHER;
+
+alloc_tag_t alloc_set_tag(alloc_tag_t tag)
+{
+    alloc_tag_t prev = current_tag;
+    current_tag = tag;
+    return prev;
+}
+
+const char *alloc_tag_name(alloc_tag_t tag)
+{
+    return tag < ALLOC_NTAGS ? tag_names[tag] : "unknown";
+}
+
+#ifdef CHIRC_ALLOC_POOLS
+
+// block capacities, header excluded; most nicks, names and replies fit
+static const size_t class_sizes[] = {32, 64, 128, 256, 512, 1024};
+#define NCLASSES (sizeof(class_sizes) / sizeof(class_sizes[0]))
+
+// blocks a thread keeps around per size class, the rest go back to libc
+#define POOL_MAX_CACHED 64
+
+struct pool_cache {
+    // free blocks, linked through their first word
+    void *head[NCLASSES];
+    int count[NCLASSES];
+};
+
+static _Thread_local struct pool_cache cache;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static void release_cache(void *arg)
+{
+    struct pool_cache *c = arg;
+    for (size_t i = 0; i < NCLASSES; i++) {
+        while (c->head[i] != NULL) {
+            void *next = *(void **) c->head[i];
+            free(HEADER(c->head[i]));
+            c->head[i] = next;
+        }
+        c->count[i] = 0;
+    }
+}
+
+static void create_cache_key()
+{
+    pthread_key_create(&cache_key, release_cache);
+}
+
+static uint32_t size_class_of(size_t size)
+{
+    for (uint32_t i = 0; i < NCLASSES; i++) {
+        if (size <= class_sizes[i])
+            return i;
+    }
+    return NO_SIZE_CLASS;
+}
+
+static union alloc_header *pool_get(uint32_t size_class)
+{
+    void *ptr = cache.head[size_class];
+    if (ptr != NULL) {
+        cache.head[size_class] = *(void **) ptr;
+        cache.count[size_class]--;
+        STATS_ADD(alloc_pool_hits, 1);
+        return HEADER(ptr);
+    }
+
+    // the cache must be emptied when this thread exits
+    pthread_once(&cache_key_once, create_cache_key);
+    if (pthread_getspecific(cache_key) == NULL)
+        pthread_setspecific(cache_key, &cache);
+    return malloc(sizeof(union alloc_header) + class_sizes[size_class]);
+}
+
+static void pool_put(union alloc_header *header)
+{
+    uint32_t size_class = header->size_class;
+    if (cache.count[size_class] >= POOL_MAX_CACHED) {
+        free(header);
+        return;
+    }
+    void *ptr = header + 1;
+    *(void **) ptr = cache.head[size_class];
+    cache.head[size_class] = ptr;
+    cache.count[size_class]++;
+}
+
+#else
+
+// without pools every block comes from malloc()
+
+static inline uint32_t size_class_of(size_t size)
+{
+    (void) size;
+    return NO_SIZE_CLASS;
+}
+
+static inline union alloc_header *pool_get(uint32_t size_class)
+{
+    (void) size_class;
+    return NULL;
+}
+
+static inline void pool_put(union alloc_header *header)
+{
+    free(header);
+}
+
+#endif
+
+void *chirc_malloc(size_t size)
+{
+    uint32_t size_class = size_class_of(size);
+    union alloc_header *header = size_class != NO_SIZE_CLASS ?
+                                 pool_get(size_class) :
+                                 malloc(sizeof(union alloc_header) + size);
+    if (header == NULL)
+        return NULL;
+
+    header->size = size;
+    header->tag = current_tag;
+    header->size_class = size_class;
+    STATS_ADD(alloc_live_bytes[current_tag], size);
+    STATS_ADD(alloc_count[current_tag], 1);
+    return header + 1;
+}
+
+void *chirc_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return chirc_malloc(size);
+
+    union alloc_header *header = HEADER(ptr);
+    alloc_tag_t tag = header->tag;
+
+    if (header->size_class != NO_SIZE_CLASS) {
+#ifdef CHIRC_ALLOC_POOLS
+        if (size <= class_sizes[header->size_class]) {
+            // still fits in its block
+            STATS_ADD(alloc_live_bytes[tag], (long) size - (long) header->size);
+            header->size = size;
+            return ptr;
+        }
+#endif
+        // move out of the pool, charged to the same subsystem
+        alloc_tag_t prev = alloc_set_tag(tag);
+        void *moved = chirc_malloc(size);
+        alloc_set_tag(prev);
+        if (moved == NULL)
+            return NULL;
+        memcpy(moved, ptr, header->size);
+        chirc_free(ptr);
+        return moved;
+    }
+
+    size_t old_size = header->size;
+    union alloc_header *grown = realloc(header, sizeof(union alloc_header) + size);
+    if (grown == NULL)
+        return NULL;
+    grown->size = size;
+    STATS_ADD(alloc_live_bytes[tag], (long) size - (long) old_size);
+    STATS_ADD(alloc_count[tag], 1);
+    return grown + 1;
+}
+
+void chirc_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    union alloc_header *header = HEADER(ptr);
+    STATS_SUB(alloc_live_bytes[header->tag], header->size);
+    if (header->size_class != NO_SIZE_CLASS) {
+        pool_put(header);
+    } else {
+        free(header);
+    }
+}
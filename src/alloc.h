@@ -0,0 +1,77 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+/*
+ * The allocator behind sds (see lib/sds/sdsalloc.h).
+ *
+ * Every allocation is charged to the subsystem that was current in the
+ * calling thread when it was made, and stays charged to it when it is
+ * grown or freed later, possibly by another thread. Code that allocates
+ * on behalf of a subsystem switches to it for the duration:
+ *
+ *     alloc_tag_t prev = alloc_set_tag(ALLOC_CHANNEL);
+ *     channel->name = sdsdup(name);
+ *     alloc_set_tag(prev);
+ *
+ * The live bytes and number of allocations of each subsystem are kept in
+ * chirc_stats (see stats.h).
+ *
+ * When built with CHIRC_ALLOC_POOLS, small blocks are recycled through
+ * per-thread free lists of a few size classes instead of going back to
+ * malloc() every time.
+ */
+
+typedef enum {
+    ALLOC_OTHER,
+    ALLOC_REPLY,        // replies built while handling a command
+    ALLOC_SENDQ,        // output buffers of the connections
+    ALLOC_USER,         // nicks and other user fields
+    ALLOC_CHANNEL,      // channel names and member nicks
+    ALLOC_ARENA,        // blocks of the per-command arenas, see arena.h
+    ALLOC_NTAGS
+} alloc_tag_t;
+
+/**
+ * @brief charge the calling thread's next allocations to a subsystem
+ *
+ * @param tag
+ * @return alloc_tag_t: the previous one, to be restored
+ */
+alloc_tag_t alloc_set_tag(alloc_tag_t tag);
+
+/**
+ * @brief the name of a subsystem, as reported by STATS and the metrics
+ *
+ * @param tag
+ * @return const char*
+ */
+const char *alloc_tag_name(alloc_tag_t tag);
+
+/**
+ * @brief malloc() charged to the calling thread's current subsystem
+ *
+ * @param size
+ * @return void*: NULL if out of memory
+ */
+void *chirc_malloc(size_t size);
+
+/**
+ * @brief realloc() of memory from chirc_malloc(), which stays charged to
+ * its subsystem
+ *
+ * @param ptr
+ * @param size
+ * @return void*: NULL if out of memory (ptr is left untouched)
+ */
+void *chirc_realloc(void *ptr, size_t size);
+
+/**
+ * @brief free() of memory from chirc_malloc(), from any thread
+ *
+ * @param ptr
+ */
+void chirc_free(void *ptr);
+
+#endif
@@ -0,0 +1,117 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "alloc.h"
+
+// enough for a command and its replies' scratch data in all but rare cases
+#define ARENA_BLOCK_SIZE 8192
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+struct arena {
+    // the block being carved from, the ones before it are full
+    struct arena_block *current;
+    // the first block, kept across resets
+    struct arena_block *first;
+};
+
+static _Thread_local struct arena arena;
+
+static struct arena_block *new_block(size_t size)
+{
+    alloc_tag_t prev = alloc_set_tag(ALLOC_ARENA);
+    struct arena_block *block = chirc_malloc(sizeof(struct arena_block) + size);
+    alloc_set_tag(prev);
+    if (block == NULL) {
+        chilog(CRITICAL, "arena: fail to allocate memory");
+        exit(1);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void *arena_alloc(size_t size)
+{
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+    if (arena.first == NULL) {
+        arena.first = new_block(ARENA_BLOCK_SIZE);
+        arena.current = arena.first;
+    }
+
+    struct arena_block *block = arena.current;
+    if (block->size - block->used < size) {
+        // a large request gets a block of its own
+        block = new_block(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        arena.current->next = block;
+        arena.current = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+sds arena_sds(const char *s, size_t len)
+{
+    // lay out an sds header the way sdsnewlen() would
+    char *buf;
+    if (len < (1 << 8)) {
+        struct sdshdr8 *sh = arena_alloc(sizeof(struct sdshdr8) + len + 1);
+        sh->len = len;
+        sh->alloc = len;
+        sh->flags = SDS_TYPE_8;
+        buf = sh->buf;
+    } else if (len < (1 << 16)) {
+        struct sdshdr16 *sh = arena_alloc(sizeof(struct sdshdr16) + len + 1);
+        sh->len = len;
+        sh->alloc = len;
+        sh->flags = SDS_TYPE_16;
+        buf = sh->buf;
+    } else {
+        struct sdshdr32 *sh = arena_alloc(sizeof(struct sdshdr32) + len + 1);
+        sh->len = len;
+        sh->alloc = len;
+        sh->flags = SDS_TYPE_32;
+        buf = sh->buf;
+    }
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+void arena_reset()
+{
+    if (arena.first == NULL)
+        return;
+
+    struct arena_block *block = arena.first->next;
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        chirc_free(block);
+        block = next;
+    }
+    arena.first->next = NULL;
+    arena.first->used = 0;
+    arena.current = arena.first;
+}
+
+void arena_release()
+{
+    arena_reset();
+    chirc_free(arena.first);
+    arena.first = NULL;
+    arena.current = NULL;
+}
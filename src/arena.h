@@ -0,0 +1,54 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <sds.h>
+
+/*
+ * A per-thread bump allocator for the scratch memory of one command.
+ *
+ * The parsed message and the temporary arrays handlers get from the
+ * context (member lists, affected channels, connection counts...) are
+ * carved from the calling thread's arena instead of being malloc'd one by
+ * one, and all of it is given back at once by arena_reset() once the
+ * command has been handled:
+ *
+ *     msg = parse the line into the arena
+ *     process_cmd(ctx, user_info, msg);
+ *     arena_reset();
+ *
+ * Nothing allocated here may be passed to free(), or kept past the next
+ * arena_reset() of the thread that allocated it.
+ */
+
+/**
+ * @brief allocate zeroed, suitably aligned memory from the calling
+ * thread's arena
+ *
+ * @param size
+ * @return void*: never NULL
+ */
+void *arena_alloc(size_t size);
+
+/**
+ * @brief copy a string into the calling thread's arena as an sds that
+ * can be read (sdslen()...) but must not be freed or grown
+ *
+ * @param s
+ * @param len
+ * @return sds
+ */
+sds arena_sds(const char *s, size_t len);
+
+/**
+ * @brief give back everything allocated since the last reset, keeping
+ * the first block for the next command
+ */
+void arena_reset();
+
+/**
+ * @brief free the calling thread's arena, e.g. before the thread exits
+ */
+void arena_release();
+
+#endif
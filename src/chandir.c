@@ -0,0 +1,113 @@
+#include "chandir.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "log.h"
+#include "alloc.h"
+
+static int by_member_count(const void *a, const void *b)
+{
+    const struct channel_dir_entry *x = a;
+    const struct channel_dir_entry *y = b;
+    if (x->member_count != y->member_count)
+        return x->member_count < y->member_count ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static int by_folded_name(const void *a, const void *b)
+{
+    const char *x = (*(const struct channel_dir_entry * const *) a)->name;
+    const char *y = (*(const struct channel_dir_entry * const *) b)->name;
+    int cmp = strcasecmp(x, y);
+    return cmp != 0 ? cmp : strcmp(x, y);
+}
+
+channel_dir_t *channel_dir_create(unsigned long generation, const struct channel_dir_entry *entries, int count)
+{
+    size_t names_len = 0;
+    for (int i = 0; i < count; i++) {
+        names_len += strlen(entries[i].name) + 1;
+    }
+
+    // one block: the header, the entries, by_name, then the names
+    alloc_tag_t prev = alloc_set_tag(ALLOC_CHANNEL);
+    size_t entry_size = sizeof(struct channel_dir_entry) + sizeof(struct channel_dir_entry *);
+    channel_dir_t *dir = chirc_malloc(sizeof(channel_dir_t) + count * entry_size + names_len);
+    alloc_set_tag(prev);
+    if (dir == NULL) {
+        chilog(CRITICAL, "channel_dir_create: fail to allocate memory");
+        exit(1);
+    }
+    atomic_init(&dir->refs, 1);
+    dir->generation = generation;
+    dir->count = count;
+
+    dir->by_name = (const struct channel_dir_entry **) &dir->entries[count];
+    char *names = (char *) &dir->by_name[count];
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(entries[i].name) + 1;
+        memcpy(names, entries[i].name, len);
+        dir->entries[i].name = names;
+        dir->entries[i].member_count = entries[i].member_count;
+        names += len;
+    }
+    qsort(dir->entries, count, sizeof(struct channel_dir_entry), by_member_count);
+
+    for (int i = 0; i < count; i++) {
+        dir->by_name[i] = &dir->entries[i];
+    }
+    qsort(dir->by_name, count, sizeof(struct channel_dir_entry *), by_folded_name);
+    return dir;
+}
+
+void channel_dir_ref(channel_dir_t *dir)
+{
+    atomic_fetch_add_explicit(&dir->refs, 1, memory_order_relaxed);
+}
+
+void channel_dir_unref(channel_dir_t *dir)
+{
+    if (dir != NULL && atomic_fetch_sub_explicit(&dir->refs, 1, memory_order_acq_rel) == 1) {
+        chirc_free(dir);
+    }
+}
+
+int channel_dir_lower_bound(const channel_dir_t *dir, int member_count)
+{
+    int lo = 0, hi = dir->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (dir->entries[mid].member_count < member_count)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief the first name in dir->by_name whose first len characters are
+ * past the prefix, or aren't before it
+ */
+static int prefix_bound(const channel_dir_t *dir, const char *prefix, size_t len, bool past)
+{
+    int lo = 0, hi = dir->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strncasecmp(dir->by_name[mid]->name, prefix, len);
+        if (cmp < 0 || (past && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int channel_dir_prefix_range(const channel_dir_t *dir, const char *prefix, size_t len, int *end)
+{
+    *end = prefix_bound(dir, prefix, len, true);
+    return prefix_bound(dir, prefix, len, false);
+}
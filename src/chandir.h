@@ -0,0 +1,88 @@
+#ifndef CHANDIR_H
+#define CHANDIR_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * The channel directory: a snapshot of every channel's name and member
+ * count, for LIST.
+ *
+ * A directory never changes once it is made, so LIST can take its time
+ * sending one to a slow client without locking anything. The context keeps
+ * the latest one and only takes a new one once channels have been created,
+ * joined or left since (see get_channel_dir()); until then every LIST is
+ * served from the same one.
+ *
+ * The entries are sorted by member count, so that a LIST for channels with
+ * more or fewer than N users (">N", "<N") is a binary search rather than a
+ * walk of every channel. They are also indexed by name, ignoring ASCII
+ * case, so that the channels matching a mask with a literal prefix
+ * ("#linux-*") are a binary search as well.
+ *
+ * A directory is reference counted: whoever got one from get_channel_dir()
+ * gives it back with channel_dir_unref().
+ */
+
+struct channel_dir_entry {
+    const char *name;
+    int member_count;
+};
+
+typedef struct channel_dir {
+    atomic_int refs;
+    unsigned long generation;       // of the channel table it was taken from
+    int count;
+    const struct channel_dir_entry **by_name;   // entries by case-folded name
+    struct channel_dir_entry entries[];     // by member count, ascending;
+                                            // by_name and the names follow
+} channel_dir_t;
+
+/**
+ * @brief make a directory, with one reference, out of its entries; the
+ * names are copied into it
+ *
+ * @param generation
+ * @param entries: in any order
+ * @param count
+ * @return channel_dir_t*
+ */
+channel_dir_t *channel_dir_create(unsigned long generation, const struct channel_dir_entry *entries, int count);
+
+/**
+ * @brief take another reference to a directory
+ *
+ * @param dir
+ */
+void channel_dir_ref(channel_dir_t *dir);
+
+/**
+ * @brief drop a reference to a directory, freeing it with the last one
+ *
+ * @param dir
+ */
+void channel_dir_unref(channel_dir_t *dir);
+
+/**
+ * @brief where the channels with at least some number of members start
+ *
+ * @param dir
+ * @param member_count
+ * @return int: the first entry with at least member_count members,
+ * dir->count if there is none
+ */
+int channel_dir_lower_bound(const channel_dir_t *dir, int member_count);
+
+/**
+ * @brief where the channels whose names start with a prefix are in
+ * dir->by_name, ignoring ASCII case
+ *
+ * @param dir
+ * @param prefix
+ * @param len
+ * @param end: to store where they end
+ * @return int: where they start
+ */
+int channel_dir_prefix_range(const channel_dir_t *dir, const char *prefix, size_t len, int *end);
+
+#endif
@@ -1,7 +1,40 @@
 #include "channel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
 #include "log.h"
 #include "handler.h"
 #include "context.h"
+#include "alloc.h"
+#include "arena.h"
+
+// a member's NAMES entry: its prefix and nick
+#define MEMBER_ENTRY_MAX 512
+
+/**
+ * @brief render a member's NAMES entry, e.g. "@nick"
+ *
+ * @param buf: MEMBER_ENTRY_MAX bytes
+ * @param nick
+ * @param modes: the member's mode bits
+ * @return size_t: the entry's length
+ */
+static size_t member_entry(char *buf, const char *nick, uint8_t modes)
+{
+    size_t n = 0;
+    if (modes & MEMBER_MODE_OPERATOR)
+        buf[n++] = '@';
+    else if (modes & MEMBER_MODE_VOICE)
+        buf[n++] = '+';
+    size_t len = strlen(nick);
+    if (len > MEMBER_ENTRY_MAX - 2)
+        len = MEMBER_ENTRY_MAX - 2;
+    memcpy(buf + n, nick, len);
+    n += len;
+    buf[n] = '\0';
+    return n;
+}
 
 channel_handle create_channel(char *name)
 {
@@ -10,9 +43,12 @@ channel_handle create_channel(char *name)
         chilog(CRITICAL, "create_channel: fail to allocate memory");
         exit(1);
     }
+    alloc_tag_t prev = alloc_set_tag(ALLOC_CHANNEL);
     channel->name = sdscpylen(sdsempty(), name, sdslen(name));
-    channel->member_table = NULL;
-    pthread_mutex_init(&channel->mutex_member_table, NULL);
+    alloc_set_tag(prev);
+    member_set_init(&channel->member_table);
+    names_cache_init(&channel->names);
+    prof_mutex_init(&channel->mutex_member_table, "channel_member_table");
     chilog(INFO, "create_channel: successfully created channel %s", name);
     return channel;
 }
@@ -21,116 +57,101 @@ void destroy_channel(channel_handle channel)
 {
     if (channel != NULL) {
         sdsfree(channel->name);
-        membership_handle next;
-        membership_handle cur = channel->member_table;
-        while (cur != NULL) {
-            next = cur->hh.next;
-            free(cur);
-            cur = next;
-        }
+        sdsfree(channel->key);
+        member_set_destroy(&channel->member_table);
+        names_cache_destroy(&channel->names);
     }
     free(channel);
 }
 
-bool already_on_channel(channel_handle channel, char *nick)
+bool already_on_channel(channel_handle channel, user_handle user)
 {
-    if (channel == NULL || nick == NULL || strlen(nick) < 1) {
+    if (channel == NULL || user == NULL) {
         chilog(CRITICAL, "already_on_channel: empty params");
         return false;
     }
 
-    membership_handle member = NULL;
-    pthread_mutex_lock(&channel->mutex_member_table);
-    HASH_FIND_STR(channel->member_table, nick, member);
-    pthread_mutex_unlock(&channel->mutex_member_table);
+    prof_mutex_lock(&channel->mutex_member_table);
+    int slot = member_set_find(&channel->member_table, user);
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    if (member) {
-        chilog(INFO, "user %s already on channel %s", nick, channel->name);
-        return true;
-    }
-    chilog(INFO, "user %s not on channel %s", nick, channel->name);
-    return false;
+    return slot != -1;
+}
+
+/**
+ * @brief whether the channel's modes keep a user out, with the member
+ * table locked
+ *
+ * @return int: 0, or join_channel()'s 3 to 5
+ */
+static int check_join_modes(channel_handle channel, const char *key)
+{
+    if (channel->modes & CHANNEL_MODE_INVITE_ONLY)
+        return 3;
+    if ((channel->modes & CHANNEL_MODE_KEY) && (key == NULL || strcmp(key, channel->key) != 0))
+        return 4;
+    if ((channel->modes & CHANNEL_MODE_LIMIT) && channel->member_table.count >= channel->limit)
+        return 5;
+    return 0;
 }
 
-int join_channel(channel_handle channel, char *nick, bool is_creator)
+int join_channel(channel_handle channel, user_handle user, const char *key, bool is_creator)
 {
-    if (channel == NULL || nick == NULL || strlen(nick) < 1) {
+    if (channel == NULL || user == NULL || user->nick == NULL || strlen(user->nick) < 1) {
         chilog(CRITICAL, "join_channel: empty params");
         return -1;
     }
 
-    membership_handle member = NULL;
-    pthread_mutex_lock(&channel->mutex_member_table);
-    HASH_FIND_STR(channel->member_table, nick, member);
+    prof_mutex_lock(&channel->mutex_member_table);
+    int rv;
+    if (member_set_find(&channel->member_table, user) != -1) {
+        rv = 1;
+    } else if ((rv = check_join_modes(channel, key)) == 0) {
+        uint8_t modes = is_creator ? MEMBER_MODE_OPERATOR : 0;
+        member_set_add(&channel->member_table, user, modes);
+        char entry[MEMBER_ENTRY_MAX];
+        int line = names_cache_add(&channel->names, entry, member_entry(entry, user->nick, modes));
+        channel->member_table.lines[member_set_find(&channel->member_table, user)] = line;
+    }
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    if (member) {
-        pthread_mutex_unlock(&channel->mutex_member_table);
-        chilog(INFO, "join_channel: user %s already on channel %s", nick, channel->name);
+    if (rv == 1) {
+        chilog(INFO, "join_channel: user %s already on channel %s", user->nick, channel->name);
         return 1;
     }
-
-    member = calloc(1, sizeof(membership_t));
-    if (member == NULL) {
-        chilog(CRITICAL, "join_channel: fail to allocate memory for member_handle");
-        exit(1);
+    if (rv != 0) {
+        chilog(INFO, "join_channel: user %s kept out of channel %s by its modes", user->nick, channel->name);
+        return rv;
     }
-
-    member->nick = nick;
-    member->is_channel_operator = is_creator;
-    HASH_ADD_KEYPTR(hh, channel->member_table, nick, strlen(nick), member);
-    pthread_mutex_unlock(&channel->mutex_member_table);
-    chilog(INFO, "join_channel: successfully add user %s to channel %s", nick, channel->name);
+    chilog(INFO, "join_channel: successfully add user %s to channel %s", user->nick, channel->name);
     return 0;
 }
 
-int leave_channel(channel_handle channel, char *nick)
+int leave_channel(channel_handle channel, user_handle user)
 {
-    if (channel == NULL || nick == NULL || strlen(nick) < 1) {
+    if (channel == NULL || user == NULL) {
         chilog(CRITICAL, "leave_channel: empty params");
         return -1;
     }
 
-    membership_handle member = NULL;
-    pthread_mutex_lock(&channel->mutex_member_table);
-    HASH_FIND_STR(channel->member_table, nick, member);
-
-    if (!member) {
-        pthread_mutex_unlock(&channel->mutex_member_table);
-        chilog(INFO, "leave_channel: user %s not on channel %s", nick, channel->name);
+    prof_mutex_lock(&channel->mutex_member_table);
+    int slot = member_set_find(&channel->member_table, user);
+    if (slot == -1) {
+        prof_mutex_unlock(&channel->mutex_member_table);
         return 1;
     }
-
-    HASH_DEL(channel->member_table, member);
-    chilog(INFO, "leave_channel: successfully remove user %s from channel %s", nick, channel->name);
-
-    unsigned int count = HASH_COUNT(channel->member_table);
-    pthread_mutex_unlock(&channel->mutex_member_table);
-    chilog(INFO, "leave_channel: current %u users on channel %s", count, channel->name);
+    char entry[MEMBER_ENTRY_MAX];
+    size_t len = member_entry(entry, user->nick, channel->member_table.modes[slot]);
+    names_cache_remove(&channel->names, channel->member_table.lines[slot], entry, len);
+    member_set_remove(&channel->member_table, user);
+    int count = channel->member_table.count;
+    prof_mutex_unlock(&channel->mutex_member_table);
+    chilog(INFO, "leave_channel: successfully remove user %s from channel %s, %d users left",
+           user->nick, channel->name, count);
 
     return count == 0 ? 2 : 0;
 }
 
-int update_member_nick(channel_handle channel, char *old_nick, char *new_nick)
-{
-    if (channel == NULL || old_nick == NULL || sdslen(old_nick) < 1 || new_nick == NULL || sdslen(new_nick) < 1) {
-        chilog(ERROR, "update_member_nick: empty params");
-        return -1;
-    }
-
-    membership_handle member = NULL;
-    pthread_mutex_lock(&channel->mutex_member_table);
-    HASH_FIND_STR(channel->member_table, old_nick, member);
-    if (!member) {
-        pthread_mutex_unlock(&channel->mutex_member_table);
-        return 1;
-    }
-    HASH_DEL(channel->member_table, member);
-    member->nick = sdscpylen(sdsempty(), new_nick, sdslen(new_nick));
-    HASH_ADD_KEYPTR(hh, channel->member_table, member->nick, sdslen(member->nick), member);
-    pthread_mutex_unlock(&channel->mutex_member_table);
-    return 0;
-}
-
 int channel_member_count(channel_handle channel)
 {
     if (channel == NULL) {
@@ -138,104 +159,244 @@ int channel_member_count(channel_handle channel)
         return -1;
     }
 
-    pthread_mutex_lock(&channel->mutex_member_table);
-    unsigned int count = HASH_COUNT(channel->member_table);
-    pthread_mutex_unlock(&channel->mutex_member_table);
-    chilog(INFO, "channel_member_count: currently %u users on channel %s", count, channel->name);
+    prof_mutex_lock(&channel->mutex_member_table);
+    int count = channel->member_table.count;
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    return ((int)count);
+    return count;
 }
 
-char **member_nicks_arr(channel_handle channel, int *count)
+user_handle *member_users_arr(channel_handle channel, user_handle exclude, int *count)
 {
-    if (channel == NULL) {
-        chilog(CRITICAL, "member_nicks_arr: empty params");
+    if (channel == NULL || count == NULL) {
+        chilog(CRITICAL, "member_users_arr: empty params");
         return NULL;
     }
 
-    pthread_mutex_lock(&channel->mutex_member_table);
-    unsigned int num = HASH_COUNT(channel->member_table);
+    prof_mutex_lock(&channel->mutex_member_table);
+    member_set_t *members = &channel->member_table;
+    user_handle *arr = arena_alloc(members->count * sizeof(user_handle));
 
-    char **arr = calloc(num, sizeof(char *));
-    if (arr == NULL) {
-        chilog(CRITICAL, "all_user_nicks: fail to allocate new memory");
-        exit(1);
+    int n = 0;
+    for (int i = 0; i < member_set_slots(members); i++) {
+        user_handle user = members->users[i];
+        if (user != NULL && user != exclude) {
+            arr[n++] = user;
+        }
     }
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    int i = 0;
-    for (membership_handle meb = channel->member_table; meb != NULL; meb = meb->hh.next) {
-        arr[i] = meb->nick;
-        i++;
+    *count = n;
+    return arr;
+}
+
+user_handle *member_users_modes_arr(channel_handle channel, uint8_t **modes, int *count)
+{
+    if (channel == NULL || modes == NULL || count == NULL) {
+        chilog(CRITICAL, "member_users_modes_arr: empty params");
+        return NULL;
     }
-    pthread_mutex_unlock(&channel->mutex_member_table);
 
-    chilog(INFO, "member_nicks_arr: successfully get all user nicks on channel %s", channel->name);
-    *count = num;
+    prof_mutex_lock(&channel->mutex_member_table);
+    member_set_t *members = &channel->member_table;
+    user_handle *arr = arena_alloc(members->count * sizeof(user_handle));
+    uint8_t *arr_modes = arena_alloc(members->count);
+
+    int n = 0;
+    for (int i = 0; i < member_set_slots(members); i++) {
+        if (members->users[i] != NULL) {
+            arr[n] = members->users[i];
+            arr_modes[n] = members->modes[i];
+            n++;
+        }
+    }
+    prof_mutex_unlock(&channel->mutex_member_table);
+
+    *modes = arr_modes;
+    *count = n;
     return arr;
 }
 
-sds member_nicks_str(channel_handle channel)
+char **channel_names_lines(channel_handle channel, size_t budget, int *count)
 {
-    if (channel == NULL) {
-        chilog(CRITICAL, "member_nicks_str: empty params");
+    if (channel == NULL || count == NULL) {
+        chilog(CRITICAL, "channel_names_lines: empty params");
         return NULL;
     }
 
-    int count = 0;
-    char **arr = member_nicks_arr(channel, &count);
-    sds rv = sdsjoin(arr, count, " ");
-    free(arr);
+    prof_mutex_lock(&channel->mutex_member_table);
+    names_cache_t *names = &channel->names;
+    if (!names->valid || names->budget != budget) {
+        names_cache_reset(names, budget);
+        member_set_t *members = &channel->member_table;
+        char entry[MEMBER_ENTRY_MAX];
+        for (int i = 0; i < member_set_slots(members); i++) {
+            if (members->users[i] != NULL) {
+                size_t len = member_entry(entry, members->users[i]->nick, members->modes[i]);
+                members->lines[i] = names_cache_add(names, entry, len);
+            }
+        }
+        chilog(DEBUG, "channel_names_lines: rendered NAMES of channel %s", channel->name);
+    }
+
+    char **arr = arena_alloc(names->count * sizeof(char *));
+    int n = 0;
+    for (int i = 0; i < names->count; i++) {
+        // emptied lines are kept in the cache, not sent
+        if (sdslen(names->lines[i]) > 0) {
+            arr[n++] = arena_sds(names->lines[i], sdslen(names->lines[i]));
+        }
+    }
+    *count = n;
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    chilog(INFO, "member_nicks_str: successfully get all user nicks on channel %s", channel->name);
-    return rv;
+    return arr;
+}
+
+void rename_member(channel_handle channel, user_handle user, const char *old_nick)
+{
+    if (channel == NULL || user == NULL || old_nick == NULL) {
+        chilog(CRITICAL, "rename_member: empty params");
+        return;
+    }
+
+    prof_mutex_lock(&channel->mutex_member_table);
+    int slot = member_set_find(&channel->member_table, user);
+    if (slot != -1) {
+        char old[MEMBER_ENTRY_MAX], entry[MEMBER_ENTRY_MAX];
+        uint8_t modes = channel->member_table.modes[slot];
+        size_t old_len = member_entry(old, old_nick, modes);
+        size_t len = member_entry(entry, user->nick, modes);
+        int *line = &channel->member_table.lines[slot];
+        *line = names_cache_replace(&channel->names, *line, old, old_len, entry, len);
+    }
+    prof_mutex_unlock(&channel->mutex_member_table);
 }
 
-bool is_channel_operator(channel_handle channel, char *nick)
+bool is_channel_operator(channel_handle channel, user_handle user)
 {
-    if (channel == NULL || nick == NULL || strlen(nick) < 1) {
+    if (channel == NULL || user == NULL) {
         chilog(CRITICAL, "is_channel_operator: empty params");
         return false;
     }
 
-    membership_handle member = NULL;
-    pthread_mutex_lock(&channel->mutex_member_table);
-    HASH_FIND_STR(channel->member_table, nick, member);
-    pthread_mutex_unlock(&channel->mutex_member_table);
+    prof_mutex_lock(&channel->mutex_member_table);
+    int slot = member_set_find(&channel->member_table, user);
+    bool rv = slot != -1 && (channel->member_table.modes[slot] & MEMBER_MODE_OPERATOR);
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    return (member ? member->is_channel_operator : false);
+    return rv;
 }
 
-int update_member_mode(channel_handle channel, char *nick, char *mode)
+int get_member_modes(channel_handle channel, user_handle user, uint8_t *channel_modes)
 {
-    // mode: +o, -o
-    if (channel == NULL || nick == NULL || strlen(nick) < 1 || mode == NULL || strlen(nick) < 1) {
-        chilog(CRITICAL, "update_member_mode: empty params");
+    if (channel == NULL || user == NULL) {
+        chilog(CRITICAL, "get_member_modes: empty params");
         return -1;
     }
 
-    membership_handle member = NULL;
-    pthread_mutex_lock(&channel->mutex_member_table);
-    HASH_FIND_STR(channel->member_table, nick, member);
-    pthread_mutex_unlock(&channel->mutex_member_table);
+    prof_mutex_lock(&channel->mutex_member_table);
+    int slot = member_set_find(&channel->member_table, user);
+    int rv = slot == -1 ? -1 : channel->member_table.modes[slot];
+    if (channel_modes != NULL)
+        *channel_modes = channel->modes;
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    if (!member) {
-        chilog(INFO, "update_member_mode: user %s not on channel %s", nick, channel->name);
-        return 1;
+    return rv;
+}
+
+/**
+ * @brief apply one change, with the member table locked
+ */
+static void apply_change(channel_handle channel, struct mode_change *change)
+{
+    const struct mode_def *def = change->def;
+
+    if (def->target == MODE_TARGET_MEMBER) {
+        int slot = change->user == NULL ? -1 : member_set_find(&channel->member_table, change->user);
+        if (slot == -1) {
+            change->status = MODE_NOT_ON_CHANNEL;
+            return;
+        }
+        uint8_t old_modes = channel->member_table.modes[slot];
+        if (change->set)
+            channel->member_table.modes[slot] |= def->bit;
+        else
+            channel->member_table.modes[slot] &= ~def->bit;
+        change->status = MODE_APPLIED;
+
+        char old[MEMBER_ENTRY_MAX], entry[MEMBER_ENTRY_MAX];
+        size_t old_len = member_entry(old, change->user->nick, old_modes);
+        size_t len = member_entry(entry, change->user->nick, channel->member_table.modes[slot]);
+        if (old[0] != entry[0]) {
+            // its prefix changed
+            int *line = &channel->member_table.lines[slot];
+            *line = names_cache_replace(&channel->names, *line, old, old_len, entry, len);
+        }
+        return;
     }
 
-    if (strcmp(mode, "+o") == 0) {
-        member->is_channel_operator = true;
-        chilog(INFO, "update_member_mode: give user %s operator privilige on channel %s", nick, channel->name);
-        return 0;
+    if (def->bit == CHANNEL_MODE_KEY) {
+        sdsfree(channel->key);
+        channel->key = NULL;
+        if (change->set) {
+            alloc_tag_t prev = alloc_set_tag(ALLOC_CHANNEL);
+            channel->key = sdsnew(change->param);
+            alloc_set_tag(prev);
+        }
+    } else if (def->bit == CHANNEL_MODE_LIMIT) {
+        // validated by parse_channel_modes()
+        channel->limit = change->set ? atoi(change->param) : 0;
+    }
+    if (change->set)
+        channel->modes |= def->bit;
+    else
+        channel->modes &= ~def->bit;
+    change->status = MODE_APPLIED;
+}
+
+int apply_channel_modes(channel_handle channel, user_handle setter, struct mode_change *changes, int n)
+{
+    if (channel == NULL || setter == NULL || changes == NULL) {
+        chilog(CRITICAL, "apply_channel_modes: empty params");
+        return -1;
     }
 
-    if (strcmp(mode, "-o") == 0) {
-        member->is_channel_operator = false;
-        chilog(INFO, "update_member_mode: remove user %s operator privilige on channel %s", nick, channel->name);
-        return 0;
+    prof_mutex_lock(&channel->mutex_member_table);
+    if (!(setter->modes & USER_MODE_OPERATOR)) {
+        int slot = member_set_find(&channel->member_table, setter);
+        if (slot == -1 || !(channel->member_table.modes[slot] & MEMBER_MODE_OPERATOR)) {
+            prof_mutex_unlock(&channel->mutex_member_table);
+            return 1;
+        }
     }
+    for (int i = 0; i < n; i++) {
+        if (changes[i].status == MODE_PENDING)
+            apply_change(channel, &changes[i]);
+    }
+    prof_mutex_unlock(&channel->mutex_member_table);
 
-    chilog(INFO, "update_member_mode: unknown mode %s", mode);
-    return 2;
+    chilog(INFO, "apply_channel_modes: %s changed modes of channel %s", setter->nick, channel->name);
+    return 0;
 }
 
+sds channel_modes_str(channel_handle channel, bool with_params)
+{
+    if (channel == NULL) {
+        chilog(CRITICAL, "channel_modes_str: empty params");
+        return NULL;
+    }
+
+    prof_mutex_lock(&channel->mutex_member_table);
+    sds rv = cat_mode_letters(sdsempty(), MODE_TARGET_CHANNEL, channel->modes);
+    if (with_params) {
+        // in the order of their letters
+        if (channel->modes & CHANNEL_MODE_KEY)
+            rv = sdscatfmt(rv, " %S", channel->key);
+        if (channel->modes & CHANNEL_MODE_LIMIT)
+            rv = sdscatfmt(rv, " %i", channel->limit);
+    }
+    prof_mutex_unlock(&channel->mutex_member_table);
+
+    return rv;
+}
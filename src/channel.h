@@ -1,12 +1,14 @@
 #ifndef CHANNEL_H
 #define CHANNEL_H
 
-#include <uthash.h>
 #include <pthread.h>
 #include <sds.h>
 #include <stdbool.h>
 #include <user.h>
 #include "membership.h"
+#include "mode.h"
+#include "namescache.h"
+#include "lockprof.h"
 
 struct context_t;
 typedef struct context_t context_t;
@@ -16,12 +18,18 @@ struct channel_t {
     char *name;
 
     // users on this channel
-    membership_handle member_table;
+    member_set_t member_table;
 
-    pthread_mutex_t mutex_member_table;
+    // mode bits (see mode.h), and the key and limit of +k and +l;
+    // the member table lock protects them with the members' modes
+    uint8_t modes;
+    int limit;
+    sds key;
 
-    // makes this structure hashable
-    UT_hash_handle hh; 
+    // the members rendered for NAMES, under the member table lock too
+    names_cache_t names;
+
+    prof_mutex_t mutex_member_table;
 };
 
 typedef struct channel_t channel_t;
@@ -47,19 +55,20 @@ void destroy_channel(channel_handle channel);
  * check whether user is on current channel
  * 
  * channel: 
- * nick: nick of the user
+ * user:
  * 
  * return: true if on this channel
  *         false otherwise
  */
-bool already_on_channel(channel_handle channel, char *nick);
+bool already_on_channel(channel_handle channel, user_handle user);
 
 
 /*
- * add a user to a channel
+ * add a user to a channel, if the channel's modes let it in
  * 
  * channel: 
- * nick: 
+ * user: a registered user, it must leave the channel before it is retired
+ * key: the key given to join, or NULL
  * is_creator: if it's true, we will give the user operator 
  *              mode when adding
  * 
@@ -67,14 +76,17 @@ bool already_on_channel(channel_handle channel, char *nick);
  * 0: success
  * -1: error
  * 1: user already on this channel
+ * 3: the channel is invite only (+i)
+ * 4: wrong key (+k)
+ * 5: the channel is full (+l)
  */
-int join_channel(channel_handle channel, char *nick, bool is_creator);
+int join_channel(channel_handle channel, user_handle user, const char *key, bool is_creator);
 
 /*
  * remove a user from the channel
  *
  * channel:
- * nick:
+ * user:
  * 
  * return:
  * 0: success
@@ -82,83 +94,118 @@ int join_channel(channel_handle channel, char *nick, bool is_creator);
  * 1: not on channel
  * 2: empty channel, this is used to tell the caller to delete this channel
  */
-int leave_channel(channel_handle channel, char *nick);
+int leave_channel(channel_handle channel, user_handle user);
 
 /*
- * change the nick of the user on this channel
- * this is called when user updates his nick
+ * get the number of users on this channel
  * 
- * channel: 
- * old_nick:
- * new_nick:
+ * channel:
  * 
- * return:
- * 0: success
- * -1: error
- * 1: user not on this channel
+ * return: int
  */
-int update_member_nick(channel_handle channel, char *old_nick, char *new_nick);
+int channel_member_count(channel_handle channel);
 
 /*
- * get the number of users on this channel
+ * get all users on this channel, without looking them up in the user table
  * 
  * channel:
+ * exclude: a user to leave out, or NULL
+ * count: this is used to store the number of users
  * 
- * return: int
+ * return:
+ * an array of users
+ * (carved from the caller's arena, see arena.h, the users stay valid
+ * until the caller's next quiescent state, see epoch.h)
  */
-int channel_member_count(channel_handle channel);
+user_handle *member_users_arr(channel_handle channel, user_handle exclude, int *count);
 
 /*
- * get nicks of all users on this channel
+ * get all users on this channel with their member modes, as listed by WHO
  * 
  * channel:
+ * modes: this is used to store their modes, MEMBER_MODE_* (see membership.h)
  * count: this is used to store the number of users
  * 
  * return:
- * an array of string
- * (caller need to free the return value)
+ * an array of users
+ * (the arrays are carved from the caller's arena, see arena.h, the users
+ * stay valid until the caller's next quiescent state, see epoch.h)
  */
-char **member_nicks_arr(channel_handle channel, int *count);
+user_handle *member_users_modes_arr(channel_handle channel, uint8_t **modes, int *count);
 
 /*
- * get nicks of all users on this channel
- * similar to last one
+ * get the channel's NAMES: the members' nicks with their prefixes
+ * ("@op +voiced user"), in lines of at most budget bytes; rendered
+ * once and then kept up to date, see namescache.h
  * 
  * channel:
+ * budget: the longest line
+ * count: this is used to store the number of lines
  * 
  * return:
- * sds, a string of all nicks, joined by ', '
- * (caller need to free the return value)
+ * an array of lines
+ * (the array and the lines are carved from the caller's arena, see arena.h)
+ */
+char **channel_names_lines(channel_handle channel, size_t budget, int *count);
+
+/*
+ * tell the channel that a member's nick changed, for its NAMES
+ * 
+ * channel:
+ * user: a member, already with its new nick
+ * old_nick:
  */
-sds member_nicks_str(channel_handle channel);
+void rename_member(channel_handle channel, user_handle user, const char *old_nick);
 
 /* 
  * to check whether a user is the operator of current channel 
  * 
  * channel:
- * nick:
+ * user:
  * 
  * return: bool
  */
-bool is_channel_operator(channel_handle channel, char *nick);
+bool is_channel_operator(channel_handle channel, user_handle user);
 
-// -1: error
-// 0 : success
-// 1 : not on channel
-// 2 : unsupported mode
 /**
- * @brief update mode of a user on this channel
+ * @brief the mode bits of a member and of its channel, read together
  * 
  * @param channel 
- * @param nick: user nick
- * @param mode: new mode
+ * @param user 
+ * @param channel_modes: to store the channel's mode bits, or NULL
+ * 
+ * @return int: the member's mode bits, -1 if the user isn't on the channel
+ */
+int get_member_modes(channel_handle channel, user_handle user, uint8_t *channel_modes);
+
+/**
+ * @brief apply the changes of a parsed mode string at once, so that
+ * nobody sees some of them without the others
+ * 
+ * Each change that was applied is marked MODE_APPLIED, and a member mode
+ * for someone who isn't on the channel (its user NULL or not a member)
+ * MODE_NOT_ON_CHANNEL; changes already marked otherwise are skipped.
+ * 
+ * @param channel 
+ * @param setter: needs to be a channel operator or an IRC operator
+ * @param changes: see parse_channel_modes()
+ * @param n 
  * 
  * @return int:
  * -1: error
  * 0 : success
- * 1 : not on channel
- * 2 : unsupported mode
+ * 1 : the setter may not change modes, nothing was applied
+ */
+int apply_channel_modes(channel_handle channel, user_handle setter, struct mode_change *changes, int n);
+
+/**
+ * @brief the channel's modes as a mode string, e.g. "+klm secret 10"
+ * 
+ * @param channel 
+ * @param with_params: include the key and limit
+ * 
+ * @return sds (caller need to free the return value)
  */
-int update_member_mode(channel_handle channel, char *nick, char *mode);
+sds channel_modes_str(channel_handle channel, bool with_params);
 
 #endif
\ No newline at end of file
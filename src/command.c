@@ -1,8 +1,11 @@
 #include "command.h"
 #include <string.h>
+#include <stdatomic.h>
 
 #include "log.h"
 #include "handler.h"
+#include "probes.h"
+#include "alloc.h"
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
@@ -11,6 +14,7 @@ typedef int (*handler_func)(context_handle ctx, user_handle user_info, message_h
 struct handler_entry {
     char *command_name;
     handler_func func;
+    atomic_ulong calls;
 };
 
 static struct handler_entry handler_entries[] = {
@@ -21,17 +25,27 @@ static struct handler_entry handler_entries[] = {
     {"PING", handler_PING},
     {"PONG", handler_PONG},
     {"WHOIS", handler_WHOIS},
+    {"WHO", handler_WHO},
+    {"MONITOR", handler_MONITOR},
+    {"ISON", handler_ISON},
+    {"USERHOST", handler_USERHOST},
+    {"WHOWAS", handler_WHOWAS},
     {"QUIT", handler_QUIT},
     {"LUSERS", handler_LUSERS},
     {"JOIN", handler_JOIN},
     {"PART", handler_PART},
+    {"NAMES", handler_NAMES},
     {"LIST", handler_LIST},
     {"OPER", handler_OPER},
-    {"MODE", handler_MODE}
+    {"MODE", handler_MODE},
+    {"STATS", handler_STATS}
 };
 
 int handlers_num = sizeof(handler_entries) / sizeof(struct handler_entry);
 
+// commands that matched no entry of the dispatch table
+static atomic_ulong unknown_calls;
+
 /* see command.h */
 int process_cmd(context_handle ctx, user_handle user_info, message_handle msg)
 {
@@ -39,12 +53,37 @@ int process_cmd(context_handle ctx, user_handle user_info, message_handle msg)
     int len=strlen(msg->cmd);
     for (i = 0; i < handlers_num; i++) {
         if (!strncmp(msg->cmd, handler_entries[i].command_name, MAX(len, strlen(handler_entries[i].command_name)))) {
-            return handler_entries[i].func(ctx, user_info, msg);
+            atomic_fetch_add_explicit(&handler_entries[i].calls, 1, memory_order_relaxed);
+            CHIRC_PROBE2(command_entry, user_info->client_fd, msg->cmd);
+            // whatever the handler allocates is charged to replies,
+            // unless it says otherwise (see alloc.h)
+            alloc_tag_t prev = alloc_set_tag(ALLOC_REPLY);
+            int rv = handler_entries[i].func(ctx, user_info, msg);
+            alloc_set_tag(prev);
+            CHIRC_PROBE3(command_exit, user_info->client_fd, msg->cmd, rv);
+            return rv;
         }
     }
     if (i == handlers_num) {
-        chilog(WARNING, "unsupported command");
+        atomic_fetch_add_explicit(&unknown_calls, 1, memory_order_relaxed);
+        chilog_ratelimited(WARNING, 10, "unsupported command %s", msg->cmd);
         return handler_UNKNOWNCOMMAND(ctx, user_info, msg);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/* see command.h */
+int get_command_stats(char **names, unsigned long *counts, int max)
+{
+    int n = 0;
+    for (int i = 0; i < handlers_num && n < max; i++, n++) {
+        names[n] = handler_entries[i].command_name;
+        counts[n] = atomic_load_explicit(&handler_entries[i].calls, memory_order_relaxed);
+    }
+    if (n < max) {
+        names[n] = "UNKNOWN";
+        counts[n] = atomic_load_explicit(&unknown_calls, memory_order_relaxed);
+        n++;
+    }
+    return n;
+}
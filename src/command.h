@@ -8,4 +8,14 @@
 /* According to the command(NICK, USER, JOIN...), call the corresponding function using dispatch table */
 int process_cmd(context_handle ctx, user_handle user_info, message_handle msg);
 
+/**
+ * @brief Get the number of times each command has been dispatched
+ * 
+ * @param names: filled with the command names (not to be freed)
+ * @param counts: filled with the matching counters
+ * @param max: capacity of both arrays
+ * @return int: number of entries filled, unknown commands are reported as "UNKNOWN"
+ */
+int get_command_stats(char **names, unsigned long *counts, int max);
+
 #endif
\ No newline at end of file
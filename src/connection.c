@@ -1,20 +1,27 @@
 #include "connection.h"
 
+#include <stdlib.h>
+
 #include "log.h"
 
-connection_handle create_connection(int socket_num)
+void init_connection(connection_handle connection, int socket_num)
+{
+    connection->socket_num = socket_num;
+    connection->state = UNKNOWN_CONNECTION;
+}
+
+connection_table_t *create_connection_table(int capacity)
 {
-    connection_handle res = calloc(1, sizeof(connection_t));
-    if(res==NULL) {
-        chilog(ERROR, "create connection: fail to allocate memory");
+    connection_table_t *table = calloc(1, sizeof(connection_table_t) + capacity * sizeof(connection_handle));
+    if (table == NULL) {
+        chilog(CRITICAL, "create_connection_table: fail to allocate memory");
         exit(1);
     }
-    res->socket_num = socket_num;
-    res->state = UNKNOWN_CONNECTION;
-    return res;
+    table->capacity = capacity;
+    return table;
 }
 
-void destroy_connection(connection_handle connection)
+void destroy_connection_table(connection_table_t *table)
 {
-    free(connection);
+    free(table);
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
-#include <uthash.h>
+#include <stdatomic.h>
 
 #define UNKNOWN_CONNECTION 0
 #define USER_CONNECTION 1
@@ -10,7 +10,6 @@
 struct connection_t {
     int socket_num; //key
     int state;  
-    UT_hash_handle hh;
 };
 
 typedef struct connection_t connection_t;
@@ -18,18 +17,40 @@ typedef struct connection_t connection_t;
 typedef connection_t * connection_handle;
 
 /**
- * @brief Create a connection object
+ * @brief all connections, indexed by socket: socket numbers are small
+ * and dense, so a lookup is a single load; the table is replaced by a
+ * larger copy when a socket doesn't fit, and the old one retired
+ * (see epoch.h)
+ */
+struct connection_table_t {
+    int capacity;
+    _Atomic(connection_handle) slots[];
+};
+
+typedef struct connection_table_t connection_table_t;
+
+/**
+ * @brief initialize a connection object, which is part of its user
+ * (see user.h) and lives as long as it does
  * 
+ * @param connection 
  * @param socket_num 
- * @return connection_handle 
  */
-connection_handle create_connection(int socket_num);
+void init_connection(connection_handle connection, int socket_num);
 
 /**
- * @brief free the memory of a connection object
+ * @brief Create an empty connection table
  * 
- * @param connection 
+ * @param capacity: number of slots, sockets 0 to capacity - 1 fit
+ * @return connection_table_t* 
+ */
+connection_table_t *create_connection_table(int capacity);
+
+/**
+ * @brief free a connection table, but not the connections in it
+ * 
+ * @param table 
  */
-void destroy_connection(connection_handle connection);
+void destroy_connection_table(connection_table_t *table);
 
 #endif
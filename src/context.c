@@ -1,19 +1,38 @@
 #include "context.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "log.h"
+#include "stats.h"
+#include "alloc.h"
+#include "lockprof.h"
+#include "epoch.h"
+#include "arena.h"
 
-/**
- * @brief update nick of user stored in channel object
- *        also return an array of affected channels so that
- *        caller can notify these channels
- * 
- * @param ctx 
- * @param old_nick 
- * @param new_nick 
- * @param count: to store the number of affected channels
- * @return channel_handle*: an array of channels 
- */
-channel_handle *update_nick_on_channel(context_handle ctx, char *old_nick, char *new_nick, int *count);
+// enough for the sockets of a small server, grown on demand
+#define CONNECTION_TABLE_INITIAL_SIZE 256
+
+static void free_retired_connection_table(void *table)
+{
+    destroy_connection_table(table);
+}
+
+static void free_retired_channel(void *channel)
+{
+    destroy_channel(channel);
+}
+
+static void free_retired_user_dir(void *dir)
+{
+    user_dir_destroy(dir);
+}
+
+static void free_retired_nick(void *nick)
+{
+    sdsfree(nick);
+}
 
 context_handle create_context(char *password)
 {
@@ -23,46 +42,54 @@ context_handle create_context(char *password)
         exit(1);
     }
     ctx->password = sdsnew(password);
-    ctx->user_hash_table = NULL;
-    ctx->connection_hash_table = NULL;
-    ctx->channel_hash_table = NULL;
+    name_table_init(&ctx->user_table);
+    atomic_init(&ctx->connection_table, create_connection_table(CONNECTION_TABLE_INITIAL_SIZE));
+    name_table_init(&ctx->channel_table);
     ctx->irc_op_num = 0;
-    pthread_mutex_init(&ctx->mutex_op_num, NULL);
-    pthread_mutex_init(&ctx->mutex_user_table, NULL);
-    pthread_mutex_init(&ctx->mutex_connection_table, NULL);
-    pthread_mutex_init(&ctx->mutex_channel_table, NULL);
+    prof_mutex_init(&ctx->mutex_op_num, "op_num");
+    prof_mutex_init(&ctx->mutex_user_table, "user_table");
+    name_table_init(&ctx->watch_table);
+    prof_mutex_init(&ctx->mutex_watch_table, "watch_table");
+    whowas_init(&ctx->whowas, WHOWAS_MAX);
+    prof_mutex_init(&ctx->mutex_whowas, "whowas");
+    atomic_init(&ctx->user_generation, 0);
+    atomic_init(&ctx->user_dir, NULL);
+    prof_mutex_init(&ctx->mutex_user_dir, "user_dir");
+    prof_mutex_init(&ctx->mutex_connection_table, "connection_table");
+    prof_mutex_init(&ctx->mutex_channel_table, "channel_table");
+    atomic_init(&ctx->channel_generation, 0);
+    atomic_init(&ctx->channel_dir, NULL);
+    prof_mutex_init(&ctx->mutex_channel_dir, "channel_dir");
+    atomic_init(&ctx->visit_generation, 0);
     return ctx;
 }
 
 void destroy_context(context_handle ctx)
 {
     if (ctx != NULL) {
-        sdsfree(ctx->server_host);
+        free(ctx->server_host);
         sdsfree(ctx->password);
 
-        user_handle next_user;
-        user_handle cur_user = ctx->user_hash_table;
-        while (cur_user != NULL) {
-            next_user = cur_user->hh.next;
-            destroy_user(cur_user);
-            cur_user = next_user;
+        for (size_t i = 0; i < ctx->user_table.capacity; i++) {
+            destroy_user(name_table_at(&ctx->user_table, i));
         }
+        name_table_destroy(&ctx->user_table);
+        user_dir_destroy(atomic_load(&ctx->user_dir));
 
-        connection_handle next_connection;
-        connection_handle cur_connection = ctx->connection_hash_table;
-        while (cur_connection != NULL) {
-            next_connection = cur_connection->hh.next;
-            destroy_connection(cur_connection);
-            cur_connection = next_connection;
+        for (size_t i = 0; i < ctx->watch_table.capacity; i++) {
+            destroy_watch(name_table_at(&ctx->watch_table, i));
         }
+        name_table_destroy(&ctx->watch_table);
+        whowas_destroy(&ctx->whowas);
 
-        channel_handle next_channel;
-        channel_handle cur_channel = ctx->channel_hash_table;
-        while (cur_channel != NULL) {
-            next_channel = cur_channel->hh.next;
-            destroy_channel(cur_channel);
-            cur_channel = next_channel;
+        // the connections are part of their users
+        destroy_connection_table(atomic_load(&ctx->connection_table));
+
+        for (size_t i = 0; i < ctx->channel_table.capacity; i++) {
+            destroy_channel(name_table_at(&ctx->channel_table, i));
         }
+        name_table_destroy(&ctx->channel_table);
+        channel_dir_unref(atomic_load(&ctx->channel_dir));
     }
     free(ctx);
 }
@@ -73,24 +100,71 @@ int increase_op_num(context_handle ctx)
         chilog(ERROR, "increase_op_num: empty params");
         return FAILURE;
     }
-    pthread_mutex_lock(&ctx->mutex_op_num);
+    TABLE_LOCK(ctx, op_num);
     ctx->irc_op_num += 1;
-    pthread_mutex_unlock(&ctx->mutex_op_num);
+    TABLE_UNLOCK(ctx, op_num);
+    STATS_ADD(operators, 1);
+    return SUCCESS;
+}
+
+int decrease_op_num(context_handle ctx)
+{
+    if (ctx == NULL) {
+        chilog(ERROR, "decrease_op_num: empty params");
+        return FAILURE;
+    }
+    TABLE_LOCK(ctx, op_num);
+    ctx->irc_op_num -= 1;
+    TABLE_UNLOCK(ctx, op_num);
+    STATS_SUB(operators, 1);
     return SUCCESS;
 }
 
 int add_connection(context_handle ctx, connection_handle connection)
 {
-    if (ctx == NULL || connection == NULL) {
+    if (ctx == NULL || connection == NULL || connection->socket_num < 0) {
         chilog(ERROR, "add_connection: empty params");
         return FAILURE;
     }
-    pthread_mutex_lock(&ctx->mutex_connection_table);
-    HASH_ADD_INT(ctx->connection_hash_table, socket_num, connection);
-    pthread_mutex_unlock(&ctx->mutex_connection_table);
+    TABLE_LOCK(ctx, connection_table);
+    connection_table_t *table = atomic_load(&ctx->connection_table);
+    if (connection->socket_num >= table->capacity) {
+        int capacity = table->capacity;
+        while (connection->socket_num >= capacity) {
+            capacity *= 2;
+        }
+        connection_table_t *larger = create_connection_table(capacity);
+        for (int i = 0; i < table->capacity; i++) {
+            atomic_init(&larger->slots[i], atomic_load(&table->slots[i]));
+        }
+        atomic_store(&ctx->connection_table, larger);
+        // modify_connection_state() may still be reading the old one
+        epoch_retire(table, free_retired_connection_table);
+        table = larger;
+    }
+    atomic_store(&table->slots[connection->socket_num], connection);
+    TABLE_UNLOCK(ctx, connection_table);
+    stats_connection_state(-1, connection->state);
     return SUCCESS;
 }
 
+/**
+ * @brief find a connection by socket, without taking the lock
+ *
+ * @param ctx
+ * @param socket_num
+ * @return connection_handle: NULL if there is none, valid until the
+ * caller's next quiescent state
+ */
+static connection_handle find_connection(context_handle ctx, int socket_num)
+{
+    connection_table_t *table = atomic_load(&ctx->connection_table);
+    if (socket_num < 0 || socket_num >= table->capacity) {
+        return NULL;
+    }
+    return atomic_load(&table->slots[socket_num]);
+}
+
 int modify_connection_state(context_handle ctx, int id, int state)
 {
     if (ctx == NULL) {
@@ -98,10 +172,7 @@ int modify_connection_state(context_handle ctx, int id, int state)
         return FAILURE;
     }
 
-    connection_handle connection = NULL;
-    pthread_mutex_lock(&ctx->mutex_connection_table);
-    HASH_FIND_INT(ctx->connection_hash_table, &id, connection);
-    pthread_mutex_unlock(&ctx->mutex_connection_table);
+    connection_handle connection = find_connection(ctx, id);
 
     if (!connection) {
         chilog(ERROR, "modify_connection_state: no such connection, id: %d", id);
@@ -113,7 +184,8 @@ int modify_connection_state(context_handle ctx, int id, int state)
         return FAILURE;
     }
 
-    if(connection->state != REGISTERED_CONNECTION) {
+    if(connection->state != REGISTERED_CONNECTION && connection->state != state) {
+        stats_connection_state(connection->state, state);
         connection->state = state;
     }
 
@@ -126,13 +198,15 @@ int delete_connection(context_handle ctx, int socket_num)
         chilog(ERROR, "delete_connection: empty params");
         return FAILURE;
     }
-    pthread_mutex_lock(&ctx->mutex_connection_table);
-    connection_handle connection = NULL;
-    HASH_FIND_INT(ctx->connection_hash_table, &socket_num, connection);
+    TABLE_LOCK(ctx, connection_table);
+    connection_handle connection = find_connection(ctx, socket_num);
     if (connection) {
-        HASH_DEL(ctx->connection_hash_table, connection);
+        atomic_store(&atomic_load(&ctx->connection_table)->slots[socket_num], NULL);
+        stats_connection_state(connection->state, -1);
     }
-    pthread_mutex_unlock(&ctx->mutex_connection_table);
+    TABLE_UNLOCK(ctx, connection_table);
+    // modify_connection_state() uses the connection outside the lock, it
+    // is freed along with its user, which is retired after this
     return SUCCESS;
 }
 
@@ -142,14 +216,14 @@ int *count_connection_state(context_handle ctx)
         chilog(ERROR, "count_connection_state: empty params");
         return NULL;
     }
-    int *res = calloc(3, sizeof(int));
-    if (res == NULL) {
-        chilog(CRITICAL, "count_connection_state: fail to allocate new memory");
-        exit(1);
-    }
-    pthread_mutex_lock(&ctx->mutex_connection_table);
-    for (connection_handle con = ctx->connection_hash_table; con != NULL; con = con->hh.next) {
-        if (con->state == UNKNOWN_CONNECTION) {
+    int *res = arena_alloc(3 * sizeof(int));
+    TABLE_LOCK(ctx, connection_table);
+    connection_table_t *table = atomic_load(&ctx->connection_table);
+    for (int i = 0; i < table->capacity; i++) {
+        connection_handle con = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+        if (con == NULL) {
+            continue;
+        } else if (con->state == UNKNOWN_CONNECTION) {
             res[0] += 1;
         } else if (con->state == USER_CONNECTION) {
             res[1] += 1;
@@ -158,7 +232,7 @@ int *count_connection_state(context_handle ctx)
             res[2] += 1;
         }
     }
-    pthread_mutex_unlock(&ctx->mutex_connection_table);
+    TABLE_UNLOCK(ctx, connection_table);
     return res;
 }
 
@@ -169,17 +243,28 @@ int add_user_nick(context_handle ctx, char *nick, user_handle user)
         chilog(ERROR, "add_user_nick: empty params");
         return FAILURE;
     }
-    user_handle temp = NULL;
-    pthread_mutex_lock(&ctx->mutex_user_table);
-    HASH_FIND_STR(ctx->user_hash_table, nick, temp);
-    if (temp) {
+    TABLE_LOCK(ctx, user_table);
+    if (name_table_find(&ctx->user_table, nick, strlen(nick)) != NULL) {
         chilog(INFO, "nick %s already in use", nick);
-        pthread_mutex_unlock(&ctx->mutex_user_table);
+        TABLE_UNLOCK(ctx, user_table);
         return NICK_IN_USE;
     }
+    // a NICK before registration is over replaces the earlier one
+    char *old_nick = user->nick;
+    if (old_nick != NULL) {
+        // the old nick stays valid until our next quiescent state
+        name_table_remove(&ctx->user_table, old_nick, sdslen(old_nick));
+        epoch_retire(old_nick, free_retired_nick);
+    }
+    alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
     user->nick = sdscpylen(sdsempty(), nick, sdslen(nick));
-    HASH_ADD_KEYPTR(hh, ctx->user_hash_table, user->nick, sdslen(user->nick), user);
-    pthread_mutex_unlock(&ctx->mutex_user_table);
+    alloc_set_tag(prev);
+    name_table_insert(&ctx->user_table, user->nick, sdslen(user->nick), user);
+    atomic_fetch_add(&ctx->user_generation, 1);
+    TABLE_UNLOCK(ctx, user_table);
+    if (old_nick == NULL) {
+        STATS_ADD(users, 1);
+    }
     chilog(INFO, "successfully add user %s to context", user->nick);
     return SUCCESS;
 }
@@ -191,22 +276,30 @@ int update_user_nick(context_handle ctx, char *new_nick, user_handle user_info,
         return FAILURE;
     }
 
-    user_handle temp = NULL;
-    pthread_mutex_lock(&ctx->mutex_user_table);
-    HASH_FIND_STR(ctx->user_hash_table, new_nick, temp);
-    if (temp) {
+    TABLE_LOCK(ctx, user_table);
+    if (name_table_find(&ctx->user_table, new_nick, strlen(new_nick)) != NULL) {
         chilog(INFO, "nick %s already in use", new_nick);
-        pthread_mutex_unlock(&ctx->mutex_user_table);
+        TABLE_UNLOCK(ctx, user_table);
         return NICK_IN_USE;
     }
 
-    // update user nick in channel first
-    *arr = update_nick_on_channel(ctx, user_info->nick, new_nick, count);
+    // memberships refer to the user, only the members need to be told
+    *arr = get_channels_user_on(ctx, user_info, count);
 
-    HASH_DEL(ctx->user_hash_table, user_info);
+    // the old nick stays valid until our next quiescent state
+    char *old_nick = user_info->nick;
+    name_table_remove(&ctx->user_table, old_nick, sdslen(old_nick));
+    epoch_retire(old_nick, free_retired_nick);
+    alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
     user_info->nick = sdscpylen(sdsempty(), new_nick, sdslen(new_nick));
-    HASH_ADD_KEYPTR(hh, ctx->user_hash_table, user_info->nick, sdslen(user_info->nick), user_info);
-    pthread_mutex_unlock(&ctx->mutex_user_table);
+    alloc_set_tag(prev);
+    name_table_insert(&ctx->user_table, user_info->nick, sdslen(user_info->nick), user_info);
+    atomic_fetch_add(&ctx->user_generation, 1);
+    TABLE_UNLOCK(ctx, user_table);
+
+    for (int i = 0; i < *count; i++) {
+        rename_member((*arr)[i], user_info, old_nick);
+    }
     return SUCCESS;
 }
 
@@ -216,22 +309,183 @@ user_handle get_user(context_handle ctx, char *nick)
         chilog(ERROR, "get_user: empty params");
         return NULL;
     }
-    user_handle user = NULL;
-    pthread_mutex_lock(&ctx->mutex_user_table);
-    HASH_FIND_STR(ctx->user_hash_table, nick, user);
-    pthread_mutex_unlock(&ctx->mutex_user_table);
+    TABLE_LOCK(ctx, user_table);
+    user_handle user = name_table_find(&ctx->user_table, nick, strlen(nick));
+    TABLE_UNLOCK(ctx, user_table);
     return user;
 }
 
+void get_users(context_handle ctx, char **nicks, int n, user_handle *users)
+{
+    if (ctx == NULL || nicks == NULL || users == NULL) {
+        chilog(ERROR, "get_users: empty params");
+        return;
+    }
+    TABLE_LOCK(ctx, user_table);
+    for (int i = 0; i < n; i++) {
+        users[i] = name_table_find(&ctx->user_table, nicks[i], strlen(nicks[i]));
+    }
+    TABLE_UNLOCK(ctx, user_table);
+}
+
+int add_monitor(context_handle ctx, user_handle user, const char *nick)
+{
+    if (ctx == NULL || user == NULL || nick == NULL || nick[0] == '\0') {
+        chilog(ERROR, "add_monitor: empty params");
+        return FAILURE;
+    }
+
+    TABLE_LOCK(ctx, watch_table);
+    for (int i = 0; i < user->nmonitors; i++) {
+        if (strcmp(user->monitors[i], nick) == 0) {
+            TABLE_UNLOCK(ctx, watch_table);
+            return 1;
+        }
+    }
+    if (user->nmonitors == MONITOR_MAX) {
+        TABLE_UNLOCK(ctx, watch_table);
+        return MONITOR_LIST_FULL;
+    }
+
+    alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
+    if (user->monitors == NULL) {
+        user->monitors = chirc_malloc(MONITOR_MAX * sizeof(sds));
+        if (user->monitors == NULL) {
+            chilog(CRITICAL, "add_monitor: fail to allocate memory");
+            exit(1);
+        }
+    }
+    user->monitors[user->nmonitors++] = sdsnew(nick);
+    alloc_set_tag(prev);
+
+    watch_t *watch = name_table_find(&ctx->watch_table, nick, strlen(nick));
+    if (watch == NULL) {
+        watch = create_watch(nick);
+        name_table_insert(&ctx->watch_table, watch->nick, sdslen(watch->nick), watch);
+    }
+    watch_add(watch, user);
+    TABLE_UNLOCK(ctx, watch_table);
+    return SUCCESS;
+}
+
+/**
+ * @brief remove a user from the watchers of a nick, and the nick's watch
+ * with its last watcher; the watch table must be locked
+ */
+static void unwatch(context_handle ctx, user_handle user, const char *nick)
+{
+    watch_t *watch = name_table_find(&ctx->watch_table, nick, strlen(nick));
+    if (watch != NULL && watch_remove(watch, user) && watch->count == 0) {
+        // nobody else holds on to it, get_watchers() copies the watchers
+        name_table_remove(&ctx->watch_table, watch->nick, sdslen(watch->nick));
+        destroy_watch(watch);
+    }
+}
+
+int remove_monitor(context_handle ctx, user_handle user, const char *nick)
+{
+    if (ctx == NULL || user == NULL || nick == NULL) {
+        chilog(ERROR, "remove_monitor: empty params");
+        return FAILURE;
+    }
+
+    TABLE_LOCK(ctx, watch_table);
+    for (int i = 0; i < user->nmonitors; i++) {
+        if (strcmp(user->monitors[i], nick) == 0) {
+            unwatch(ctx, user, nick);
+            sdsfree(user->monitors[i]);
+            // MONITOR L lists them in the order they were added
+            memmove(user->monitors + i, user->monitors + i + 1, (user->nmonitors - i - 1) * sizeof(sds));
+            user->nmonitors--;
+            TABLE_UNLOCK(ctx, watch_table);
+            return SUCCESS;
+        }
+    }
+    TABLE_UNLOCK(ctx, watch_table);
+    return 1;
+}
+
+void clear_monitors(context_handle ctx, user_handle user)
+{
+    if (ctx == NULL || user == NULL) {
+        chilog(ERROR, "clear_monitors: empty params");
+        return;
+    }
+    if (user->nmonitors == 0) {
+        return;
+    }
+
+    TABLE_LOCK(ctx, watch_table);
+    for (int i = 0; i < user->nmonitors; i++) {
+        unwatch(ctx, user, user->monitors[i]);
+        sdsfree(user->monitors[i]);
+    }
+    user->nmonitors = 0;
+    TABLE_UNLOCK(ctx, watch_table);
+}
+
+user_handle *get_watchers(context_handle ctx, const char *nick, int *count)
+{
+    if (ctx == NULL || nick == NULL || count == NULL) {
+        chilog(ERROR, "get_watchers: empty params");
+        return NULL;
+    }
+
+    TABLE_LOCK(ctx, watch_table);
+    watch_t *watch = name_table_find(&ctx->watch_table, nick, strlen(nick));
+    int n = watch != NULL ? watch->count : 0;
+    user_handle *arr = arena_alloc(n * sizeof(user_handle));
+    if (n > 0) {
+        memcpy(arr, watch->watchers, n * sizeof(user_handle));
+    }
+    TABLE_UNLOCK(ctx, watch_table);
+
+    *count = n;
+    return arr;
+}
+
+void record_whowas(context_handle ctx, user_handle user, const char *nick)
+{
+    if (ctx == NULL || user == NULL || nick == NULL) {
+        chilog(ERROR, "record_whowas: empty params");
+        return;
+    }
+
+    TABLE_LOCK(ctx, whowas);
+    whowas_add(&ctx->whowas, nick, user->username, user->client_host_name, user->fullname,
+               (int64_t) time(NULL));
+    TABLE_UNLOCK(ctx, whowas);
+}
+
+struct whowas_entry *get_whowas(context_handle ctx, const char *nick, int max, int *count)
+{
+    if (ctx == NULL || nick == NULL || count == NULL) {
+        chilog(ERROR, "get_whowas: empty params");
+        return NULL;
+    }
+
+    struct whowas_entry *entries = arena_alloc(max * sizeof(struct whowas_entry));
+    TABLE_LOCK(ctx, whowas);
+    *count = whowas_find(&ctx->whowas, nick, max, entries);
+    TABLE_UNLOCK(ctx, whowas);
+    return entries;
+}
+
 int delete_user(context_handle ctx, user_handle user)
 {
     if (ctx == NULL || user == NULL) {
         chilog(ERROR, "delete_user: empty params");
         return FAILURE;
     }
-    pthread_mutex_lock(&ctx->mutex_user_table);
-    HASH_DEL(ctx->user_hash_table, user);
-    pthread_mutex_unlock(&ctx->mutex_user_table);
+    if (user->nick == NULL) {
+        // never got a nick, so it was never added to the table
+        return SUCCESS;
+    }
+    TABLE_LOCK(ctx, user_table);
+    name_table_remove(&ctx->user_table, user->nick, sdslen(user->nick));
+    atomic_fetch_add(&ctx->user_generation, 1);
+    TABLE_UNLOCK(ctx, user_table);
+    STATS_SUB(users, 1);
     return SUCCESS;
 }
 
@@ -241,9 +495,9 @@ int get_channel_count(context_handle ctx)
         chilog(ERROR, "get_channel_count: empty params");
         return -1;
     }
-    pthread_mutex_lock(&ctx->mutex_channel_table);
-    unsigned int count = HASH_COUNT(ctx->channel_hash_table);
-    pthread_mutex_unlock(&ctx->mutex_channel_table);
+    TABLE_LOCK(ctx, channel_table);
+    size_t count = ctx->channel_table.count;
+    TABLE_UNLOCK(ctx, channel_table);
     return ((int) count);
 }
 
@@ -253,111 +507,378 @@ channel_handle get_channel(context_handle ctx, char *name)
         chilog(ERROR, "get_channel: empty params");
         return NULL;
     }
-    channel_handle channel = NULL;
-    pthread_mutex_lock(&ctx->mutex_channel_table);
-    HASH_FIND_STR(ctx->channel_hash_table, name, channel);
-    pthread_mutex_unlock(&ctx->mutex_channel_table);
+    TABLE_LOCK(ctx, channel_table);
+    channel_handle channel = name_table_find(&ctx->channel_table, name, strlen(name));
+    TABLE_UNLOCK(ctx, channel_table);
     return channel;
 }
 
-channel_handle try_get_channel(context_handle ctx, char *name, bool *is_creator)
+int enter_channel(context_handle ctx, char *name, const char *key, user_handle user, channel_handle *channel)
 {
-    if (ctx == NULL || name == NULL || sdslen(name) < 1 || is_creator == NULL) {
-        chilog(ERROR, "try_get_channel: empty params");
-        return NULL;
+    if (ctx == NULL || name == NULL || sdslen(name) < 1 || user == NULL || channel == NULL) {
+        chilog(ERROR, "enter_channel: empty params");
+        return -1;
     }
-    channel_handle channel = NULL;
-    pthread_mutex_lock(&ctx->mutex_channel_table);
-    HASH_FIND_STR(ctx->channel_hash_table, name, channel);
-    if (channel) {
-        pthread_mutex_unlock(&ctx->mutex_channel_table);
-        *is_creator = false;
-        return channel;
-    }
-    // create a new channel
-    channel = create_channel(name);
-    *is_creator = true;
-    HASH_ADD_KEYPTR(hh, ctx->channel_hash_table, channel->name, strlen(channel->name), channel);
-    pthread_mutex_unlock(&ctx->mutex_channel_table);
-    return channel;
+
+    bool is_creator = false;
+    TABLE_LOCK(ctx, channel_table);
+    channel_handle cha = name_table_find(&ctx->channel_table, name, strlen(name));
+    if (!cha) {
+        // create a new channel
+        cha = create_channel(name);
+        is_creator = true;
+        name_table_insert(&ctx->channel_table, cha->name, sdslen(cha->name), cha);
+        STATS_ADD(channels, 1);
+    }
+    // join while the channel is still in the table, so that a concurrent
+    // PART of its last member can't delete it under us
+    int rv = join_channel(cha, user, key, is_creator);
+    if (rv == 0) {
+        atomic_fetch_add(&ctx->channel_generation, 1);
+    }
+    TABLE_UNLOCK(ctx, channel_table);
+
+    *channel = cha;
+    return rv;
 }
 
-channel_handle *get_channels_user_on(context_handle ctx, char *nick, int *count)
+channel_handle *get_channels_user_on(context_handle ctx, user_handle user, int *count)
 {
-    if (ctx == NULL || nick == NULL || sdslen(nick) < 1 || count == NULL) {
+    if (ctx == NULL || user == NULL || count == NULL) {
         chilog(ERROR, "get_channels_user_on: empty params");
         return NULL;
     }
-    pthread_mutex_lock(&ctx->mutex_channel_table);
-    unsigned int num = HASH_COUNT(ctx->channel_hash_table);
-    channel_handle *arr = calloc(num, sizeof(channel_handle));
-    if (arr == NULL) {
-        chilog(CRITICAL, "get_channels_user_on: can't allocate new memory");
-        exit(1);
+    TABLE_LOCK(ctx, channel_table);
+    channel_handle *arr = arena_alloc(ctx->channel_table.count * sizeof(channel_handle));
+
+    int i = 0;
+    for (size_t slot = 0; slot < ctx->channel_table.capacity; slot++) {
+        channel_handle cha = name_table_at(&ctx->channel_table, slot);
+        if (cha != NULL && already_on_channel(cha, user))
+            arr[i++] = cha;
+    }
+
+    TABLE_UNLOCK(ctx, channel_table);
+    *count = i;
+    return arr;
+}
+
+channel_handle *get_all_channels(context_handle ctx, int *count)
+{
+    if (ctx == NULL || count == NULL) {
+        chilog(ERROR, "get_all_channels: empty params");
+        return NULL;
     }
+    TABLE_LOCK(ctx, channel_table);
+    channel_handle *arr = arena_alloc(ctx->channel_table.count * sizeof(channel_handle));
 
     int i = 0;
-    for (channel_handle cha = ctx->channel_hash_table; cha != NULL; cha = cha->hh.next) {
-        if (already_on_channel(cha, nick))
+    for (size_t slot = 0; slot < ctx->channel_table.capacity; slot++) {
+        channel_handle cha = name_table_at(&ctx->channel_table, slot);
+        if (cha != NULL)
             arr[i++] = cha;
     }
 
-    pthread_mutex_unlock(&ctx->mutex_channel_table);
+    TABLE_UNLOCK(ctx, channel_table);
     *count = i;
     return arr;
 }
 
-char **get_all_channel_names(context_handle ctx, int *count)
+static int compare_handles(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(const void * const *) a;
+    uintptr_t y = (uintptr_t) *(const void * const *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Members of the given channels as a sorted array, so that membership is
+ * a bsearch() with compare_handles(); private to the caller, unlike the
+ * visit marks, which concurrent builds may overwrite.
+ */
+static user_handle *sorted_members(channel_handle *channels, int nchannels, int *count)
+{
+    int num = 0, capacity = 0;
+    user_handle *arr = NULL;
+    for (int i = 0; i < nchannels; i++) {
+        int members = 0;
+        user_handle *users = member_users_arr(channels[i], NULL, &members);
+        if (num + members > capacity) {
+            capacity = num + members > capacity * 2 ? num + members : capacity * 2;
+            user_handle *larger = arena_alloc(capacity * sizeof(user_handle));
+            if (num > 0) {
+                memcpy(larger, arr, num * sizeof(user_handle));
+            }
+            arr = larger;
+        }
+        memcpy(arr + num, users, members * sizeof(user_handle));
+        num += members;
+    }
+    if (num > 1) {
+        qsort(arr, num, sizeof(user_handle), compare_handles);
+    }
+    *count = num;
+    return arr;
+}
+
+char **get_nicks_on_no_channel(context_handle ctx, int *count)
 {
     if (ctx == NULL || count == NULL) {
-        chilog(ERROR, "get_all_channel_names: empty params");
+        chilog(ERROR, "get_nicks_on_no_channel: empty params");
         return NULL;
     }
-    pthread_mutex_lock(&ctx->mutex_channel_table);
-    unsigned int num = HASH_COUNT(ctx->channel_hash_table);
 
-    char **arr = calloc(num, sizeof(char *));
-    if (arr == NULL) {
-        chilog(CRITICAL, "get_all_channel_names: can't allocate new memories");
-        exit(1);
+    // everyone on a channel...
+    int nchannels = 0, nmembers = 0;
+    channel_handle *channels = get_all_channels(ctx, &nchannels);
+    user_handle *members = sorted_members(channels, nchannels, &nmembers);
+
+    // ...and the others
+    TABLE_LOCK(ctx, user_table);
+    char **arr = arena_alloc(ctx->user_table.count * sizeof(char *));
+    int n = 0;
+    for (size_t slot = 0; slot < ctx->user_table.capacity; slot++) {
+        user_handle user = name_table_at(&ctx->user_table, slot);
+        if (user != NULL && user->registered
+            && bsearch(&user, members, nmembers, sizeof(user_handle), compare_handles) == NULL)
+            arr[n++] = user->nick;
     }
+    TABLE_UNLOCK(ctx, user_table);
 
-    int i = 0;
-    for (channel_handle cha = ctx->channel_hash_table; cha != NULL; cha = cha->hh.next) {
-        arr[i++] = cha->name;
+    *count = n;
+    return arr;
+}
+
+user_handle *get_users_sharing_no_channel(context_handle ctx, user_handle user, int *count)
+{
+    if (ctx == NULL || user == NULL || count == NULL) {
+        chilog(ERROR, "get_users_sharing_no_channel: empty params");
+        return NULL;
     }
 
-    pthread_mutex_unlock(&ctx->mutex_channel_table);
-    *count = num;
+    // everyone on the user's channels...
+    int nchannels = 0, nmembers = 0;
+    channel_handle *channels = get_channels_user_on(ctx, user, &nchannels);
+    user_handle *members = sorted_members(channels, nchannels, &nmembers);
+
+    // ...and the others
+    TABLE_LOCK(ctx, user_table);
+    user_handle *arr = arena_alloc(ctx->user_table.count * sizeof(user_handle));
+    int n = 0;
+    for (size_t slot = 0; slot < ctx->user_table.capacity; slot++) {
+        user_handle other = name_table_at(&ctx->user_table, slot);
+        if (other != NULL && other->registered
+            && bsearch(&other, members, nmembers, sizeof(user_handle), compare_handles) == NULL)
+            arr[n++] = other;
+    }
+    TABLE_UNLOCK(ctx, user_table);
+
+    *count = n;
     return arr;
 }
 
-channel_handle *update_nick_on_channel(context_handle ctx, char *old_nick, char *new_nick, int *count)
+user_dir_t *get_user_dir(context_handle ctx)
 {
-    if (ctx == NULL || old_nick == NULL || sdslen(old_nick) < 1 || new_nick == NULL || sdslen(new_nick) < 1) {
-        chilog(ERROR, "update_nick_on_channel: empty params");
+    if (ctx == NULL) {
+        chilog(ERROR, "get_user_dir: empty params");
         return NULL;
     }
 
-    pthread_mutex_lock(&ctx->mutex_channel_table);
-    unsigned int num = HASH_COUNT(ctx->channel_hash_table);
-    channel_handle *arr = calloc(num, sizeof(channel_handle));
+    user_dir_t *dir = atomic_load(&ctx->user_dir);
+    if (dir == NULL || dir->generation != atomic_load(&ctx->user_generation)) {
+        TABLE_LOCK(ctx, user_dir);
+        // someone else may have taken it while we waited
+        dir = atomic_load(&ctx->user_dir);
+        unsigned long generation = atomic_load(&ctx->user_generation);
+        if (dir == NULL || dir->generation != generation) {
+            user_dir_t *stale = dir;
+            // only the users and their nicks are taken with the table
+            // locked, the nicks are retired like the users, so they can
+            // be sorted after
+            TABLE_LOCK(ctx, user_table);
+            struct user_dir_entry *users = arena_alloc(ctx->user_table.count * sizeof(struct user_dir_entry));
+            int n = 0;
+            for (size_t slot = 0; slot < ctx->user_table.capacity; slot++) {
+                user_handle user = name_table_at(&ctx->user_table, slot);
+                if (user != NULL) {
+                    users[n].user = user;
+                    users[n].key = user->nick;
+                    n++;
+                }
+            }
+            TABLE_UNLOCK(ctx, user_table);
+            dir = user_dir_create(generation, users, n);
+            atomic_store(&ctx->user_dir, dir);
+            if (stale != NULL) {
+                epoch_retire(stale, free_retired_user_dir);
+            }
+        }
+        TABLE_UNLOCK(ctx, user_dir);
+    }
+    return dir;
+}
 
-    int i = 0;
-    for (channel_handle cha = ctx->channel_hash_table; cha != NULL; cha = cha->hh.next) {
-        int rv = update_member_nick(cha, old_nick, new_nick);
-        if (rv == 0) {
-            // find a channel that user is on
-            chilog(INFO, "user %s on channel %s, need to notify members with new nick", old_nick, cha->name);
-            arr[i++] = cha;
-        } else if (rv == -1) {
-            // error occurs
-            pthread_mutex_unlock(&ctx->mutex_channel_table);
-            free(arr);
-            return NULL;
+/**
+ * @brief take a new channel directory
+ *
+ * @param ctx
+ * @param generation: of the channel table, read before walking it
+ * @return channel_dir_t*
+ */
+static channel_dir_t *take_channel_dir(context_handle ctx, unsigned long generation)
+{
+    // only the channels are collected with the table locked, they are
+    // retired through the epoch, so their names and member sets stay
+    // readable until this thread is quiescent
+    int n = 0;
+    channel_handle *channels = get_all_channels(ctx, &n);
+
+    struct channel_dir_entry *entries = arena_alloc(n * sizeof(struct channel_dir_entry));
+    for (int i = 0; i < n; i++) {
+        entries[i].name = channels[i]->name;
+        entries[i].member_count = channel_member_count(channels[i]);
+    }
+    return channel_dir_create(generation, entries, n);
+}
+
+static void release_retired_channel_dir(void *dir)
+{
+    channel_dir_unref(dir);
+}
+
+channel_dir_t *get_channel_dir(context_handle ctx)
+{
+    if (ctx == NULL) {
+        chilog(ERROR, "get_channel_dir: empty params");
+        return NULL;
+    }
+
+    channel_dir_t *dir = atomic_load(&ctx->channel_dir);
+    if (dir == NULL || dir->generation != atomic_load(&ctx->channel_generation)) {
+        TABLE_LOCK(ctx, channel_dir);
+        // someone else may have taken it while we waited
+        dir = atomic_load(&ctx->channel_dir);
+        unsigned long generation = atomic_load(&ctx->channel_generation);
+        if (dir == NULL || dir->generation != generation) {
+            channel_dir_t *stale = dir;
+            dir = take_channel_dir(ctx, generation);
+            atomic_store(&ctx->channel_dir, dir);
+            if (stale != NULL) {
+                // readers that loaded it may not have their reference yet
+                epoch_retire(stale, release_retired_channel_dir);
+            }
         }
+        TABLE_UNLOCK(ctx, channel_dir);
     }
-    pthread_mutex_unlock(&ctx->mutex_channel_table);
-    *count = i;
+    channel_dir_ref(dir);
+    return dir;
+}
+
+int part_channel(context_handle ctx, char *name, user_handle user, channel_handle *channel)
+{
+    if (ctx == NULL || name == NULL || user == NULL || channel == NULL) {
+        chilog(ERROR, "part_channel: empty params");
+        return -1;
+    }
+
+    TABLE_LOCK(ctx, channel_table);
+    channel_handle cha = name_table_find(&ctx->channel_table, name, strlen(name));
+    if (!cha) {
+        TABLE_UNLOCK(ctx, channel_table);
+        return 3;
+    }
+
+    int rv = leave_channel(cha, user);
+    if (rv == 0 || rv == 2) {
+        atomic_fetch_add(&ctx->channel_generation, 1);
+    }
+    if (rv == 2) {
+        // last member left, delete this channel
+        name_table_remove(&ctx->channel_table, cha->name, sdslen(cha->name));
+        STATS_SUB(channels, 1);
+        epoch_retire(cha, free_retired_channel);
+    }
+    TABLE_UNLOCK(ctx, channel_table);
+
+    *channel = cha;
+    return rv;
+}
+
+int part_all_channels(context_handle ctx, user_handle user)
+{
+    if (ctx == NULL || user == NULL) {
+        chilog(ERROR, "part_all_channels: empty params");
+        return FAILURE;
+    }
+
+    TABLE_LOCK(ctx, channel_table);
+    for (size_t slot = 0; slot < ctx->channel_table.capacity; slot++) {
+        channel_handle cha = name_table_at(&ctx->channel_table, slot);
+        if (cha == NULL)
+            continue;
+        int rv = leave_channel(cha, user);
+        if (rv == 0 || rv == 2) {
+            atomic_fetch_add(&ctx->channel_generation, 1);
+        }
+        if (rv == 2) {
+            // removing doesn't move the other entries
+            name_table_remove(&ctx->channel_table, cha->name, sdslen(cha->name));
+            STATS_SUB(channels, 1);
+            epoch_retire(cha, free_retired_channel);
+        }
+    }
+    TABLE_UNLOCK(ctx, channel_table);
+    return SUCCESS;
+}
+
+user_handle *get_channel_recipients(context_handle ctx, channel_handle channel, user_handle exclude, int *count)
+{
+    if (ctx == NULL || channel == NULL || count == NULL) {
+        chilog(ERROR, "get_channel_recipients: empty params");
+        return NULL;
+    }
+
+    // memberships point at their users, the user table isn't needed
+    return member_users_arr(channel, exclude, count);
+}
+
+user_handle *get_channels_recipients(context_handle ctx, channel_handle *channels, int nchannels, user_handle exclude, int *count)
+{
+    if (ctx == NULL || channels == NULL || count == NULL) {
+        chilog(ERROR, "get_channels_recipients: empty params");
+        return NULL;
+    }
+
+    int num = 0, capacity = 0;
+    user_handle *arr = NULL;
+
+    // no lock: a build that overwrites our mark makes us add that user
+    // twice at worst, which is cheaper than serializing every build
+    unsigned long generation = atomic_fetch_add_explicit(&ctx->visit_generation, 1, memory_order_relaxed) + 1;
+    for (int i = 0; i < nchannels; i++) {
+        if (channels[i] == NULL) {
+            continue;
+        }
+        int members = 0;
+        user_handle *users = member_users_arr(channels[i], exclude, &members);
+        for (int j = 0; j < members; j++) {
+            if (atomic_load_explicit(&users[j]->visit_mark, memory_order_relaxed) == generation) {
+                // already reached through an earlier channel
+                continue;
+            }
+            atomic_store_explicit(&users[j]->visit_mark, generation, memory_order_relaxed);
+            if (num == capacity) {
+                capacity = capacity == 0 ? members : capacity * 2;
+                user_handle *larger = arena_alloc(capacity * sizeof(user_handle));
+                if (num > 0) {
+                    memcpy(larger, arr, num * sizeof(user_handle));
+                }
+                arr = larger;
+            }
+            arr[num++] = users[j];
+        }
+    }
+
+    *count = num;
     return arr;
-}
\ No newline at end of file
+}
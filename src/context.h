@@ -6,34 +6,102 @@
 #include "user.h"
 #include "connection.h"
 #include "channel.h"
+#include "chandir.h"
+#include "userdir.h"
+#include "watch.h"
+#include "whowas.h"
+#include "lockprof.h"
+#include "nametable.h"
+#include "probes.h"
 
 #define SUCCESS 0
 #define FAILURE -1
 
 #define NICK_IN_USE 1
 
+// how many nicks a user can MONITOR
+#define MONITOR_MAX 100
+#define MONITOR_LIST_FULL 2
+
+// the users WHOWAS remembers
+#define WHOWAS_MAX 1024
+
 struct context_t {
     char *server_host;
 
     char *password;
 
     int irc_op_num;
-    pthread_mutex_t mutex_op_num;
+    prof_mutex_t mutex_op_num;
+
+    // read without the lock, which only serializes adding and removing
+    _Atomic(connection_table_t *) connection_table;
+    prof_mutex_t mutex_connection_table;
+
+    // users by nick
+    name_table_t user_table;
+    prof_mutex_t mutex_user_table;
+
+    // the watchers of the nicks someone MONITORs, by nick, see watch.h
+    name_table_t watch_table;
+    prof_mutex_t mutex_watch_table;
+
+    // the users who quit or changed nicks, see whowas.h
+    whowas_t whowas;
+    prof_mutex_t mutex_whowas;
+
+    // bumped whenever users are added, removed or renamed, which is when
+    // user_dir goes stale
+    atomic_ulong user_generation;
 
-    connection_handle connection_hash_table;
-    pthread_mutex_t mutex_connection_table;
+    // the latest user directory, see get_user_dir(); read without the
+    // lock, which only serializes taking a new one
+    _Atomic(user_dir_t *) user_dir;
+    prof_mutex_t mutex_user_dir;
 
-    user_handle user_hash_table;
-    pthread_mutex_t mutex_user_table;
+    // channels by name
+    name_table_t channel_table;
+    prof_mutex_t mutex_channel_table;
 
-    channel_handle channel_hash_table;
-    pthread_mutex_t mutex_channel_table;
+    // bumped whenever channels are created, joined or left, which is
+    // when channel_dir goes stale
+    atomic_ulong channel_generation;
+
+    // the latest channel directory, see get_channel_dir(); read without
+    // the lock, which only serializes taking a new one
+    _Atomic(channel_dir_t *) channel_dir;
+    prof_mutex_t mutex_channel_dir;
+
+    // one per get_channels_recipients() call, stamped on the users it adds
+    atomic_ulong visit_generation;
 };
 
 typedef struct context_t context_t;
 
 typedef context_t * context_handle;
 
+/**
+ * @brief lock one of the global tables of the context, e.g.
+ * TABLE_LOCK(ctx, user_table) locks ctx->mutex_user_table
+ * (this also fires the lock_* USDT probes, and the lock is profiled
+ * under the table name, see lockprof.h)
+ */
+#define TABLE_LOCK(ctx, table) \
+    do { \
+        CHIRC_PROBE1(lock_acquire, #table); \
+        prof_mutex_lock(&(ctx)->mutex_##table); \
+        CHIRC_PROBE1(lock_acquired, #table); \
+    } while (0)
+
+/**
+ * @brief unlock a table locked with TABLE_LOCK()
+ */
+#define TABLE_UNLOCK(ctx, table) \
+    do { \
+        prof_mutex_unlock(&(ctx)->mutex_##table); \
+        CHIRC_PROBE1(lock_release, #table); \
+    } while (0)
+
 // context
 
 /**
@@ -61,6 +129,14 @@ void destroy_context(context_handle ctx);
  */
 int increase_op_num(context_handle ctx);
 
+/**
+ * @brief decrease the number of operators of current server(context) by 1
+ * 
+ * @param ctx 
+ * @return int 
+ */
+int decrease_op_num(context_handle ctx);
+
 // connection
 /**
  * @brief add a new connection to the connext
@@ -82,7 +158,8 @@ int add_connection(context_handle ctx, connection_handle connection);
 int modify_connection_state(context_handle ctx, int id, int state);
 
 /**
- * @brief remove a connection from current context
+ * @brief remove a connection from current context,
+ *        the connection object is retired, see epoch.h
  * 
  * @param ctx 
  * @param socket_num 
@@ -99,13 +176,14 @@ int delete_connection(context_handle ctx, int socket_num);
  * arr[1]: user
  * arr[2]: registered
  * 
- * need to free the return value
+ * carved from the caller's arena, see arena.h
  */
 int *count_connection_state(context_handle ctx);
 
 // user
 /**
- * @brief add nick to a user, this is used when the user hasn't registered
+ * @brief add nick to a user, this is used when the user hasn't registered;
+ * a nick it was given before is replaced
  * 
  * @param ctx 
  * @param nick 
@@ -122,6 +200,7 @@ int add_user_nick(context_handle ctx, char *nick, user_handle user);
  * @param user_info 
  * @param arr: this param is used to store the array of channels affected,
  *             caller need to notify members of these channels of the update
+ *             (carved from the caller's arena, see arena.h)
  * @param count: to store the number of affected channels
  * @return int: SUCCESS, FAILURE
  */
@@ -136,6 +215,79 @@ int update_user_nick(context_handle ctx, char *new_nick, user_handle user_info,
  */
 user_handle get_user(context_handle ctx, char *nick);
 
+/**
+ * @brief Get the users with some nicks, under a single lock
+ * 
+ * @param ctx 
+ * @param nicks 
+ * @param n 
+ * @param users: to store the user of each nick, NULL if there is none
+ * (the users stay valid until the caller's next quiescent state)
+ */
+void get_users(context_handle ctx, char **nicks, int n, user_handle *users);
+
+/**
+ * @brief MONITOR a nick: the user will be told when a user with that
+ *        nick comes online or goes offline, see get_watchers()
+ * 
+ * @param ctx 
+ * @param user 
+ * @param nick 
+ * @return int: SUCCESS, 1 if it already monitors it, or
+ * MONITOR_LIST_FULL if it monitors MONITOR_MAX nicks
+ */
+int add_monitor(context_handle ctx, user_handle user, const char *nick);
+
+/**
+ * @brief stop monitoring a nick
+ * 
+ * @param ctx 
+ * @param user 
+ * @param nick 
+ * @return int: SUCCESS, 1 if it doesn't monitor it
+ */
+int remove_monitor(context_handle ctx, user_handle user, const char *nick);
+
+/**
+ * @brief stop monitoring every nick, which a user must do before it is
+ *        retired
+ * 
+ * @param ctx 
+ * @param user 
+ */
+void clear_monitors(context_handle ctx, user_handle user);
+
+/**
+ * @brief Get the users that monitor a nick
+ * 
+ * @param ctx 
+ * @param nick 
+ * @param count: to store the number of users
+ * @return user_handle*: an array of users, carved from the caller's arena
+ * (the users stay valid until the caller's next quiescent state)
+ */
+user_handle *get_watchers(context_handle ctx, const char *nick, int *count);
+
+/**
+ * @brief remember a user for WHOWAS, once it quits or leaves a nick
+ * 
+ * @param ctx 
+ * @param user 
+ * @param nick: the nick it leaves
+ */
+void record_whowas(context_handle ctx, user_handle user, const char *nick);
+
+/**
+ * @brief Get what WHOWAS remembers of a nick, newest first
+ * 
+ * @param ctx 
+ * @param nick 
+ * @param max: the most records to return
+ * @param count: to store the number of records
+ * @return struct whowas_entry*: the records, copied into the caller's arena
+ */
+struct whowas_entry *get_whowas(context_handle ctx, const char *nick, int max, int *count);
+
 /**
  * @brief delete a user from the context
  * 
@@ -164,34 +316,144 @@ int get_channel_count(context_handle ctx);
 channel_handle get_channel(context_handle ctx, char *name);
 
 /**
- * @brief compared to last function, this one will create a new channel
- *        if there doesn't exist one; this is designed for JOIN command
+ * @brief add a user to a channel, creating the channel if it doesn't
+ *        exist yet (its creator becomes a channel operator);
+ *        this is designed for JOIN command
  * 
  * @param ctx 
- * @param name 
- * @param is_creator: true if newly created, false otherwise
- * @return channel_handle 
+ * @param name: channel name
+ * @param key: the key given to join, or NULL
+ * @param user 
+ * @param channel: to store the channel
+ * @return int: same as join_channel()
+ * 0: success
+ * -1: error
+ * 1: user already on this channel
+ * 3, 4, 5: kept out by the channel's +i, +k, +l
  */
-channel_handle try_get_channel(context_handle ctx, char *name, bool *is_creator);
+int enter_channel(context_handle ctx, char *name, const char *key, user_handle user, channel_handle *channel);
 
 /**
  * @brief Get the channels user on 
  * 
  * @param ctx 
- * @param nick 
+ * @param user 
  * @param count: to store the number of channels
- * @return channel_handle*: an array of channels
+ * @return channel_handle*: an array of channels, carved from the
+ * caller's arena, see arena.h
  */
-channel_handle *get_channels_user_on(context_handle ctx, char *nick, int *count);
+channel_handle *get_channels_user_on(context_handle ctx, user_handle user, int *count);
 
 /**
- * @brief Get the names of all channels
+ * @brief Get all the channels
  * 
  * @param ctx 
  * @param count: to store the number of channels
- * @return char**: an array of string
- * need to free the return value
+ * @return channel_handle*: an array of channels, carved from the
+ * caller's arena, see arena.h (they stay valid until the caller's next
+ * quiescent state, see epoch.h)
+ */
+channel_handle *get_all_channels(context_handle ctx, int *count);
+
+/**
+ * @brief Get the nicks of the registered users that aren't on any
+ *        channel, as listed by NAMES; everyone on a channel is stamped
+ *        with a generation number first, see get_channels_recipients()
+ * 
+ * @param ctx 
+ * @param count: to store the number of nicks
+ * @return char**: an array of nicks, carved from the caller's arena
+ * (the nicks stay valid until the caller's next quiescent state)
+ */
+char **get_nicks_on_no_channel(context_handle ctx, int *count);
+
+/**
+ * @brief Get the registered users that share no channel with a user,
+ *        as listed by "WHO *": the user itself if it is on no channel
+ * 
+ * @param ctx 
+ * @param user 
+ * @param count: to store the number of users
+ * @return user_handle*: an array of users, carved from the caller's arena
+ * (the users stay valid until the caller's next quiescent state)
+ */
+user_handle *get_users_sharing_no_channel(context_handle ctx, user_handle user, int *count);
+
+/**
+ * @brief the user directory (see userdir.h), taken again only if users
+ *        have been added, removed or renamed since the last one
+ *
+ * @param ctx
+ * @return user_dir_t*: it stays valid until the caller's next quiescent
+ * state
+ */
+user_dir_t *get_user_dir(context_handle ctx);
+
+/**
+ * @brief the channel directory (see chandir.h), taken again only if
+ *        channels have changed since the last one
+ *
+ * @param ctx
+ * @return channel_dir_t*: release it with channel_dir_unref(); it needs
+ * no epoch protection, the caller may go offline while it holds it
+ */
+channel_dir_t *get_channel_dir(context_handle ctx);
+
+/**
+ * @brief remove a user from a channel, deleting the channel from the
+ *        context if the user was its last member
+ * 
+ * @param ctx 
+ * @param name: channel name
+ * @param user 
+ * @param channel: to store the channel, caller can use it to notify
+ *                 the remaining members after this returns
+ * @return int:
+ * -1: error
+ * 0: success
+ * 1: not on channel
+ * 2: success, and the channel was empty and has been deleted
+ *    (it stays valid until the caller's next quiescent state, see epoch.h)
+ * 3: no such channel
+ */
+int part_channel(context_handle ctx, char *name, user_handle user, channel_handle *channel);
+
+/**
+ * @brief remove a user from every channel it is on, deleting the
+ *        channels it was the last member of; used when a client goes away
+ * 
+ * @param ctx 
+ * @param user 
+ * @return int: SUCCESS, FAILURE
+ */
+int part_all_channels(context_handle ctx, user_handle user);
+
+/**
+ * @brief Get the users currently on a channel
+ * 
+ * @param ctx 
+ * @param channel 
+ * @param exclude: a user to leave out (e.g. the sender), or NULL
+ * @param count: to store the number of users
+ * @return user_handle*: an array of users
+ * carved from the caller's arena, see arena.h
+ */
+user_handle *get_channel_recipients(context_handle ctx, channel_handle channel, user_handle exclude, int *count);
+
+/**
+ * @brief Get the users on any of several channels, each of them once
+ *        no matter how many of the channels they share (e.g. for NICK
+ *        and QUIT); duplicates are skipped by stamping each user with
+ *        a generation number, without building a set
+ * 
+ * @param ctx 
+ * @param channels 
+ * @param nchannels 
+ * @param exclude: a user to leave out (e.g. the sender), or NULL
+ * @param count: to store the number of users
+ * @return user_handle*: an array of users
+ * carved from the caller's arena, see arena.h
  */
-char **get_all_channel_names(context_handle ctx, int *count);
+user_handle *get_channels_recipients(context_handle ctx, channel_handle *channels, int nchannels, user_handle exclude, int *count);
 
 #endif
\ No newline at end of file
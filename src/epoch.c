@@ -0,0 +1,251 @@
+#include "epoch.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "stats.h"
+
+// retired objects are only freed once this many are waiting
+#define EPOCH_RECLAIM_BATCH 32
+
+#define EPOCH_OFFLINE UINT64_MAX
+
+/**
+ * @brief one reader thread, records are reused by later threads and
+ * never freed
+ */
+struct epoch_record {
+    // epoch seen at the thread's last quiescent state, EPOCH_OFFLINE if offline
+    _Atomic uint64_t seen;
+    atomic_bool in_use;
+    struct epoch_record *next;
+};
+
+/**
+ * @brief see epoch_pin(), pins are reused and never freed, like records
+ */
+struct epoch_pin {
+    _Atomic uint64_t epoch;
+    atomic_bool in_use;
+    struct epoch_pin *next;
+};
+
+struct retired {
+    void *ptr;
+    epoch_destructor destructor;
+    uint64_t epoch;
+    struct retired *next;
+};
+
+static _Atomic uint64_t global_epoch = 1;
+
+static _Atomic(struct epoch_record *) records;
+
+static _Atomic(struct epoch_pin *) pins;
+
+static _Atomic(struct retired *) limbo;
+static atomic_long limbo_count;
+
+static _Thread_local struct epoch_record *my_record;
+
+void epoch_register()
+{
+    if (my_record != NULL)
+        return;
+
+    for (struct epoch_record *r = atomic_load(&records); r != NULL; r = r->next) {
+        bool expected = false;
+        if (!atomic_load(&r->in_use) && atomic_compare_exchange_strong(&r->in_use, &expected, true)) {
+            my_record = r;
+            return;
+        }
+    }
+
+    struct epoch_record *r = calloc(1, sizeof(struct epoch_record));
+    if (r == NULL) {
+        chilog(CRITICAL, "epoch_register: fail to allocate memory");
+        exit(1);
+    }
+    atomic_init(&r->seen, EPOCH_OFFLINE);
+    atomic_init(&r->in_use, true);
+
+    struct epoch_record *first = atomic_load(&records);
+    do {
+        r->next = first;
+    } while (!atomic_compare_exchange_weak(&records, &first, r));
+    my_record = r;
+}
+
+void epoch_unregister()
+{
+    if (my_record == NULL)
+        return;
+
+    epoch_offline();
+    atomic_store(&my_record->in_use, false);
+    my_record = NULL;
+}
+
+void epoch_online()
+{
+    if (my_record == NULL)
+        return;
+
+    atomic_store(&my_record->seen, atomic_load(&global_epoch));
+    // the store above must be visible before we read any shared pointer
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_offline()
+{
+    if (my_record == NULL)
+        return;
+
+    atomic_store(&my_record->seen, EPOCH_OFFLINE);
+    if (atomic_load_explicit(&limbo_count, memory_order_relaxed) >= EPOCH_RECLAIM_BATCH)
+        epoch_reclaim();
+}
+
+void epoch_quiescent()
+{
+    if (my_record == NULL)
+        return;
+
+    atomic_store(&my_record->seen, atomic_load(&global_epoch));
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&limbo_count, memory_order_relaxed) >= EPOCH_RECLAIM_BATCH)
+        epoch_reclaim();
+}
+
+void epoch_retire(void *ptr, epoch_destructor destructor)
+{
+    if (ptr == NULL)
+        return;
+
+    struct retired *node = malloc(sizeof(struct retired));
+    if (node == NULL) {
+        chilog(CRITICAL, "epoch_retire: fail to allocate memory");
+        exit(1);
+    }
+    node->ptr = ptr;
+    node->destructor = destructor;
+    // any reader that sees this epoch (or a later one) at a quiescent
+    // state can no longer reach ptr
+    node->epoch = atomic_fetch_add(&global_epoch, 1) + 1;
+
+    struct retired *first = atomic_load(&limbo);
+    do {
+        node->next = first;
+    } while (!atomic_compare_exchange_weak(&limbo, &first, node));
+
+    atomic_fetch_add_explicit(&limbo_count, 1, memory_order_relaxed);
+    STATS_ADD(retired_pending, 1);
+}
+
+epoch_pin_t *epoch_pin()
+{
+    uint64_t epoch = my_record != NULL ? atomic_load(&my_record->seen) : EPOCH_OFFLINE;
+    if (epoch == EPOCH_OFFLINE) {
+        chilog(WARNING, "epoch_pin: called while offline");
+        epoch = atomic_load(&global_epoch);
+    }
+
+    struct epoch_pin *pin = NULL;
+    for (struct epoch_pin *p = atomic_load(&pins); p != NULL; p = p->next) {
+        bool expected = false;
+        if (!atomic_load(&p->in_use) && atomic_compare_exchange_strong(&p->in_use, &expected, true)) {
+            pin = p;
+            break;
+        }
+    }
+
+    if (pin == NULL) {
+        pin = calloc(1, sizeof(struct epoch_pin));
+        if (pin == NULL) {
+            chilog(CRITICAL, "epoch_pin: fail to allocate memory");
+            exit(1);
+        }
+        atomic_init(&pin->epoch, EPOCH_OFFLINE);
+        atomic_init(&pin->in_use, true);
+        struct epoch_pin *first = atomic_load(&pins);
+        do {
+            pin->next = first;
+        } while (!atomic_compare_exchange_weak(&pins, &first, pin));
+    }
+
+    // this must happen before our own next quiescent state
+    atomic_store(&pin->epoch, epoch);
+    return pin;
+}
+
+void epoch_unpin(epoch_pin_t *pin)
+{
+    atomic_store(&pin->epoch, EPOCH_OFFLINE);
+    atomic_store(&pin->in_use, false);
+}
+
+/**
+ * @brief the oldest epoch any online thread or pin may still be reading in
+ *
+ * @return uint64_t: EPOCH_OFFLINE if no thread is online
+ */
+static uint64_t oldest_seen_epoch()
+{
+    uint64_t oldest = EPOCH_OFFLINE;
+    for (struct epoch_record *r = atomic_load(&records); r != NULL; r = r->next) {
+        uint64_t seen = atomic_load(&r->seen);
+        if (seen < oldest)
+            oldest = seen;
+    }
+    // pins are read after the records: a pin is set before its creator's
+    // next quiescent state, so if we missed the creator's old epoch above
+    // we are sure to see the pin here
+    for (struct epoch_pin *p = atomic_load(&pins); p != NULL; p = p->next) {
+        uint64_t epoch = atomic_load(&p->epoch);
+        if (epoch < oldest)
+            oldest = epoch;
+    }
+    return oldest;
+}
+
+void epoch_reclaim()
+{
+    struct retired *list = atomic_exchange(&limbo, NULL);
+    if (list == NULL)
+        return;
+
+    uint64_t safe = oldest_seen_epoch();
+
+    struct retired *keep = NULL, *keep_tail = NULL;
+    long freed = 0;
+    while (list != NULL) {
+        struct retired *next = list->next;
+        if (list->epoch <= safe) {
+            list->destructor(list->ptr);
+            free(list);
+            freed++;
+        } else {
+            list->next = keep;
+            keep = list;
+            if (keep_tail == NULL)
+                keep_tail = list;
+        }
+        list = next;
+    }
+
+    if (keep != NULL) {
+        struct retired *first = atomic_load(&limbo);
+        do {
+            keep_tail->next = first;
+        } while (!atomic_compare_exchange_weak(&limbo, &first, keep));
+    }
+
+    if (freed > 0) {
+        atomic_fetch_sub_explicit(&limbo_count, freed, memory_order_relaxed);
+        STATS_SUB(retired_pending, freed);
+        chilog(DEBUG, "epoch_reclaim: freed %ld retired objects", freed);
+    }
+}
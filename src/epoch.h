@@ -0,0 +1,97 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * Quiescent-state based reclamation of shared objects.
+ *
+ * Lookups like get_user() or get_channel() hand out raw pointers that the
+ * caller keeps using after the table lock has been released. An object that
+ * is removed from its table therefore can't be freed right away: it is
+ * retired with epoch_retire() instead, and freed once every worker thread
+ * has passed through a quiescent state (a point where it holds no pointers
+ * into the shared tables).
+ *
+ * A worker thread is "online" while it handles commands and "offline" while
+ * it blocks in recv(), which the reclaimer never has to wait for:
+ *
+ *     epoch_register();
+ *     while (...) {
+ *         epoch_offline();
+ *         recv(...);
+ *         epoch_online();
+ *         ... handle commands, calling epoch_quiescent() between them ...
+ *     }
+ *     epoch_unregister();
+ *
+ * Retired objects are freed in batches by whichever thread next reaches a
+ * quiescent state, so readers never take a lock for this.
+ */
+
+typedef void (*epoch_destructor)(void *ptr);
+
+/**
+ * @brief register the calling thread as a reader, it starts offline
+ */
+void epoch_register();
+
+/**
+ * @brief unregister the calling thread, it must not hold any pointers
+ * into the shared tables anymore
+ */
+void epoch_unregister();
+
+/**
+ * @brief the calling thread is about to look things up in the shared tables
+ */
+void epoch_online();
+
+/**
+ * @brief the calling thread holds no pointers into the shared tables and
+ * won't until the next epoch_online(), e.g. it is about to block in recv()
+ */
+void epoch_offline();
+
+/**
+ * @brief the calling thread holds no pointers into the shared tables right
+ * now, but stays online
+ */
+void epoch_quiescent();
+
+/**
+ * @brief free an object once no thread can still be using it,
+ * the object must already be unreachable from the shared tables
+ *
+ * @param ptr
+ * @param destructor: called with ptr after the grace period
+ */
+void epoch_retire(void *ptr, epoch_destructor destructor);
+
+/**
+ * @brief a pin keeps alive everything its creator could see when it was
+ * made, past the creator's next quiescent state; this is how pointers are
+ * handed to another thread (e.g. a job queued for a worker pool)
+ */
+typedef struct epoch_pin epoch_pin_t;
+
+/**
+ * @brief pin what the calling thread can see right now,
+ * must be called while online
+ *
+ * @return epoch_pin_t*
+ */
+epoch_pin_t *epoch_pin();
+
+/**
+ * @brief drop a pin, can be called from any thread
+ *
+ * @param pin
+ */
+void epoch_unpin(epoch_pin_t *pin);
+
+/**
+ * @brief free every retired object whose grace period is over now,
+ * regardless of the batch size
+ */
+void epoch_reclaim();
+
+#endif
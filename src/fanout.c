@@ -0,0 +1,187 @@
+#include "fanout.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sds.h>
+
+#include "log.h"
+#include "epoch.h"
+#include "handler.h"
+#include "arena.h"
+
+/**
+ * @brief a message shared by all the jobs it was split into
+ */
+struct fanout_msg {
+    atomic_int refs;
+    sds data;
+    user_handle sender;
+    // keeps the sender and the recipients alive until the last job is done
+    epoch_pin_t *pin;
+};
+
+struct fanout_job {
+    struct fanout_msg *msg;
+    user_handle *recipients;
+    int count;
+    struct fanout_job *next;
+};
+
+struct fanout_worker {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct fanout_job *head;
+    struct fanout_job *tail;
+};
+
+static struct fanout_worker *workers;
+static int nworkers;
+static int threshold;
+
+static void *fanout_thread(void *args);
+
+int start_fanout_pool(int fanout_threshold, int nthreads)
+{
+    if (fanout_threshold <= 0 || nthreads <= 0) {
+        threshold = 0;
+        return 0;
+    }
+
+    workers = calloc(nthreads, sizeof(struct fanout_worker));
+    if (workers == NULL) {
+        chilog(CRITICAL, "start_fanout_pool: fail to allocate memory");
+        exit(1);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&workers[i].mutex, NULL);
+        pthread_cond_init(&workers[i].cond, NULL);
+        if (pthread_create(&workers[i].thread, NULL, fanout_thread, &workers[i]) != 0) {
+            chilog(ERROR, "start_fanout_pool: could not create a fan-out thread");
+            // the ones already started stay idle
+            return -1;
+        }
+        pthread_detach(workers[i].thread);
+    }
+
+    nworkers = nthreads;
+    threshold = fanout_threshold;
+    chilog(INFO, "fan-out pool: %d threads for channels of %d or more", nthreads, fanout_threshold);
+    return 0;
+}
+
+int fanout_threshold()
+{
+    return threshold;
+}
+
+static void release_msg(struct fanout_msg *msg)
+{
+    atomic_fetch_sub(&msg->sender->fanout_pending, 1);
+    if (atomic_fetch_sub(&msg->refs, 1) == 1) {
+        epoch_unpin(msg->pin);
+        sdsfree(msg->data);
+        free(msg);
+    }
+}
+
+static void enqueue(struct fanout_worker *worker, struct fanout_job *job)
+{
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->tail == NULL) {
+        worker->head = job;
+    } else {
+        worker->tail->next = job;
+    }
+    worker->tail = job;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+void fanout_submit(user_handle sender, user_handle *recipients, int count, char *msg)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    // a recipient always goes to the same worker, which keeps its messages in order
+    int *per_worker = arena_alloc(nworkers * sizeof(int));
+    struct fanout_job *jobs = arena_alloc(nworkers * sizeof(struct fanout_job));
+    struct fanout_msg *shared = calloc(1, sizeof(struct fanout_msg));
+    if (shared == NULL) {
+        chilog(CRITICAL, "fanout_submit: fail to allocate memory");
+        exit(1);
+    }
+
+    for (int i = 0; i < count; i++) {
+        per_worker[recipients[i]->client_fd % nworkers]++;
+    }
+
+    int njobs = 0;
+    for (int w = 0; w < nworkers; w++) {
+        if (per_worker[w] == 0) {
+            continue;
+        }
+        jobs[w].recipients = malloc(per_worker[w] * sizeof(user_handle));
+        if (jobs[w].recipients == NULL) {
+            chilog(CRITICAL, "fanout_submit: fail to allocate memory");
+            exit(1);
+        }
+        jobs[w].msg = shared;
+        njobs++;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct fanout_job *job = &jobs[recipients[i]->client_fd % nworkers];
+        job->recipients[job->count++] = recipients[i];
+    }
+
+    shared->data = sdsdup(msg);
+    shared->sender = sender;
+    shared->pin = epoch_pin();
+    atomic_init(&shared->refs, njobs);
+    atomic_fetch_add(&sender->fanout_pending, njobs);
+
+    for (int w = 0; w < nworkers; w++) {
+        if (jobs[w].count == 0) {
+            continue;
+        }
+        struct fanout_job *job = malloc(sizeof(struct fanout_job));
+        if (job == NULL) {
+            chilog(CRITICAL, "fanout_submit: fail to allocate memory");
+            exit(1);
+        }
+        *job = jobs[w];
+        job->next = NULL;
+        enqueue(&workers[w], job);
+    }
+}
+
+static void *fanout_thread(void *args)
+{
+    struct fanout_worker *worker = args;
+
+    while (true) {
+        pthread_mutex_lock(&worker->mutex);
+        while (worker->head == NULL) {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+        struct fanout_job *job = worker->head;
+        worker->head = job->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&worker->mutex);
+
+        for (int i = 0; i < job->count; i++) {
+            send_reply(job->msg->data, job->recipients[i], false);
+        }
+
+        release_msg(job->msg);
+        free(job->recipients);
+        free(job);
+    }
+    return NULL;
+}
@@ -0,0 +1,46 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "user.h"
+
+/*
+ * A pool of threads that delivers messages to the members of very large
+ * channels, so that the sender's thread doesn't have to post to every
+ * member itself.
+ *
+ * Recipients are split between the pool threads by connection, always
+ * sending a given recipient's messages through the same thread, so every
+ * recipient still gets them in the order they were submitted.
+ */
+
+/**
+ * @brief start the pool
+ *
+ * @param threshold: channels with at least this many recipients are
+ *                   delivered by the pool, 0 disables it
+ * @param nthreads: number of pool threads
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+int start_fanout_pool(int threshold, int nthreads);
+
+/**
+ * @brief the recipient count from which the pool is used
+ *
+ * @return int: 0 if the pool is disabled
+ */
+int fanout_threshold();
+
+/**
+ * @brief hand a message for a set of recipients to the pool and return
+ * right away; must be called while online (see epoch.h), the recipients
+ * are kept alive until they have been delivered to
+ *
+ * @param sender: the user on whose behalf this is sent, its fanout_pending
+ *                count covers the message until it has been delivered
+ * @param recipients
+ * @param count
+ * @param msg
+ */
+void fanout_submit(user_handle sender, user_handle *recipients, int count, char *msg);
+
+#endif
@@ -1,8 +1,13 @@
 #include <sys/socket.h>
 #include <sds.h>
 #include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "handler.h"
 #include "user.h"
@@ -12,9 +17,36 @@
 #include "reply.h"
 #include "connection.h"
 #include "channel.h"
+#include "mode.h"
+#include "stats.h"
+#include "alloc.h"
+#include "probes.h"
+#include "lockprof.h"
+#include "fanout.h"
+#include "epoch.h"
+#include "mask.h"
+#include "arena.h"
+#include "single_service.h"
 
 #define MAX_BUFFER_SIZE 512
 
+// while handling a command, replies are sent early once they grow past this
+#define OUTBUF_FLUSH_SIZE 16384
+
+// how much other threads may queue for a client before it is dropped
+#define SENDQ_MAX (1024 * 1024)
+
+// the connection served by the calling thread, see own_connection()
+static _Thread_local user_handle owned_user;
+
+// a long reply built offline (e.g. LIST) is sent whenever this much of it
+// is queued, well before send_reply() would flush it online
+#define OUTBUF_STREAM_SIZE (OUTBUF_FLUSH_SIZE / 2)
+
+// room kept in an RPL_NAMREPLY for the nick it is sent to, a longer
+// nick makes for lines a little over MAX_BUFFER_SIZE
+#define NAMES_NICK_MAX 30
+
 #define SUFFICIENT 1
 #define INSUFFICIENT 2
 
@@ -30,6 +62,19 @@
  */
 static int check_insufficient_param(int have, int target, char *cmd, user_handle user_info, context_handle ctx);
 
+static int flush_outbuf(user_handle user_info, int flags);
+
+/**
+ * @brief send the replies queued for the calling thread's own client once
+ * there are OUTBUF_STREAM_SIZE of them, offline (see epoch.h) since a slow
+ * client can keep us waiting; for long replies whose handler holds no
+ * pointers into the shared tables
+ *
+ * @param user_info
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int stream_outbuf(user_handle user_info);
+
 #define REGISTERED 3
 #define NOTREGISTERED 4
 /**
@@ -41,16 +86,6 @@ static int check_insufficient_param(int have, int target, char *cmd, user_handle
  */
 static int check_registered(context_handle ctx, user_handle user_info);
 
-/**
- * @brief a helper function in charge of sending replies or error messages to the client side
- * This function ensures that send() does send the whole message successfully
- * @param str message to be sent
- * @param user_info struct that stores user relevant information 
- * @param to_free whether the str needs to be freed
- * @return int -1: FAILURE 0: SUCCESS
- */
-int send_reply(char *str, user_handle user_info, bool to_free);
-
 /**
  * @brief a helper function designed specially for "NICK" and "USER" to send welcome message
  * 
@@ -60,16 +95,71 @@ int send_reply(char *str, user_handle user_info, bool to_free);
  */
 static int send_welcome(user_handle user_info, char *server_host_name);
 
+/**
+ * @brief how long the list of names in an RPL_NAMREPLY can be
+ * 
+ * @param ctx 
+ * @param channel_name: the channel the reply is about, "*" for none
+ * @return size_t 
+ */
+static size_t names_budget(context_handle ctx, const char *channel_name);
+
+/**
+ * @brief send the RPL_NAMREPLY lines of a channel, without RPL_ENDOFNAMES
+ * 
+ * @param ctx 
+ * @param user_info 
+ * @param channel 
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int send_names(context_handle ctx, user_handle user_info, channel_handle channel);
+
+/**
+ * @brief whether a user may talk on a channel: it has to be on it and,
+ * if the channel is moderated, have voice or be an operator
+ * 
+ * @param channel 
+ * @param user 
+ * @return bool 
+ */
+static bool can_send_to_channel(channel_handle channel, user_handle user);
+
+/**
+ * @brief MODE on a channel: query its modes, or change channel and member modes
+ * 
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int channel_MODE(context_handle ctx, user_handle user_info, message_handle msg);
+
+/**
+ * @brief MODE on a user: query or change the user's own modes
+ * 
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int user_MODE(context_handle ctx, user_handle user_info, message_handle msg);
+
 /**
  * @brief send message(reply) to all the members in the channel except the sender itself
- * if there's no need to exclude the sender, set sender_nick argument as NULL
+ * if there's no need to exclude the sender, set sender argument as NULL
  * @param ctx global context
  * @param channel broadcast message to this channel
  * @param reply the content of the message
- * @param sender_nick nick name of the sender
- * @return int -1: FAILURE 1: SUCCESS
+ * @param sender the sender
+ * @return int 1: SUCCESS (members that can't be reached are skipped)
+ */
+int notify_all_channel_members(context_handle ctx, channel_handle channel, char *reply, user_handle sender);
+
+/**
+ * @brief send message(reply) once to every user sharing at least one of the
+ * channels, however many of them it shares
+ * @param ctx global context
+ * @param channels the channels whose members are notified
+ * @param nchannels
+ * @param reply the content of the message
+ * @param sender the sender, or NULL to include it
+ * @return int 1: SUCCESS (members that can't be reached are skipped)
  */
-int notify_all_channel_members(context_handle ctx, channel_handle channel, char *reply, char * sender_nick);
+int notify_users_on_channels(context_handle ctx, channel_handle *channels, int nchannels, char *reply, user_handle sender);
 
 
 /*
@@ -81,7 +171,7 @@ int handler_NICK(context_handle ctx, user_handle user_info, message_handle msg)
 {
     if (msg->nparams < 1) {
         // ERR_NONICKNAMEGIVEN
-        chilog(WARNING, "handler_NICK: no nickname given");
+        chilog_ratelimited(WARNING, 10, "handler_NICK: no nickname given");
         char *temp_nick = user_info->nick ? user_info->nick : "*";
         sds reply = sdscatfmt(sdsempty(), ":%s %s %s :No nickname given\r\n",
                               ctx->server_host, ERR_NONICKNAMEGIVEN, temp_nick);
@@ -100,7 +190,7 @@ int handler_NICK(context_handle ctx, user_handle user_info, message_handle msg)
 
     switch (rv) {
     case NICK_IN_USE:
-        chilog(WARNING, "nick %s already in use", new_nick);
+        chilog_ratelimited(WARNING, 10, "nick %s already in use", new_nick);
         char *temp_nick = user_info->nick ? user_info->nick : "*";
         sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :Nickname is already in use\r\n",
                               ctx->server_host, ERR_NICKNAMEINUSE, temp_nick, new_nick);
@@ -116,17 +206,14 @@ int handler_NICK(context_handle ctx, user_handle user_info, message_handle msg)
         if (affected_channel_count > 0) {
             sds reply = sdscatfmt(sdsempty(), ":%s!%s@%s NICK :%s\r\n",
                                   old_nick, user_info->username, user_info->client_host_name, new_nick);
-            for (int i = 0; i < affected_channel_count; i++) {
-                if (affected_channels[i] == NULL) {
-                    chilog(WARNING, "handler_NICK: null channel");
-                    continue;
-                }
-
-                notify_all_channel_members(ctx, affected_channels[i], reply, NULL);
-            }
+            // someone sharing several channels with us gets it only once
+            notify_users_on_channels(ctx, affected_channels, affected_channel_count, reply, NULL);
             sdsfree(reply);
-            free(affected_channels);
         }
+        // the old nick was retired, it's still good until we're quiescent
+        record_whowas(ctx, user_info, old_nick);
+        notify_monitors(ctx, user_info, old_nick, false);
+        notify_monitors(ctx, user_info, user_info->nick, true);
         return SUCCESS;
     } else if (can_register(user_info)) {
         user_info->registered = true;
@@ -134,6 +221,7 @@ int handler_NICK(context_handle ctx, user_handle user_info, message_handle msg)
         modify_connection_state(ctx, user_info->client_fd, REGISTERED_CONNECTION);
         send_welcome(user_info, ctx->server_host);
         handler_LUSERS(ctx, user_info, msg);
+        notify_monitors(ctx, user_info, user_info->nick, true);
     } else {
         // labels this connection as a user connection
         modify_connection_state(ctx, user_info->client_fd, USER_CONNECTION);
@@ -154,15 +242,17 @@ int handler_USER(context_handle ctx, user_handle user_info, message_handle msg)
 
     int ret = check_insufficient_param(msg->nparams, 4, "USER", user_info, ctx);
     if (ret == INSUFFICIENT) {
-        chilog(WARNING, "handler_USER: insufficient params");
+        chilog_ratelimited(WARNING, 10, "handler_USER: insufficient params");
         return SUCCESS;
     } else if (ret == FAILURE) {
         chilog(ERROR, "handler_USER: error in sending insufficient params reply");
         return FAILURE;
     }
 
+    alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
     user_info->username = sdscpylen(sdsempty(), msg->params[0], sdslen(msg->params[0]));
     user_info->fullname = sdscpylen(sdsempty(), msg->params[msg->nparams - 1], sdslen(msg->params[msg->nparams - 1]));
+    alloc_set_tag(prev);
 
     if (can_register(user_info)) {
         // add to ctx->user_table
@@ -174,6 +264,7 @@ int handler_USER(context_handle ctx, user_handle user_info, message_handle msg)
         // send welcome
         send_welcome(user_info, ctx->server_host);
         handler_LUSERS(ctx, user_info, msg);
+        notify_monitors(ctx, user_info, user_info->nick, true);
     } else {
         // labels this connection as a user connection
         modify_connection_state(ctx, user_info->client_fd, USER_CONNECTION);
@@ -236,8 +327,8 @@ int handler_PRIVMSG(context_handle ctx, user_handle user_info, message_handle ms
     }
 
     //if the name is a channel
-    //firstly, check whether the sender is in this channel
-    if(!already_on_channel(target_channel, user_info->nick)) {
+    //firstly, check whether the sender may talk there
+    if(!can_send_to_channel(target_channel, user_info)) {
         sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :Cannot send to channel\r\n",
                               ctx->server_host, ERR_CANNOTSENDTOCHAN, user_info->nick, target_name);
         return send_reply(reply, user_info, true);
@@ -248,7 +339,7 @@ int handler_PRIVMSG(context_handle ctx, user_handle user_info, message_handle ms
                           user_info->nick, user_info->username, user_info->client_host_name,
                           target_name, msg->params[msg->nparams - 1]);
     // notify all
-    notify_all_channel_members(ctx, target_channel, reply, user_info->nick);
+    notify_all_channel_members(ctx, target_channel, reply, user_info);
     sdsfree(reply);
     return SUCCESS;
 }
@@ -265,7 +356,7 @@ int handler_NOTICE(context_handle ctx, user_handle user_info, message_handle msg
     }
 
     if (!msg->longlast || msg->nparams < 2) {
-        chilog(WARNING, "handler_NOTICE: error params");
+        chilog_ratelimited(WARNING, 10, "handler_NOTICE: error params");
         return SUCCESS;
     }
 
@@ -281,7 +372,7 @@ int handler_NOTICE(context_handle ctx, user_handle user_info, message_handle msg
     }
 
     if (target_user == NULL && target_channel == NULL) {
-        chilog(WARNING, "handler_NOTICE: no such nick/channel");
+        chilog_ratelimited(WARNING, 10, "handler_NOTICE: no such nick/channel");
         return SUCCESS;
     }
 
@@ -294,9 +385,9 @@ int handler_NOTICE(context_handle ctx, user_handle user_info, message_handle msg
     }
 
     //if the name is a channel
-    //firstly, check whether the sender is in this channel
-    if(!already_on_channel(target_channel, user_info->nick)) {
-        chilog(WARNING, "handler_NOTICE: sender not in channel");
+    //firstly, check whether the sender may talk there
+    if(!can_send_to_channel(target_channel, user_info)) {
+        chilog_ratelimited(WARNING, 10, "handler_NOTICE: sender can't send to channel");
         return SUCCESS;
     }
 
@@ -305,7 +396,7 @@ int handler_NOTICE(context_handle ctx, user_handle user_info, message_handle msg
                           user_info->nick, user_info->username, user_info->client_host_name,
                           target_name, msg->params[msg->nparams - 1]);
     // notify all
-    notify_all_channel_members(ctx, target_channel, reply, user_info->nick);
+    notify_all_channel_members(ctx, target_channel, reply, user_info);
     sdsfree(reply);
     return SUCCESS;
 }
@@ -383,6 +474,584 @@ int handler_WHOIS(context_handle ctx, user_handle user_info, message_handle msg)
 
 
 
+// the fields of a user a WHO mask can be matched against
+#define WHO_MATCH_NICK      0x01
+#define WHO_MATCH_USER      0x02
+#define WHO_MATCH_HOST      0x04
+#define WHO_MATCH_SERVER    0x08
+#define WHO_MATCH_REALNAME  0x10
+#define WHO_MATCH_ALL       0x1f
+
+// the fields a WHOX reply can have, in the order they are sent
+#define WHOX_FIELDS "tcuihsnfdlaor"
+
+/**
+ * @brief the options of a WHO, its second parameter: "o" for IRC
+ * operators only and the fields to match the mask against ("n", "u", "h",
+ * "s", "r"; all of them if none is given), then for a WHOX, "%", the
+ * fields to reply with and an optional ",token", e.g. "n%tnuhf,42"
+ */
+struct who_query {
+    bool opers_only;
+    uint8_t match;
+    bool whox;
+    char fields[sizeof(WHOX_FIELDS)];   // in the order they are sent
+    char token[4];
+};
+
+static void parse_who_query(const char *options, struct who_query *query)
+{
+    query->opers_only = false;
+    query->match = 0;
+    query->whox = false;
+    query->fields[0] = '\0';
+    strcpy(query->token, "0");
+    if (options == NULL) {
+        query->match = WHO_MATCH_ALL;
+        return;
+    }
+
+    const char *c = options;
+    for (; *c != '\0' && *c != '%'; c++) {
+        switch (*c) {
+        case 'o': query->opers_only = true; break;
+        case 'n': query->match |= WHO_MATCH_NICK; break;
+        case 'u': query->match |= WHO_MATCH_USER; break;
+        case 'h': query->match |= WHO_MATCH_HOST; break;
+        case 's': query->match |= WHO_MATCH_SERVER; break;
+        case 'r': query->match |= WHO_MATCH_REALNAME; break;
+        }
+    }
+    if (query->match == 0) {
+        query->match = WHO_MATCH_ALL;
+    }
+    if (*c != '%') {
+        return;
+    }
+
+    query->whox = true;
+    const char *token = strchr(c, ',');
+    size_t len = token != NULL ? (size_t) (token - c) : strlen(c);
+    int n = 0;
+    for (const char *f = WHOX_FIELDS; *f != '\0'; f++) {
+        if (memchr(c, *f, len) != NULL)
+            query->fields[n++] = *f;
+    }
+    query->fields[n] = '\0';
+    if (token != NULL && strlen(token + 1) >= 1 && strlen(token + 1) <= 3
+        && strspn(token + 1, "0123456789") == strlen(token + 1)) {
+        strcpy(query->token, token + 1);
+    }
+}
+
+/**
+ * @brief render the WHO reply (RPL_WHOREPLY, or RPL_WHOSPCRPL for a WHOX)
+ * about a user
+ *
+ * @param ctx
+ * @param user_info: who asked
+ * @param query
+ * @param channel: the channel the user is listed for, "*" for none
+ * @param user
+ * @param member_modes: the user's modes on that channel
+ * @return char*: carved from the caller's arena
+ */
+static char *who_line(context_handle ctx, user_handle user_info, const struct who_query *query,
+                      const char *channel, user_handle user, uint8_t member_modes)
+{
+    char flags[4];
+    int f = 0;
+    flags[f++] = (user->modes & USER_MODE_AWAY) ? 'G' : 'H';
+    if (user->modes & USER_MODE_OPERATOR)
+        flags[f++] = '*';
+    if (member_modes & MEMBER_MODE_OPERATOR)
+        flags[f++] = '@';
+    else if (member_modes & MEMBER_MODE_VOICE)
+        flags[f++] = '+';
+    flags[f] = '\0';
+
+    sds s;
+    if (!query->whox) {
+        s = sdscatfmt(sdsempty(), ":%s %s %s %s %s %s %s %s %s :0 %s\r\n",
+                      ctx->server_host, RPL_WHOREPLY, user_info->nick, channel, user->username,
+                      user->client_host_name, ctx->server_host, user->nick, flags, user->fullname);
+    } else {
+        s = sdscatfmt(sdsempty(), ":%s %s %s", ctx->server_host, RPL_WHOSPCRPL, user_info->nick);
+        for (const char *c = query->fields; *c != '\0'; c++) {
+            switch (*c) {
+            case 't': s = sdscatfmt(s, " %s", query->token); break;
+            case 'c': s = sdscatfmt(s, " %s", channel); break;
+            case 'u': s = sdscatfmt(s, " %s", user->username); break;
+            case 'i': s = sdscat(s, " 255.255.255.255"); break;
+            case 'h': s = sdscatfmt(s, " %s", user->client_host_name); break;
+            case 's': s = sdscatfmt(s, " %s", ctx->server_host); break;
+            case 'n': s = sdscatfmt(s, " %s", user->nick); break;
+            case 'f': s = sdscatfmt(s, " %s", flags); break;
+            case 'd': s = sdscat(s, " 0"); break;
+            case 'l': s = sdscat(s, " 0"); break;
+            case 'a': s = sdscat(s, " 0"); break;
+            case 'o': s = sdscat(s, " n/a"); break;
+            case 'r': s = sdscatfmt(s, " :%s", user->fullname); break;
+            }
+        }
+        s = sdscatlen(s, "\r\n", 2);
+    }
+    char *line = arena_sds(s, sdslen(s));
+    sdsfree(s);
+    return line;
+}
+
+static bool who_wanted(const struct who_query *query, user_handle user)
+{
+    return user->registered && (!query->opers_only || (user->modes & USER_MODE_OPERATOR));
+}
+
+static bool who_match(const mask_t *mask, uint8_t match, user_handle user)
+{
+    return ((match & WHO_MATCH_NICK) && mask_match(mask, user->nick))
+           || ((match & WHO_MATCH_USER) && mask_match(mask, user->username))
+           || ((match & WHO_MATCH_HOST) && mask_match(mask, user->client_host_name))
+           || ((match & WHO_MATCH_REALNAME) && mask_match(mask, user->fullname));
+}
+
+/**
+ * @brief render the WHO replies about the users matching a mask
+ *
+ * @param ctx
+ * @param user_info
+ * @param mask
+ * @param query
+ * @param count: to store the number of replies
+ * @return char**: carved from the caller's arena
+ */
+static char **who_mask(context_handle ctx, user_handle user_info, char *mask,
+                       const struct who_query *query, int *count)
+{
+    *count = 0;
+
+    // a nick is just that user
+    if (!mask_has_wildcards(mask)) {
+        user_handle user = get_user(ctx, mask);
+        if (user != NULL) {
+            char **lines = arena_alloc(sizeof(char *));
+            if (who_wanted(query, user))
+                lines[(*count)++] = who_line(ctx, user_info, query, "*", user, 0);
+            return lines;
+        }
+    }
+
+    mask_t compiled;
+    mask_compile(&compiled, mask);
+    // everyone is on this server
+    bool everyone = (query->match & WHO_MATCH_SERVER) && mask_match(&compiled, ctx->server_host);
+    uint8_t match = query->match & ~WHO_MATCH_SERVER;
+    if (!everyone && match == 0) {
+        return NULL;
+    }
+
+    // the users matching by nick or host alone are ranges of the user
+    // directory's indexes, if the mask has a literal prefix; otherwise
+    // every user has to be looked at
+    user_dir_t *dir = get_user_dir(ctx);
+    struct {
+        struct user_dir_entry *users;
+        int start, end;
+    } ranges[2];
+    int nranges = 0;
+    if (!everyone && (match & ~(WHO_MATCH_NICK | WHO_MATCH_HOST)) == 0 && compiled.prefix_len > 0) {
+        if (match & WHO_MATCH_NICK) {
+            ranges[nranges].users = dir->by_nick;
+            ranges[nranges].start = user_dir_nick_range(dir, compiled.pattern, compiled.prefix_len,
+                                                        &ranges[nranges].end);
+            nranges++;
+        }
+        if (match & WHO_MATCH_HOST) {
+            ranges[nranges].users = dir->by_host;
+            ranges[nranges].start = user_dir_host_range(dir, compiled.pattern, compiled.prefix_len,
+                                                        &ranges[nranges].end);
+            nranges++;
+        }
+    } else {
+        ranges[0].users = dir->by_nick;
+        ranges[0].start = 0;
+        ranges[0].end = dir->count;
+        nranges = 1;
+    }
+
+    int total = 0;
+    for (int r = 0; r < nranges; r++) {
+        total += ranges[r].end - ranges[r].start;
+    }
+    char **lines = arena_alloc(total * sizeof(char *));
+    for (int r = 0; r < nranges; r++) {
+        for (int i = ranges[r].start; i < ranges[r].end; i++) {
+            user_handle user = ranges[r].users[i].user;
+            if (!who_wanted(query, user) || (!everyone && !who_match(&compiled, match, user)))
+                continue;
+            // a user in both the nick and the host range is listed once
+            if (r > 0 && (match & WHO_MATCH_NICK) && mask_match(&compiled, user->nick))
+                continue;
+            lines[(*count)++] = who_line(ctx, user_info, query, "*", user, 0);
+        }
+    }
+    return lines;
+}
+
+int handler_WHO(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    int ret = check_registered(ctx, user_info);
+    if (ret != REGISTERED) {
+        return ret;
+    }
+
+    char *mask = msg->nparams >= 1 ? msg->params[0] : "*";
+    struct who_query query;
+    parse_who_query(msg->nparams >= 2 ? msg->params[1] : NULL, &query);
+
+    // the replies are rendered first, then sent (offline, see
+    // stream_outbuf()) as the client takes them
+    char **lines = NULL;
+    int count = 0;
+    if (mask[0] == '#') {
+        channel_handle channel = get_channel(ctx, mask);
+        if (channel) {
+            int members = 0;
+            uint8_t *modes;
+            user_handle *users = member_users_modes_arr(channel, &modes, &members);
+            lines = arena_alloc(members * sizeof(char *));
+            for (int i = 0; i < members; i++) {
+                if (who_wanted(&query, users[i]))
+                    lines[count++] = who_line(ctx, user_info, &query, channel->name, users[i], modes[i]);
+            }
+        }
+    } else if (strcmp(mask, "*") == 0 || strcmp(mask, "0") == 0) {
+        int n = 0;
+        user_handle *users = get_users_sharing_no_channel(ctx, user_info, &n);
+        lines = arena_alloc(n * sizeof(char *));
+        for (int i = 0; i < n; i++) {
+            if (who_wanted(&query, users[i]))
+                lines[count++] = who_line(ctx, user_info, &query, "*", users[i], 0);
+        }
+    } else {
+        lines = who_mask(ctx, user_info, mask, &query, &count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (send_reply(lines[i], user_info, false) == FAILURE || stream_outbuf(user_info) == FAILURE)
+            return FAILURE;
+    }
+
+    sds r_end = sdscatfmt(sdsempty(), ":%s %s %s %s :End of WHO list\r\n",
+                          ctx->server_host, RPL_ENDOFWHO, user_info->nick, mask);
+    return send_reply(r_end, user_info, true);
+}
+
+
+void notify_monitors(context_handle ctx, user_handle user, const char *nick, bool online)
+{
+    int count = 0;
+    user_handle *watchers = get_watchers(ctx, nick, &count);
+    for (int i = 0; i < count; i++) {
+        sds reply = online ?
+                    sdscatfmt(sdsempty(), ":%s %s %s :%s!%s@%s\r\n", ctx->server_host, RPL_MONONLINE,
+                              watchers[i]->nick, nick, user->username, user->client_host_name) :
+                    sdscatfmt(sdsempty(), ":%s %s %s :%s\r\n", ctx->server_host, RPL_MONOFFLINE,
+                              watchers[i]->nick, nick);
+        // a watcher that can't be reached is being dropped anyway
+        send_reply(reply, watchers[i], true);
+    }
+}
+
+/**
+ * @brief send a list in as few replies as it fits in, e.g. the targets of
+ * an RPL_MONONLINE: ":server 730 nick :a!b@c,d!e@f"
+ *
+ * @param ctx
+ * @param user_info
+ * @param code
+ * @param items
+ * @param n
+ * @param sep: between the items
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int send_list_replies(context_handle ctx, user_handle user_info, const char *code,
+                             char **items, int n, char sep)
+{
+    sds reply = NULL;
+    size_t header = 0;
+    for (int i = 0; i <= n; i++) {
+        size_t len = i < n ? strlen(items[i]) : 0;
+        if (reply != NULL && (i == n || sdslen(reply) + 1 + len + 2 > MAX_BUFFER_SIZE)) {
+            reply = sdscatlen(reply, "\r\n", 2);
+            if (send_reply(reply, user_info, true) == FAILURE)
+                return FAILURE;
+            reply = NULL;
+        }
+        if (i == n)
+            break;
+        if (reply == NULL) {
+            reply = sdscatfmt(sdsempty(), ":%s %s %s :", ctx->server_host, code, user_info->nick);
+            header = sdslen(reply);
+        } else if (sdslen(reply) > header) {
+            reply = sdscatlen(reply, &sep, 1);
+        }
+        reply = sdscatlen(reply, items[i], len);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief split the parameters of a command into words, at sep and at the
+ * spaces of a trailing parameter
+ *
+ * @param msg
+ * @param first: the first parameter to split
+ * @param sep
+ * @param count: to store the number of words
+ * @return char**: carved from the caller's arena, like the words
+ */
+static char **split_params(message_handle msg, int first, const char *sep, int *count)
+{
+    size_t total = 0;
+    for (int i = first; i < msg->nparams; i++) {
+        total += strlen(msg->params[i]) + 1;
+    }
+    char **words = arena_alloc((total / 2 + 1) * sizeof(char *));
+    int n = 0;
+    for (int i = first; i < msg->nparams; i++) {
+        char *param = arena_sds(msg->params[i], strlen(msg->params[i]));
+        char *saveptr;
+        for (char *w = strtok_r(param, sep, &saveptr); w != NULL; w = strtok_r(NULL, sep, &saveptr)) {
+            words[n++] = w;
+        }
+    }
+    *count = n;
+    return words;
+}
+
+/**
+ * @brief send RPL_MONONLINE and RPL_MONOFFLINE about some nicks
+ *
+ * @param ctx
+ * @param user_info
+ * @param nicks
+ * @param n
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int send_monitor_status(context_handle ctx, user_handle user_info, char **nicks, int n)
+{
+    user_handle *users = arena_alloc(n * sizeof(user_handle));
+    get_users(ctx, nicks, n, users);
+
+    char **online = arena_alloc(n * sizeof(char *));
+    char **offline = arena_alloc(n * sizeof(char *));
+    int non = 0, noff = 0;
+    for (int i = 0; i < n; i++) {
+        if (users[i] != NULL && users[i]->registered) {
+            sds s = sdscatfmt(sdsempty(), "%s!%s@%s", users[i]->nick, users[i]->username, users[i]->client_host_name);
+            online[non++] = arena_sds(s, sdslen(s));
+            sdsfree(s);
+        } else {
+            offline[noff++] = nicks[i];
+        }
+    }
+    if (non > 0 && send_list_replies(ctx, user_info, RPL_MONONLINE, online, non, ',') == FAILURE)
+        return FAILURE;
+    if (noff > 0 && send_list_replies(ctx, user_info, RPL_MONOFFLINE, offline, noff, ',') == FAILURE)
+        return FAILURE;
+    return SUCCESS;
+}
+
+int handler_MONITOR(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    int ret = check_registered(ctx, user_info);
+    if (ret != REGISTERED) {
+        return ret;
+    }
+
+    ret = check_insufficient_param(msg->nparams, 1, "MONITOR", user_info, ctx);
+    if (ret != SUFFICIENT) {
+        return ret;
+    }
+
+    char op = msg->params[0][0];
+    if ((op == '+' || op == '-') && msg->nparams < 2) {
+        return check_insufficient_param(msg->nparams, 2, "MONITOR", user_info, ctx);
+    }
+
+    int n = 0;
+    char **targets = NULL;
+    switch (op) {
+    case '+':
+        targets = split_params(msg, 1, ",", &n);
+        for (int i = 0; i < n; i++) {
+            if (add_monitor(ctx, user_info, targets[i]) == MONITOR_LIST_FULL) {
+                // the targets from here on weren't added
+                sds rest = sdsjoin(targets + i, n - i, ",");
+                sds reply = sdscatfmt(sdsempty(), ":%s %s %s %i %s :Monitor list is full.\r\n",
+                                      ctx->server_host, ERR_MONLISTFULL, user_info->nick, MONITOR_MAX, rest);
+                sdsfree(rest);
+                if (send_reply(reply, user_info, true) == FAILURE)
+                    return FAILURE;
+                n = i;
+                break;
+            }
+        }
+        return send_monitor_status(ctx, user_info, targets, n);
+    case '-':
+        targets = split_params(msg, 1, ",", &n);
+        for (int i = 0; i < n; i++) {
+            remove_monitor(ctx, user_info, targets[i]);
+        }
+        return SUCCESS;
+    case 'C':
+    case 'c':
+        clear_monitors(ctx, user_info);
+        return SUCCESS;
+    case 'L':
+    case 'l':
+        // only this thread changes the list
+        if (send_list_replies(ctx, user_info, RPL_MONLIST, user_info->monitors, user_info->nmonitors, ',') == FAILURE)
+            return FAILURE;
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s :End of MONITOR list\r\n",
+                              ctx->server_host, RPL_ENDOFMONLIST, user_info->nick);
+        return send_reply(reply, user_info, true);
+    case 'S':
+    case 's':
+        return send_monitor_status(ctx, user_info, user_info->monitors, user_info->nmonitors);
+    default:
+        return SUCCESS;
+    }
+}
+
+int handler_ISON(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    int ret = check_registered(ctx, user_info);
+    if (ret != REGISTERED) {
+        return ret;
+    }
+
+    ret = check_insufficient_param(msg->nparams, 1, "ISON", user_info, ctx);
+    if (ret != SUFFICIENT) {
+        return ret;
+    }
+
+    int n = 0;
+    char **nicks = split_params(msg, 0, " ", &n);
+    user_handle *users = arena_alloc(n * sizeof(user_handle));
+    get_users(ctx, nicks, n, users);
+
+    sds reply = sdscatfmt(sdsempty(), ":%s %s %s :", ctx->server_host, RPL_ISON, user_info->nick);
+    bool first = true;
+    for (int i = 0; i < n; i++) {
+        if (users[i] != NULL && users[i]->registered) {
+            reply = sdscatfmt(reply, first ? "%s" : " %s", nicks[i]);
+            first = false;
+        }
+    }
+    reply = sdscatlen(reply, "\r\n", 2);
+    return send_reply(reply, user_info, true);
+}
+
+// nicks a USERHOST can ask about, the rest are ignored
+#define USERHOST_MAX 5
+
+int handler_USERHOST(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    int ret = check_registered(ctx, user_info);
+    if (ret != REGISTERED) {
+        return ret;
+    }
+
+    ret = check_insufficient_param(msg->nparams, 1, "USERHOST", user_info, ctx);
+    if (ret != SUFFICIENT) {
+        return ret;
+    }
+
+    int n = 0;
+    char **nicks = split_params(msg, 0, " ", &n);
+    if (n > USERHOST_MAX) {
+        n = USERHOST_MAX;
+    }
+    user_handle users[USERHOST_MAX];
+    get_users(ctx, nicks, n, users);
+
+    // nick[*]=[+-]user@host, * for an IRC operator, - if away
+    sds reply = sdscatfmt(sdsempty(), ":%s %s %s :", ctx->server_host, RPL_USERHOST, user_info->nick);
+    bool first = true;
+    for (int i = 0; i < n; i++) {
+        user_handle user = users[i];
+        if (user == NULL || !user->registered)
+            continue;
+        reply = sdscatfmt(reply, "%s%s%s=%s%s@%s", first ? "" : " ", user->nick,
+                          (user->modes & USER_MODE_OPERATOR) ? "*" : "",
+                          (user->modes & USER_MODE_AWAY) ? "-" : "+",
+                          user->username, user->client_host_name);
+        first = false;
+    }
+    reply = sdscatlen(reply, "\r\n", 2);
+    return send_reply(reply, user_info, true);
+}
+
+// records a WHOWAS replies with for each nick when not asked for a count
+#define WHOWAS_DEFAULT_COUNT 8
+
+int handler_WHOWAS(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    int ret = check_registered(ctx, user_info);
+    if (ret != REGISTERED) {
+        return ret;
+    }
+
+    if (msg->nparams < 1 || msg->params[0][0] == '\0') {
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s :No nickname given\r\n",
+                              ctx->server_host, ERR_NONICKNAMEGIVEN, user_info->nick);
+        return send_reply(reply, user_info, true);
+    }
+
+    // WHOWAS nick[,nick...] [count], a count that isn't positive is none
+    int max = WHOWAS_DEFAULT_COUNT;
+    if (msg->nparams > 1) {
+        char *end;
+        long count = strtol(msg->params[1], &end, 10);
+        if (*end == '\0' && count > 0) {
+            max = count < WHOWAS_MAX ? (int) count : WHOWAS_MAX;
+        }
+    }
+
+    int n = 0;
+    char **nicks = split_params(msg, 0, ",", &n);
+    for (int i = 0; i < n; i++) {
+        // the records are copies, a long history can be sent as it goes
+        int count = 0;
+        struct whowas_entry *entries = get_whowas(ctx, nicks[i], max, &count);
+        sds reply = sdsempty();
+        if (count == 0) {
+            reply = sdscatfmt(reply, ":%s %s %s %s :There was no such nickname\r\n",
+                              ctx->server_host, ERR_WASNOSUCHNICK, user_info->nick, nicks[i]);
+        }
+        for (int j = 0; j < count; j++) {
+            struct whowas_entry *entry = &entries[j];
+            char signoff[32];
+            time_t t = (time_t) entry->signoff;
+            struct tm tm;
+            strftime(signoff, sizeof(signoff), "%a %b %d %H:%M:%S %Y", gmtime_r(&t, &tm));
+            reply = sdscatfmt(reply, ":%s %s %s %s %s %s * :%s\r\n",
+                              ctx->server_host, RPL_WHOWASUSER, user_info->nick,
+                              entry->nick, entry->username, entry->host, entry->realname);
+            reply = sdscatfmt(reply, ":%s %s %s %s %s :%s\r\n",
+                              ctx->server_host, RPL_WHOISSERVER, user_info->nick,
+                              entry->nick, ctx->server_host, signoff);
+        }
+        reply = sdscatfmt(reply, ":%s %s %s %s :End of WHOWAS\r\n",
+                          ctx->server_host, RPL_ENDOFWHOWAS, user_info->nick, nicks[i]);
+        if (send_reply(reply, user_info, true) == FAILURE || stream_outbuf(user_info) == FAILURE)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
 int handler_UNKNOWNCOMMAND(context_handle ctx, user_handle user_info, message_handle msg)
 {
     if (!user_info->registered) {
@@ -410,17 +1079,11 @@ int handler_QUIT(context_handle ctx, user_handle user_info, message_handle msg)
     // :syrk!kalt@millennium.stealth.net QUIT :Gone to have lunch
     channel_handle *affected_channel;
     int affected_channel_count;
-    affected_channel = get_channels_user_on(ctx, user_info->nick, &affected_channel_count);
+    affected_channel = get_channels_user_on(ctx, user_info, &affected_channel_count);
     if (affected_channel_count > 0) {
         sds r_channel = sdscatfmt(sdsempty(), ":%s!%s@%s QUIT :%s\r\n",
                                   user_info->nick, user_info->username, user_info->client_host_name, quit_msg);
-        for (int i = 0; i < affected_channel_count; i++) {
-            if (affected_channel[i] == NULL) {
-                chilog(WARNING, "handler_QUIT: null channel");
-                continue;
-            }
-            notify_all_channel_members(ctx, affected_channel[i], r_channel, user_info->nick);
-        }
+        notify_users_on_channels(ctx, affected_channel, affected_channel_count, r_channel, user_info);
         sdsfree(r_channel);
     }
 
@@ -478,8 +1141,6 @@ int handler_LUSERS(context_handle ctx, user_handle user_info, message_handle msg
         return FAILURE;
     }
 
-    free(count);
-
     sds r_nomotd = sdscatfmt(sdsempty(), ":%s %s %s :MOTD File is missing\r\n",
                              ctx->server_host, ERR_NOMOTD, user_info->nick);
 
@@ -501,13 +1162,14 @@ int handler_JOIN(context_handle ctx, user_handle user_info, message_handle msg)
     }
 
     char *name = msg->params[0];
-    bool is_creator = false;
-    channel_handle channel = try_get_channel(ctx, name, &is_creator);
+    char *key = msg->nparams > 1 ? msg->params[1] : NULL;
+    channel_handle channel = NULL;
 
     // add user to current channel
-    int rv = join_channel(channel, user_info->nick, is_creator);
+    int rv = enter_channel(ctx, name, key, user_info, &channel);
 
     // send reply
+    sds reply;
     switch (rv) {
     case 0:
         chilog(DEBUG, "user %s joined channel %s", user_info->nick, name);
@@ -520,19 +1182,26 @@ int handler_JOIN(context_handle ctx, user_handle user_info, message_handle msg)
     case 1:
         chilog(DEBUG, "handler_JOIN: ignored, user %s already on channel %s", user_info->nick, channel->name);
         return SUCCESS;
+    case 3:
+        reply = sdscatfmt(sdsempty(), ":%s %s %s %s :Cannot join channel (+i)\r\n",
+                          ctx->server_host, ERR_INVITEONLYCHAN, user_info->nick, name);
+        return send_reply(reply, user_info, true);
+    case 4:
+        reply = sdscatfmt(sdsempty(), ":%s %s %s %s :Cannot join channel (+k)\r\n",
+                          ctx->server_host, ERR_BADCHANNELKEY, user_info->nick, name);
+        return send_reply(reply, user_info, true);
+    case 5:
+        reply = sdscatfmt(sdsempty(), ":%s %s %s %s :Cannot join channel (+l)\r\n",
+                          ctx->server_host, ERR_CHANNELISFULL, user_info->nick, name);
+        return send_reply(reply, user_info, true);
     default:
         chilog(CRITICAL, "handler_JOIN: unanticipated error");
         return FAILURE;
     }
 
-    sds all_nicks = member_nicks_str(channel);
-    sds r_name = sdscatfmt(sdsempty(), ":%s %s %s = %s :@%s\r\n",
-                           ctx->server_host, RPL_NAMREPLY, user_info->nick, name, all_nicks);
-    if (send_reply(r_name, user_info, true) == FAILURE) {
-        sdsfree(all_nicks);
+    if (send_names(ctx, user_info, channel) == FAILURE) {
         return FAILURE;
     }
-    sdsfree(all_nicks);
 
     sds r_end = sdscatfmt(sdsempty(), ":%s %s %s %s :End of NAMES list\r\n",
                           ctx->server_host, RPL_ENDOFNAMES, user_info->nick, name);
@@ -551,22 +1220,19 @@ int handler_PART(context_handle ctx, user_handle user_info, message_handle msg)
         return ret;
     }
 
+    // the channel table is only locked while we leave the channel,
+    // replies are sent once it is released
     char *channel_name = msg->params[0];
     channel_handle channel = NULL;
-    pthread_mutex_lock(&ctx->mutex_channel_table);
-    HASH_FIND_STR(ctx->channel_hash_table, channel_name, channel);
+    int rv = part_channel(ctx, channel_name, user_info, &channel);
 
-    if (!channel) {
-        // ERR_NOSUCHCHANNEL
-        pthread_mutex_unlock(&ctx->mutex_channel_table);
-        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :No such channel\r\n",
-                              ctx->server_host, ERR_NOSUCHCHANNEL, user_info->nick, channel_name);
-        return send_reply(reply, user_info, true);
-    }
-
-    int rv = leave_channel(channel, user_info->nick);
     sds reply;
     switch (rv) {
+    case 3:
+        // ERR_NOSUCHCHANNEL
+        reply = sdscatfmt(sdsempty(), ":%s %s %s %s :No such channel\r\n",
+                          ctx->server_host, ERR_NOSUCHCHANNEL, user_info->nick, channel_name);
+        return send_reply(reply, user_info, true);
     case 1:
         reply = sdscatfmt(sdsempty(), ":%s %s %s %s :You're not on that channel\r\n", 
             ctx->server_host, ERR_NOTONCHANNEL, user_info->nick, channel_name);
@@ -592,31 +1258,229 @@ int handler_PART(context_handle ctx, user_handle user_info, message_handle msg)
         }
 
         sdsfree(reply);
-        break;
+        return SUCCESS;
     default:
         chilog(CRITICAL, "handler_PART: unanticipated error");
         return FAILURE;
     }
-
-    if (rv == 2) {
-        // delete this channel
-        HASH_DEL(ctx->channel_hash_table, channel);
-    }
-
-    pthread_mutex_unlock(&ctx->mutex_channel_table);
-    return SUCCESS;
 }
 
-int handler_LIST(context_handle ctx, user_handle user_info, message_handle msg)
+int handler_NAMES(context_handle ctx, user_handle user_info, message_handle msg)
 {
     int ret = check_registered(ctx, user_info);
     if (ret != REGISTERED) {
         return ret;
     }
 
-    if (msg->nparams == 1) {
+    if (msg->nparams >= 1) {
         char *name = msg->params[0];
         channel_handle channel = get_channel(ctx, name);
+        if (channel && send_names(ctx, user_info, channel) == FAILURE) {
+            return FAILURE;
+        }
+        sds r_end = sdscatfmt(sdsempty(), ":%s %s %s %s :End of NAMES list\r\n",
+                              ctx->server_host, RPL_ENDOFNAMES, user_info->nick, name);
+        return send_reply(r_end, user_info, true);
+    }
+
+    int nchannels = 0;
+    channel_handle *channels = get_all_channels(ctx, &nchannels);
+    for (int i = 0; i < nchannels; i++) {
+        if (send_names(ctx, user_info, channels[i]) == FAILURE) {
+            return FAILURE;
+        }
+    }
+
+    // then everyone on no channel, in lines like the channels' ones
+    int nnicks = 0;
+    char **nicks = get_nicks_on_no_channel(ctx, &nnicks);
+    size_t budget = names_budget(ctx, "*");
+    for (int i = 0; i < nnicks; ) {
+        sds line = sdsnew(nicks[i++]);
+        while (i < nnicks && sdslen(line) + 1 + strlen(nicks[i]) <= budget) {
+            line = sdscatfmt(line, " %s", nicks[i++]);
+        }
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s * * :%S\r\n",
+                              ctx->server_host, RPL_NAMREPLY, user_info->nick, line);
+        sdsfree(line);
+        if (send_reply(reply, user_info, true) == FAILURE) {
+            return FAILURE;
+        }
+    }
+
+    sds r_end = sdscatfmt(sdsempty(), ":%s %s %s * :End of NAMES list\r\n",
+                          ctx->server_host, RPL_ENDOFNAMES, user_info->nick);
+    return send_reply(r_end, user_info, true);
+}
+
+// name masks a LIST can filter by, the rest are ignored
+#define LIST_MAX_MASKS 8
+
+/**
+ * @brief the ELIST filters of a LIST: its parameter is a comma-separated
+ * list of ">N" (more than N users), "<N" (fewer than N users), name masks,
+ * and "!mask" (names not matching mask)
+ */
+struct list_filter {
+    int more_than;
+    int fewer_than;
+    int nmasks;
+    mask_t masks[LIST_MAX_MASKS];
+    bool negated[LIST_MAX_MASKS];
+    bool any_positive;
+};
+
+/**
+ * @brief parse the parameter of a LIST
+ *
+ * @param param: tokenized in place, NULL if there is none
+ * @param filter
+ */
+static void parse_list_filter(char *param, struct list_filter *filter)
+{
+    filter->more_than = -1;
+    filter->fewer_than = INT_MAX;
+    filter->nmasks = 0;
+    filter->any_positive = false;
+    if (param == NULL) {
+        return;
+    }
+
+    char *saveptr;
+    for (char *term = strtok_r(param, ",", &saveptr); term != NULL; term = strtok_r(NULL, ",", &saveptr)) {
+        if (term[0] == '>' || term[0] == '<') {
+            char *end;
+            long n = strtol(term + 1, &end, 10);
+            if (end == term + 1 || *end != '\0' || n < 0 || n > INT_MAX)
+                continue;
+            if (term[0] == '>' && n > filter->more_than)
+                filter->more_than = n;
+            else if (term[0] == '<' && n < filter->fewer_than)
+                filter->fewer_than = n;
+        } else if (filter->nmasks < LIST_MAX_MASKS) {
+            bool negated = term[0] == '!';
+            mask_compile(&filter->masks[filter->nmasks], negated ? term + 1 : term);
+            filter->negated[filter->nmasks] = negated;
+            filter->any_positive |= !negated;
+            filter->nmasks++;
+        }
+    }
+}
+
+static bool list_filter_match(const struct list_filter *filter, const char *name)
+{
+    bool matched = !filter->any_positive;
+    for (int i = 0; i < filter->nmasks; i++) {
+        if (mask_match(&filter->masks[i], name)) {
+            if (filter->negated[i])
+                return false;
+            matched = true;
+        }
+    }
+    return matched;
+}
+
+static int send_list_entry(context_handle ctx, user_handle user_info, const struct channel_dir_entry *entry)
+{
+    sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s %i :\r\n",
+                          ctx->server_host, RPL_LIST, user_info->nick, entry->name, entry->member_count);
+    if (send_reply(reply, user_info, true) == FAILURE)
+        return FAILURE;
+    return stream_outbuf(user_info);
+}
+
+/**
+ * @brief where the names matching each positive mask of a filter are in
+ * dir->by_name (see channel_dir_prefix_range())
+ *
+ * @param dir
+ * @param filter
+ * @param ranges: to store the range of each mask
+ * @return int: how many names are in the ranges, -1 if the filter has no
+ * positive masks or one without a literal prefix, which could match anything
+ */
+static int list_mask_ranges(const channel_dir_t *dir, const struct list_filter *filter, int ranges[][2])
+{
+    if (!filter->any_positive) {
+        return -1;
+    }
+    int total = 0;
+    for (int m = 0; m < filter->nmasks; m++) {
+        if (filter->negated[m])
+            continue;
+        const mask_t *mask = &filter->masks[m];
+        if (mask->prefix_len == 0)
+            return -1;
+        ranges[m][0] = channel_dir_prefix_range(dir, mask->pattern, mask->prefix_len, &ranges[m][1]);
+        total += ranges[m][1] - ranges[m][0];
+    }
+    return total;
+}
+
+/**
+ * @brief send an RPL_LIST for each channel of a directory that passes a filter
+ *
+ * @param ctx
+ * @param user_info
+ * @param dir
+ * @param filter
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int list_channels(context_handle ctx, user_handle user_info, const channel_dir_t *dir,
+                         const struct list_filter *filter)
+{
+    // the directory is sorted by member count, the counts asked for
+    // are a range of it...
+    // (none has more than INT_MAX)
+    int first = filter->more_than == INT_MAX ? dir->count : channel_dir_lower_bound(dir, filter->more_than + 1);
+    int last = channel_dir_lower_bound(dir, filter->fewer_than);
+
+    // ...and indexed by name, the names matching masks like "#linux-*" are
+    // ranges of that: go through whichever is shorter
+    int ranges[LIST_MAX_MASKS][2];
+    int by_name = list_mask_ranges(dir, filter, ranges);
+    if (by_name == -1 || by_name >= last - first) {
+        for (int i = first; i < last; i++) {
+            const struct channel_dir_entry *entry = &dir->entries[i];
+            if (filter->nmasks > 0 && !list_filter_match(filter, entry->name))
+                continue;
+            if (send_list_entry(ctx, user_info, entry) == FAILURE)
+                return FAILURE;
+        }
+        return SUCCESS;
+    }
+
+    for (int m = 0; m < filter->nmasks; m++) {
+        if (filter->negated[m])
+            continue;
+        for (int i = ranges[m][0]; i < ranges[m][1]; i++) {
+            const struct channel_dir_entry *entry = dir->by_name[i];
+            if (entry->member_count <= filter->more_than || entry->member_count >= filter->fewer_than
+                || !list_filter_match(filter, entry->name))
+                continue;
+            // a name matching several masks is sent for the first one
+            bool sent = false;
+            for (int k = 0; k < m && !sent; k++) {
+                sent = !filter->negated[k] && mask_match(&filter->masks[k], entry->name);
+            }
+            if (!sent && send_list_entry(ctx, user_info, entry) == FAILURE)
+                return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+int handler_LIST(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    int ret = check_registered(ctx, user_info);
+    if (ret != REGISTERED) {
+        return ret;
+    }
+
+    char *param = msg->nparams >= 1 ? msg->params[0] : NULL;
+    if (param != NULL && strpbrk(param, ",<>!") == NULL && !mask_has_wildcards(param)) {
+        // LIST #channel is a lookup
+        channel_handle channel = get_channel(ctx, param);
         if (channel) {
             sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s %u :\r\n",
                                   ctx->server_host, RPL_LIST, user_info->nick, channel->name, channel_member_count(channel));
@@ -624,16 +1488,14 @@ int handler_LIST(context_handle ctx, user_handle user_info, message_handle msg)
                 return FAILURE;
         }
     } else {
-        pthread_mutex_lock(&ctx->mutex_channel_table);
-        for (channel_handle cha = ctx->channel_hash_table; cha != NULL; cha = cha->hh.next) {
-            sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s %u :\r\n",
-                                  ctx->server_host, RPL_LIST, user_info->nick, cha->name, channel_member_count(cha));
-            if (send_reply(reply, user_info, true) == FAILURE) {
-                pthread_mutex_unlock(&ctx->mutex_channel_table);
-                return FAILURE;
-            }
-        }
-        pthread_mutex_unlock(&ctx->mutex_channel_table);
+        struct list_filter filter;
+        parse_list_filter(param != NULL ? arena_sds(param, strlen(param)) : NULL, &filter);
+
+        channel_dir_t *dir = get_channel_dir(ctx);
+        int rv = list_channels(ctx, user_info, dir, &filter);
+        channel_dir_unref(dir);
+        if (rv == FAILURE)
+            return FAILURE;
     }
 
     sds r_end = sdscatfmt(sdsempty(), ":%s %s %s :End of LIST\r\n",
@@ -660,8 +1522,10 @@ int handler_OPER(context_handle ctx, user_handle user_info, message_handle msg)
         return send_reply(reply, user_info, true);
     }
 
-    user_info->is_irc_operator = true;
-    increase_op_num(ctx);
+    if (!(user_info->modes & USER_MODE_OPERATOR)) {
+        user_info->modes |= USER_MODE_OPERATOR;
+        increase_op_num(ctx);
+    }
 
     sds reply = sdscatfmt(sdsempty(), ":%s %s %s :You are now an IRC operator\r\n",
                           ctx->server_host, RPL_YOUREOPER, user_info->nick);
@@ -675,49 +1539,81 @@ int handler_MODE(context_handle ctx, user_handle user_info, message_handle msg)
         return ret;
     }
 
-    ret = check_insufficient_param(msg->nparams, 3, "MODE", user_info, ctx);
+    ret = check_insufficient_param(msg->nparams, 1, "MODE", user_info, ctx);
     if (ret != SUFFICIENT) {
         return ret;
     }
 
-    char *channel_name = msg->params[0];
-    channel_handle channel = get_channel(ctx, channel_name);
+    if (msg->params[0][0] == '#') {
+        return channel_MODE(ctx, user_info, msg);
+    }
+    return user_MODE(ctx, user_info, msg);
+}
 
-    if (!channel) {
-        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :No such channel\r\n",
-                              ctx->server_host, ERR_NOSUCHCHANNEL, user_info->nick, channel_name);
-        return send_reply(reply, user_info, true);
+int handler_STATS(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    int ret = check_registered(ctx, user_info);
+    if (ret != REGISTERED) {
+        return ret;
     }
 
-    char *mode_name = msg->params[1];
-    if (strcmp(mode_name, "-o") != 0 && strcmp(mode_name, "+o") != 0) {
-        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :is unknown mode char to me for %s\r\n",
-                              ctx->server_host, ERR_UNKNOWNMODE, user_info->nick, mode_name, channel_name);
-        return send_reply(reply, user_info, true);
+    ret = check_insufficient_param(msg->nparams, 1, "STATS", user_info, ctx);
+    if (ret != SUFFICIENT) {
+        return ret;
     }
 
-    char *target_nick = msg->params[2];
-    if (!already_on_channel(channel, target_nick)) {
-        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s %s :They aren't on that channel\r\n",
-                              ctx->server_host, ERR_USERNOTINCHANNEL, user_info->nick, target_nick, channel_name);
+    if (!(user_info->modes & USER_MODE_OPERATOR)) {
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s :Permission Denied- You're not an IRC operator\r\n",
+                              ctx->server_host, ERR_NOPRIVILEGES, user_info->nick);
         return send_reply(reply, user_info, true);
     }
 
-    if (user_info->is_irc_operator || is_channel_operator(channel, user_info->nick)) {
-        if(update_member_mode(channel, target_nick, mode_name) == -1) {
+    char *query = msg->params[0];
+    if (strcmp(query, "locks") == 0 || strcmp(query, "locksreset") == 0) {
+        // lock contention profile, see lockprof.h
+        for (lock_profile_t *p = lockprof_list(); p != NULL; p = p->next) {
+            sds line = lockprof_describe(p);
+            sds reply = sdscatfmt(sdsempty(), ":%s %s %s :%S\r\n",
+                                  ctx->server_host, RPL_STATSDEBUG, user_info->nick, line);
+            sdsfree(line);
+            if (send_reply(reply, user_info, true) == FAILURE) {
+                return FAILURE;
+            }
+        }
+        if (strcmp(query, "locksreset") == 0) {
+            lockprof_reset();
+        }
+    } else if (strcmp(query, "memory") == 0) {
+        // sds memory by subsystem, see alloc.h
+        for (int tag = 0; tag < ALLOC_NTAGS; tag++) {
+            sds reply = sdscatprintf(sdsempty(), ":%s %s %s :%s live %ld bytes, %lu allocations\r\n",
+                                     ctx->server_host, RPL_STATSDEBUG, user_info->nick, alloc_tag_name(tag),
+                                     STATS_GET(alloc_live_bytes[tag]), STATS_GET(alloc_count[tag]));
+            if (send_reply(reply, user_info, true) == FAILURE) {
+                return FAILURE;
+            }
+        }
+        // what each connection costs besides the above
+        int *counts = count_connection_state(ctx);
+        sds reply = sdscatprintf(sdsempty(), ":%s %s %s :connections %d, %ld bytes of user state, %ld bytes of log rings, %d bytes of stack reserved each\r\n",
+                                 ctx->server_host, RPL_STATSDEBUG, user_info->nick,
+                                 // registered connections are counted as user connections too
+                                 counts[UNKNOWN_CONNECTION] + counts[USER_CONNECTION],
+                                 STATS_GET(user_bytes), STATS_GET(log_ring_bytes), WORKER_STACK_SIZE);
+        if (send_reply(reply, user_info, true) == FAILURE) {
+            return FAILURE;
+        }
+        // removed objects not freed yet, see epoch.h
+        reply = sdscatprintf(sdsempty(), ":%s %s %s :retired %ld objects waiting to be freed\r\n",
+                             ctx->server_host, RPL_STATSDEBUG, user_info->nick, STATS_GET(retired_pending));
+        if (send_reply(reply, user_info, true) == FAILURE) {
             return FAILURE;
         }
-        sds reply = sdscatfmt(sdsempty(), ":%s!%s@%s MODE %s %s %s\r\n",
-                              user_info->nick, user_info->username, user_info->client_host_name,channel_name, mode_name, target_nick);
-        // notify all
-        notify_all_channel_members(ctx, channel, reply, NULL);
-        sdsfree(reply);
-        return SUCCESS;
-    } else {
-        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :You're not channel operator\r\n",
-                              ctx->server_host, ERR_CHANOPRIVSNEEDED, user_info->nick, channel_name);
-        return send_reply(reply, user_info, true);
     }
+
+    sds r_end = sdscatfmt(sdsempty(), ":%s %s %s %s :End of STATS report\r\n",
+                          ctx->server_host, RPL_ENDOFSTATS, user_info->nick, query);
+    return send_reply(r_end, user_info, true);
 }
 
 static int check_insufficient_param(int have, int target, char *cmd, user_handle user_info, context_handle ctx)
@@ -746,6 +1642,174 @@ static int check_registered(context_handle ctx, user_handle user_info)
     return REGISTERED;
 }
 
+static size_t names_budget(context_handle ctx, const char *channel_name)
+{
+    // ":server 353 nick = #channel :names\r\n"
+    size_t overhead = strlen(ctx->server_host) + strlen(channel_name) + NAMES_NICK_MAX + 13;
+    return overhead < MAX_BUFFER_SIZE / 2 ? MAX_BUFFER_SIZE - overhead : MAX_BUFFER_SIZE / 2;
+}
+
+static int send_names(context_handle ctx, user_handle user_info, channel_handle channel)
+{
+    int count = 0;
+    char **lines = channel_names_lines(channel, names_budget(ctx, channel->name), &count);
+    for (int i = 0; i < count; i++) {
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s = %s :%s\r\n",
+                              ctx->server_host, RPL_NAMREPLY, user_info->nick, channel->name, lines[i]);
+        if (send_reply(reply, user_info, true) == FAILURE) {
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+static bool can_send_to_channel(channel_handle channel, user_handle user)
+{
+    uint8_t channel_modes;
+    int member_modes = get_member_modes(channel, user, &channel_modes);
+    if (member_modes == -1) {
+        return false;
+    }
+    if (!(channel_modes & CHANNEL_MODE_MODERATED) || (user->modes & USER_MODE_OPERATOR)) {
+        return true;
+    }
+    return member_modes & (MEMBER_MODE_OPERATOR | MEMBER_MODE_VOICE);
+}
+
+static int channel_MODE(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    char *channel_name = msg->params[0];
+    channel_handle channel = get_channel(ctx, channel_name);
+
+    if (!channel) {
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :No such channel\r\n",
+                              ctx->server_host, ERR_NOSUCHCHANNEL, user_info->nick, channel_name);
+        return send_reply(reply, user_info, true);
+    }
+
+    if (msg->nparams == 1) {
+        // the key and limit are only shown to members
+        sds modes = channel_modes_str(channel, already_on_channel(channel, user_info));
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s %S\r\n",
+                              ctx->server_host, RPL_CHANNELMODEIS, user_info->nick, channel_name, modes);
+        sdsfree(modes);
+        return send_reply(reply, user_info, true);
+    }
+
+    // parse the whole mode string first, then apply it in one go
+    struct mode_change changes[MODE_MAX_CHANGES];
+    int n = parse_channel_modes(msg->params[1], msg->params + 2, msg->nparams - 2, changes);
+    bool pending = false;
+    for (int i = 0; i < n; i++) {
+        if (changes[i].status != MODE_PENDING)
+            continue;
+        pending = true;
+        if (changes[i].def->target == MODE_TARGET_MEMBER)
+            changes[i].user = get_user(ctx, changes[i].param);
+    }
+    int rv = pending ? apply_channel_modes(channel, user_info, changes, n) : 0;
+    if (rv == -1) {
+        return FAILURE;
+    }
+
+    for (int i = 0; i < n; i++) {
+        char letter[2] = {changes[i].letter, '\0'};
+        sds reply = NULL;
+        switch (changes[i].status) {
+        case MODE_UNKNOWN:
+            reply = sdscatfmt(sdsempty(), ":%s %s %s %s :is unknown mode char to me for %s\r\n",
+                              ctx->server_host, ERR_UNKNOWNMODE, user_info->nick, letter, channel_name);
+            break;
+        case MODE_NEED_PARAM:
+            reply = sdscatfmt(sdsempty(), ":%s %s %s MODE :Not enough parameters\r\n",
+                              ctx->server_host, ERR_NEEDMOREPARAMS, user_info->nick);
+            break;
+        case MODE_NOT_ON_CHANNEL:
+            reply = sdscatfmt(sdsempty(), ":%s %s %s %s %s :They aren't on that channel\r\n",
+                              ctx->server_host, ERR_USERNOTINCHANNEL, user_info->nick, changes[i].param, channel_name);
+            break;
+        default:
+            break;
+        }
+        if (reply != NULL && send_reply(reply, user_info, true) == FAILURE) {
+            return FAILURE;
+        }
+    }
+
+    if (rv == 1) {
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %s :You're not channel operator\r\n",
+                              ctx->server_host, ERR_CHANOPRIVSNEEDED, user_info->nick, channel_name);
+        return send_reply(reply, user_info, true);
+    }
+
+    // one MODE for everything that changed
+    sds modes = cat_applied_modes(sdsempty(), changes, n);
+    if (sdslen(modes) > 0) {
+        sds reply = sdscatfmt(sdsempty(), ":%s!%s@%s MODE %s %S\r\n",
+                              user_info->nick, user_info->username, user_info->client_host_name, channel_name, modes);
+        notify_all_channel_members(ctx, channel, reply, NULL);
+        sdsfree(reply);
+    }
+    sdsfree(modes);
+    return SUCCESS;
+}
+
+static int user_MODE(context_handle ctx, user_handle user_info, message_handle msg)
+{
+    char *nick = msg->params[0];
+    if (strcmp(nick, user_info->nick) != 0) {
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s :Cannot change mode for other users\r\n",
+                              ctx->server_host, ERR_USERSDONTMATCH, user_info->nick);
+        return send_reply(reply, user_info, true);
+    }
+
+    if (msg->nparams == 1) {
+        sds modes = cat_mode_letters(sdsempty(), MODE_TARGET_USER, user_info->modes);
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s %S\r\n",
+                              ctx->server_host, RPL_UMODEIS, user_info->nick, modes);
+        sdsfree(modes);
+        return send_reply(reply, user_info, true);
+    }
+
+    struct mode_change changes[MODE_MAX_CHANGES];
+    int n = parse_user_modes(msg->params[1], changes);
+    bool unknown = false;
+    for (int i = 0; i < n; i++) {
+        struct mode_change *change = &changes[i];
+        if (change->status == MODE_UNKNOWN) {
+            unknown = true;
+            continue;
+        }
+        // +o only comes from OPER and a only from AWAY, but anyone can drop o
+        if (change->def->bit == USER_MODE_OPERATOR && !change->set) {
+            if (user_info->modes & USER_MODE_OPERATOR) {
+                user_info->modes &= ~USER_MODE_OPERATOR;
+                decrease_op_num(ctx);
+            }
+            change->status = MODE_APPLIED;
+        } else {
+            change->status = MODE_IGNORED;
+        }
+    }
+
+    if (unknown) {
+        sds reply = sdscatfmt(sdsempty(), ":%s %s %s :Unknown MODE flag\r\n",
+                              ctx->server_host, ERR_UMODEUNKNOWNFLAG, user_info->nick);
+        if (send_reply(reply, user_info, true) == FAILURE) {
+            return FAILURE;
+        }
+    }
+
+    sds modes = cat_applied_modes(sdsempty(), changes, n);
+    if (sdslen(modes) == 0) {
+        sdsfree(modes);
+        return SUCCESS;
+    }
+    sds reply = sdscatfmt(sdsempty(), ":%s MODE %s :%S\r\n", user_info->nick, nick, modes);
+    sdsfree(modes);
+    return send_reply(reply, user_info, true);
+}
+
 static int send_welcome(user_handle user_info, char *server_host_name)
 {
     sds r_welcome = sdscatfmt(sdsempty(), ":%s %s %s :Welcome to the Internet Relay Network %s!%s@%s\r\n",
@@ -776,41 +1840,75 @@ static int send_welcome(user_handle user_info, char *server_host_name)
     return SUCCESS;
 }
 
-int notify_all_channel_members(context_handle ctx, channel_handle channel, char *reply, char * sender_nick)
+/**
+ * @brief send a message to a set of recipients, through the fan-out pool
+ * if there are enough of them
+ *
+ * @param recipients: reordered on the way
+ * @param count
+ * @param reply
+ * @return int: the number of recipients it was delivered or handed off to
+ */
+static int deliver_to_recipients(user_handle *recipients, int count, char *reply)
 {
-    int count = 0;
-    char **member_nicks = member_nicks_arr(channel, &count);
-    for (int i = 0; i < count; i++) {
-        if(sender_nick != NULL && sdscmp(sender_nick, member_nicks[i]) == 0) {
-            // skip sender
-            continue;
+    if (fanout_threshold() > 0 && count >= fanout_threshold() && owned_user != NULL) {
+        // a very large channel, hand it to the fan-out pool; our own copy
+        // (e.g. of a JOIN) still has to come before our next replies
+        for (int i = 0; i < count; i++) {
+            if (recipients[i] == owned_user) {
+                send_reply(reply, owned_user, false);
+                recipients[i] = recipients[--count];
+                break;
+            }
         }
+        fanout_submit(owned_user, recipients, count, reply);
+        return count;
+    }
 
-        user_handle usr = get_user(ctx, member_nicks[i]);
-        if (!usr) {
-            chilog(WARNING, "notify_all_channel_members: fail to get user %s", member_nicks[i]);
-            continue;
-        }
-        if (send_reply(reply, usr, false) == FAILURE) {
-            free(member_nicks);
-            return FAILURE;
+    int delivered = 0;
+    for (int i = 0; i < count; i++) {
+        // a recipient going away must not cut off the others
+        if (send_reply(reply, recipients[i], false) == SUCCESS) {
+            delivered++;
         }
     }
-    free(member_nicks);
+    return delivered;
+}
+
+int notify_all_channel_members(context_handle ctx, channel_handle channel, char *reply, user_handle sender)
+{
+    // snapshot the recipients first, no lock is held while sending
+    int count = 0;
+    user_handle *recipients = get_channel_recipients(ctx, channel, sender, &count);
+    CHIRC_PROBE2(fanout_start, channel->name, count);
+    int delivered = deliver_to_recipients(recipients, count, reply);
+    CHIRC_PROBE2(fanout_end, channel->name, delivered);
+    return SUCCESS;
+}
+
+int notify_users_on_channels(context_handle ctx, channel_handle *channels, int nchannels, char *reply, user_handle sender)
+{
+    int count = 0;
+    user_handle *recipients = get_channels_recipients(ctx, channels, nchannels, sender, &count);
+    deliver_to_recipients(recipients, count, reply);
     return SUCCESS;
 }
 
 // This chunk of code is from Beej, thanks for Beej!
 // Ensure that we send all we want to send successfully
-static int sendall(int s, char *buf, int *len)
+static int sendall(int s, char *buf, int *len, int flags)
 {
     int total = 0;        // how many bytes we've sent
     int bytesleft = *len; // how many we have left to send
     int n;
 
     while (total < *len) {
-        n = send(s, buf + total, bytesleft, 0);
+        n = send(s, buf + total, bytesleft, flags);
         if (n == -1) {
+            if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // the socket is full, the caller keeps the rest
+                n = 0;
+            }
             break;
         }
         total += n;
@@ -822,6 +1920,81 @@ static int sendall(int s, char *buf, int *len)
     return n == -1 ? -1 : 0; // return -1 on failure, 0 on success
 }
 
+/**
+ * @brief send the replies queued for a user, owner thread only
+ *
+ * @param user_info
+ * @param flags: passed to send(), MSG_MORE if more replies are coming,
+ * MSG_DONTWAIT to keep what the socket can't take for the next flush
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+static int flush_outbuf(user_handle user_info, int flags)
+{
+    if (user_info->outbuf == NULL) {
+        return SUCCESS;
+    }
+    int queued = sdslen(user_info->outbuf);
+    if (queued == 0) {
+        return SUCCESS;
+    }
+
+    int len = queued;
+    int rv = sendall(user_info->client_fd, user_info->outbuf, &len, flags);
+    STATS_ADD(bytes_out, len);
+    if (rv == SUCCESS && len < queued) {
+        // MSG_DONTWAIT and the client is slow
+        STATS_SUB(sendq_bytes, len);
+        sdsrange(user_info->outbuf, len, -1);
+        return SUCCESS;
+    }
+    STATS_SUB(sendq_bytes, queued);
+    // on error whatever is left is dropped along with the connection
+    if (flags & MSG_MORE) {
+        // more is coming right away
+        sdsclear(user_info->outbuf);
+    } else {
+        // an idle connection keeps no buffer
+        sdsfree(user_info->outbuf);
+        user_info->outbuf = NULL;
+    }
+    if (rv == -1) {
+        chilog(ERROR, "send error in sendall()!");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+static int stream_outbuf(user_handle user_info)
+{
+    if (user_info != owned_user || user_info->outbuf == NULL
+        || sdslen(user_info->outbuf) < OUTBUF_STREAM_SIZE) {
+        return SUCCESS;
+    }
+    epoch_offline();
+    int rv = flush_outbuf(user_info, MSG_MORE);
+    epoch_online();
+    return rv;
+}
+
+/**
+ * @brief an output buffer, allocated when a connection first has
+ * something to send
+ *
+ * @return sds
+ */
+static sds new_outbuf()
+{
+    alloc_tag_t prev = alloc_set_tag(ALLOC_SENDQ);
+    sds outbuf = sdsempty();
+    alloc_set_tag(prev);
+    return outbuf;
+}
+
+void own_connection(user_handle user_info)
+{
+    owned_user = user_info;
+}
+
 int send_reply(char *str, user_handle user_info, bool to_free)
 {
     if (str == NULL || user_info == NULL) {
@@ -830,14 +2003,54 @@ int send_reply(char *str, user_handle user_info, bool to_free)
     }
 
     int len = sdslen(str);
-    if (sendall(user_info->client_fd, str, &len) == -1) {
-        chilog(ERROR, "send error in sendall()!");
-        sdsfree(str);
-        return FAILURE;
+    CHIRC_PROBE2(reply_queued, user_info->client_fd, len);
+    STATS_ADD(sendq_bytes, len);
+
+    int rv = SUCCESS;
+    if (user_info == owned_user) {
+        if (user_info->outbuf == NULL) {
+            user_info->outbuf = new_outbuf();
+        }
+        user_info->outbuf = sdscatlen(user_info->outbuf, str, len);
+        if (sdslen(user_info->outbuf) >= OUTBUF_FLUSH_SIZE) {
+            // a long burst, send what we have and keep the segment open;
+            // the caller may hold pointers into the shared tables, so we
+            // can't go offline, and mustn't block online: a client that
+            // doesn't read would hold up reclamation for everyone
+            rv = flush_outbuf(user_info, MSG_MORE | MSG_DONTWAIT);
+        }
+    } else if (owned_user != NULL && atomic_load(&owned_user->fanout_pending) > 0) {
+        // an earlier message of ours may still be in the fan-out pool,
+        // don't overtake it
+        fanout_submit(owned_user, &user_info, 1, str);
+    } else if (mailbox_post(&user_info->mailbox, str, len) > SENDQ_MAX) {
+        // the client isn't reading, its owner thread is stuck in send();
+        // cut it off rather than queueing without bound
+        chilog_ratelimited(WARNING, 10, "max sendq exceeded for %s, dropping it", user_info->client_host_name);
+        shutdown(user_info->client_fd, SHUT_RDWR);
+        rv = FAILURE;
     }
 
     if (to_free) {
         sdsfree(str);
     }
-    return SUCCESS;
+    return rv;
+}
+
+int flush_replies(user_handle user_info)
+{
+    // posters count their bytes before queueing, so nothing is missed
+    if (atomic_load(&user_info->mailbox.queued_bytes) > 0) {
+        long drained;
+        if (user_info->outbuf == NULL) {
+            user_info->outbuf = new_outbuf();
+        }
+        user_info->outbuf = mailbox_drain(&user_info->mailbox, user_info->outbuf, &drained);
+    }
+    // a client that doesn't read keeps us in send(), offline so that
+    // reclamation goes on without us
+    epoch_offline();
+    int rv = flush_outbuf(user_info, 0);
+    epoch_online();
+    return rv;
 }
@@ -5,6 +5,50 @@
 #include "user.h"
 #include "message.h"
 
+/**
+ * @brief a helper function in charge of sending replies or error messages to the client side
+ * This function ensures that send() does send the whole message successfully
+ * (the message is only queued, the thread that owns the connection sends it,
+ * see own_connection())
+ * @param str message to be sent
+ * @param user_info struct that stores user relevant information 
+ * @param to_free whether the str needs to be freed
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+int send_reply(char *str, user_handle user_info, bool to_free);
+
+/**
+ * @brief make the calling thread the only one writing to this user's socket:
+ * its own replies are buffered until flush_replies(), while other threads
+ * post theirs to the user's mailbox and wake it up
+ * 
+ * @param user_info 
+ */
+void own_connection(user_handle user_info);
+
+/**
+ * @brief send the replies buffered so far, together with everything other
+ * threads have posted to the mailbox, in as few send()s as possible;
+ * owner thread only, holding no pointers into the shared tables since it
+ * sends offline (see epoch.h)
+ * 
+ * @param user_info 
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+int flush_replies(user_handle user_info);
+
+/**
+ * @brief tell the users that MONITOR a nick that a user with that nick
+ * came online (it registered or took the nick) or went offline (it quit or
+ * dropped the nick); call it once the user table has changed
+ * 
+ * @param ctx 
+ * @param user 
+ * @param nick 
+ * @param online 
+ */
+void notify_monitors(context_handle ctx, user_handle user, const char *nick, bool online);
+
 /*
 Below are all handler functions corresponding to different client-side commands
 */
@@ -23,6 +67,16 @@ int handler_PONG(context_handle ctx, user_handle user_info, message_handle msg);
 
 int handler_WHOIS(context_handle ctx, user_handle user_info, message_handle msg);
 
+int handler_WHO(context_handle ctx, user_handle user_info, message_handle msg);
+
+int handler_MONITOR(context_handle ctx, user_handle user_info, message_handle msg);
+
+int handler_ISON(context_handle ctx, user_handle user_info, message_handle msg);
+
+int handler_USERHOST(context_handle ctx, user_handle user_info, message_handle msg);
+
+int handler_WHOWAS(context_handle ctx, user_handle user_info, message_handle msg);
+
 int handler_UNKNOWNCOMMAND(context_handle ctx, user_handle user_info, message_handle msg);
 
 int handler_QUIT(context_handle ctx, user_handle user_info, message_handle msg);
@@ -33,10 +87,14 @@ int handler_JOIN(context_handle ctx, user_handle user_info, message_handle msg);
 
 int handler_PART(context_handle ctx, user_handle user_info, message_handle msg);
 
+int handler_NAMES(context_handle ctx, user_handle user_info, message_handle msg);
+
 int handler_LIST(context_handle ctx, user_handle user_info, message_handle msg);
 
 int handler_OPER(context_handle ctx, user_handle user_info, message_handle msg);
 
 int handler_MODE(context_handle ctx, user_handle user_info, message_handle msg);
 
+int handler_STATS(context_handle ctx, user_handle user_info, message_handle msg);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "lockprof.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "stats.h"
+
+static _Atomic(lock_profile_t *) profiles;
+static pthread_mutex_t profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static lock_profile_t *get_profile(const char *name);
+
+/* Returns whether value is the new maximum */
+static bool update_max(atomic_ulong *max, unsigned long value)
+{
+    unsigned long cur = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > cur) {
+        if (atomic_compare_exchange_weak(max, &cur, value))
+            return true;
+    }
+    return false;
+}
+
+void prof_mutex_init(prof_mutex_t *mutex, const char *name)
+{
+    pthread_mutex_init(&mutex->mutex, NULL);
+    mutex->profile = get_profile(name);
+    mutex->acquired_at = 0;
+    mutex->site = NULL;
+}
+
+void prof_mutex_destroy(prof_mutex_t *mutex)
+{
+    pthread_mutex_destroy(&mutex->mutex);
+}
+
+void __prof_mutex_lock(prof_mutex_t *mutex, const char *site)
+{
+    lock_profile_t *profile = mutex->profile;
+    uint64_t now;
+
+    if (pthread_mutex_trylock(&mutex->mutex) == 0) {
+        now = stats_now_ns();
+    } else {
+        uint64_t start = stats_now_ns();
+        pthread_mutex_lock(&mutex->mutex);
+        now = stats_now_ns();
+        atomic_fetch_add_explicit(&profile->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&profile->wait_ns, now - start, memory_order_relaxed);
+        update_max(&profile->max_wait_ns, now - start);
+    }
+
+    atomic_fetch_add_explicit(&profile->acquisitions, 1, memory_order_relaxed);
+    mutex->acquired_at = now;
+    mutex->site = site;
+}
+
+void prof_mutex_unlock(prof_mutex_t *mutex)
+{
+    lock_profile_t *profile = mutex->profile;
+    uint64_t held = stats_now_ns() - mutex->acquired_at;
+    const char *site = mutex->site;
+
+    pthread_mutex_unlock(&mutex->mutex);
+
+    atomic_fetch_add_explicit(&profile->hold_ns, held, memory_order_relaxed);
+    // only the thread that set the maximum names the site
+    if (update_max(&profile->max_hold_ns, held)) {
+        atomic_store_explicit(&profile->max_hold_site, (uintptr_t) site, memory_order_relaxed);
+    }
+}
+
+lock_profile_t *lockprof_list()
+{
+    return atomic_load(&profiles);
+}
+
+sds lockprof_describe(lock_profile_t *p)
+{
+    unsigned long acquisitions = atomic_load(&p->acquisitions);
+    const char *site = (const char *) atomic_load_explicit(&p->max_hold_site, memory_order_relaxed);
+    if (site != NULL && strrchr(site, '/') != NULL) {
+        // __FILE__ may be an absolute path
+        site = strrchr(site, '/') + 1;
+    }
+
+    return sdscatprintf(sdsempty(),
+                        "%s: acquired %lu contended %lu (%.1f%%) wait %.3fms (max %.3fms) "
+                        "hold %.3fms (max %.3fms at %s)",
+                        p->name, acquisitions, atomic_load(&p->contended),
+                        acquisitions ? 100.0 * atomic_load(&p->contended) / acquisitions : 0.0,
+                        atomic_load(&p->wait_ns) / 1e6, atomic_load(&p->max_wait_ns) / 1e6,
+                        atomic_load(&p->hold_ns) / 1e6, atomic_load(&p->max_hold_ns) / 1e6,
+                        site ? site : "-");
+}
+
+void lockprof_log()
+{
+    for (lock_profile_t *p = lockprof_list(); p != NULL; p = p->next) {
+        sds line = lockprof_describe(p);
+        chilog(INFO, "lockprof %s", line);
+        sdsfree(line);
+    }
+}
+
+void lockprof_reset()
+{
+    for (lock_profile_t *p = lockprof_list(); p != NULL; p = p->next) {
+        atomic_store(&p->acquisitions, 0);
+        atomic_store(&p->contended, 0);
+        atomic_store(&p->wait_ns, 0);
+        atomic_store(&p->hold_ns, 0);
+        atomic_store(&p->max_wait_ns, 0);
+        atomic_store(&p->max_hold_ns, 0);
+        atomic_store(&p->max_hold_site, 0);
+    }
+}
+
+static lock_profile_t *get_profile(const char *name)
+{
+    pthread_mutex_lock(&profiles_mutex);
+    lock_profile_t *p;
+    for (p = atomic_load(&profiles); p != NULL; p = p->next) {
+        if (strcmp(p->name, name) == 0) {
+            pthread_mutex_unlock(&profiles_mutex);
+            return p;
+        }
+    }
+
+    p = calloc(1, sizeof(lock_profile_t));
+    if (p == NULL) {
+        chilog(CRITICAL, "get_profile: fail to allocate memory");
+        exit(1);
+    }
+    p->name = name;
+
+    // readers walk the list without the lock, so publish it fully built
+    p->next = atomic_load(&profiles);
+    atomic_store(&profiles, p);
+
+    pthread_mutex_unlock(&profiles_mutex);
+    return p;
+}
@@ -0,0 +1,107 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sds.h>
+
+/**
+ * @brief contention statistics shared by all the locks with the same name
+ * (e.g. every channel's member table lock is accounted as one)
+ * 
+ */
+struct lock_profile {
+    const char *name;
+
+    atomic_ulong acquisitions;
+    atomic_ulong contended;     // acquisitions that had to wait
+    atomic_ulong wait_ns;
+    atomic_ulong hold_ns;
+    atomic_ulong max_wait_ns;
+    atomic_ulong max_hold_ns;
+    // the "file:line" (a string literal) that held it the longest; an
+    // integer since gcc reports atomic loads of pointers as dangling
+    _Atomic(uintptr_t) max_hold_site;
+
+    // profiles are never freed, this list is append-only
+    struct lock_profile *next;
+};
+
+typedef struct lock_profile lock_profile_t;
+
+/**
+ * @brief a mutex that records how long it is waited for and held
+ * 
+ */
+struct prof_mutex {
+    pthread_mutex_t mutex;
+    lock_profile_t *profile;
+
+    // only meaningful while the lock is held
+    uint64_t acquired_at;
+    const char *site;
+};
+
+typedef struct prof_mutex prof_mutex_t;
+
+#define LOCKPROF_STR_(x) #x
+#define LOCKPROF_STR(x) LOCKPROF_STR_(x)
+
+/**
+ * @brief initialize a profiled mutex
+ * 
+ * @param mutex 
+ * @param name: profile to account it to, must be a string literal
+ */
+void prof_mutex_init(prof_mutex_t *mutex, const char *name);
+
+/**
+ * @brief destroy a profiled mutex, its statistics are kept
+ * 
+ * @param mutex 
+ */
+void prof_mutex_destroy(prof_mutex_t *mutex);
+
+/**
+ * @brief lock a profiled mutex, recording the call-site
+ */
+#define prof_mutex_lock(mutex) __prof_mutex_lock((mutex), __FILE__ ":" LOCKPROF_STR(__LINE__))
+
+void __prof_mutex_lock(prof_mutex_t *mutex, const char *site);
+
+/**
+ * @brief unlock a profiled mutex
+ * 
+ * @param mutex 
+ */
+void prof_mutex_unlock(prof_mutex_t *mutex);
+
+/**
+ * @brief Get the first registered lock profile, follow ->next for the others
+ * 
+ * @return lock_profile_t* 
+ */
+lock_profile_t *lockprof_list();
+
+/**
+ * @brief one-line human readable summary of a lock profile
+ * 
+ * @param profile 
+ * @return sds: caller need to free the return value
+ */
+sds lockprof_describe(lock_profile_t *profile);
+
+/**
+ * @brief write the summary of every lock profile to the log
+ * 
+ */
+void lockprof_log();
+
+/**
+ * @brief reset the statistics of every lock profile
+ * 
+ */
+void lockprof_reset();
+
+#endif
@@ -39,75 +39,445 @@
  *
  */
 
+/*
+ * Log messages are not written by the thread that calls chilog(). Each
+ * thread formats its messages into its own single-producer ring buffer,
+ * and a background writer thread drains all the rings to stdout. The
+ * fast path is therefore free of locks and system calls: when a ring is
+ * full, the message is dropped and counted instead of blocking the caller.
+ *
+ * A thread that goes idle can give its ring back (chilog_release()), the
+ * writer frees it once written out. The rings a thread gave back are
+ * written before the one it logs to now, so its messages stay in order.
+ */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "log.h"
+#include "stats.h"
+
+/* Size in bytes of each per-thread ring, must be a power of two */
+#define LOG_RING_SIZE 8192
+
+/* Longest message kept, longer ones are truncated */
+#define LOG_MSG_MAX 1024
+
+/* How long the writer sleeps when there is nothing to write (ms) */
+#define LOG_IDLE_WAIT_MS 100
+
+/* Entry header, entries are 16-byte aligned so a padding entry
+ * always fits at the end of the ring */
+struct log_entry {
+    uint32_t size;      // whole entry, header included
+    uint16_t len;       // message length
+    uint8_t level;
+    uint8_t padding;    // true for entries that only skip to the start of the ring
+    int64_t sec;
+};
+
+struct log_ring {
+    atomic_size_t head;     // only written by the owner thread
+    atomic_size_t tail;     // only written by the writer thread
+    atomic_bool dead;       // set when the owner thread exits or releases it
+    bool reaped;            // dead and written out, only used by the writer
+    unsigned int thread_num;
+    struct log_ring *next;
+    char data[LOG_RING_SIZE];
+};
 
 /* Logging level. Set by default to print just informational messages */
-static int loglevel = INFO;
+int chirc_loglevel = INFO;
+
+static logformat_t logformat = LOG_FORMAT_TEXT;
+
+/* All rings, new ones are pushed at the head by their owner thread,
+ * only the writer thread removes them */
+static _Atomic(struct log_ring *) rings;
+
+static _Thread_local struct log_ring *my_ring;
+
+// numbered by the first ring, the same for all the thread's rings
+static _Thread_local int my_thread_num = -1;
+
+static atomic_uint thread_counter;
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_t writer;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool writer_idle;
+static atomic_bool writer_stop;
+
+static void *writer_thread(void *args);
+
+static void start_writer();
+
+static void stop_writer();
+
+static void ring_release(void *ring);
+
+static struct log_ring *get_ring();
 
 
 void chirc_setloglevel(loglevel_t level)
 {
-    loglevel = level;
+    chirc_loglevel = level;
+}
+
+void chirc_setlogformat(logformat_t format)
+{
+    logformat = format;
 }
 
 /* This function does the actual logging and is called by chilog().
  * It has a va_list parameter instead of being a variadic function */
 void __chilog(loglevel_t level, char *fmt, va_list argptr)
 {
-    time_t t;
-    char buf[80], *levelstr;
+    if(level > chirc_loglevel)
+        return;
 
-    if(level > loglevel)
+    char msg[LOG_MSG_MAX];
+    int len = vsnprintf(msg, LOG_MSG_MAX, fmt, argptr);
+    if (len < 0)
         return;
+    if (len >= LOG_MSG_MAX)
+        len = LOG_MSG_MAX - 1;
 
-    t = time(NULL);
-    strftime(buf,80,"%Y-%m-%d %H:%M:%S",localtime(&t));
+    struct log_ring *ring = get_ring();
+    if (ring == NULL) {
+        STATS_ADD(log_dropped, 1);
+        return;
+    }
 
+    size_t needed = (sizeof(struct log_entry) + len + 15) & ~((size_t) 15);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t idx = head & (LOG_RING_SIZE - 1);
+    size_t contiguous = LOG_RING_SIZE - idx;
+    size_t total = contiguous < needed ? contiguous + needed : needed;
+
+    if (LOG_RING_SIZE - (head - tail) < total) {
+        STATS_ADD(log_dropped, 1);
+        return;
+    }
+
+    if (contiguous < needed) {
+        struct log_entry *pad = (struct log_entry *) (ring->data + idx);
+        pad->size = contiguous;
+        pad->padding = true;
+        head += contiguous;
+        idx = 0;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    struct log_entry *entry = (struct log_entry *) (ring->data + idx);
+    entry->size = needed;
+    entry->len = len;
+    entry->level = level;
+    entry->padding = false;
+    entry->sec = now.tv_sec;
+    memcpy(entry + 1, msg, len);
+
+    // seq_cst: pairs with the writer announcing it is idle
+    atomic_store(&ring->head, head + needed);
+    if (atomic_load(&writer_idle)) {
+        pthread_mutex_lock(&writer_mutex);
+        pthread_cond_signal(&writer_cond);
+        pthread_mutex_unlock(&writer_mutex);
+    }
+}
+
+void chilog_emit(loglevel_t level, char *fmt, ...)
+{
+    va_list argptr;
+
+    va_start(argptr, fmt);
+    __chilog(level, fmt, argptr);
+    va_end(argptr);
+}
+
+bool chilog_ratelimit_pass(chilog_ratelimit_t *rl, loglevel_t level, int interval)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    long last = atomic_load_explicit(&rl->last, memory_order_relaxed);
+    // the monotonic clock starts near zero at boot, so the first message is
+    // only guaranteed to pass if last is still unset
+    if ((last != 0 && now.tv_sec - last < interval) ||
+        !atomic_compare_exchange_strong(&rl->last, &last, now.tv_sec == 0 ? 1 : now.tv_sec)) {
+        atomic_fetch_add_explicit(&rl->suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    unsigned long suppressed = atomic_exchange(&rl->suppressed, 0);
+    if (suppressed > 0)
+        chilog_emit(level, "(%lu similar messages suppressed)", suppressed);
+    return true;
+}
+
+void chilog_flush()
+{
+    stop_writer();
+}
+
+static struct log_ring *get_ring()
+{
+    if (my_ring != NULL)
+        return my_ring;
+
+    pthread_once(&writer_once, start_writer);
+
+    struct log_ring *ring = calloc(1, sizeof(struct log_ring));
+    if (ring == NULL)
+        return NULL;
+    STATS_ADD(log_ring_bytes, sizeof(struct log_ring));
+    if (my_thread_num == -1)
+        my_thread_num = atomic_fetch_add(&thread_counter, 1);
+    ring->thread_num = my_thread_num;
+
+    struct log_ring *first = atomic_load(&rings);
+    do {
+        ring->next = first;
+    } while (!atomic_compare_exchange_weak(&rings, &first, ring));
+
+    pthread_setspecific(ring_key, ring);
+    my_ring = ring;
+    return ring;
+}
+
+static void ring_release(void *ring)
+{
+    // anything logged by a later destructor goes to a fresh ring
+    my_ring = NULL;
+    atomic_store(&((struct log_ring *) ring)->dead, true);
+}
+
+void chilog_release()
+{
+    if (my_ring == NULL)
+        return;
+
+    // the writer may free it from now on
+    pthread_setspecific(ring_key, NULL);
+    ring_release(my_ring);
+}
+
+static void start_writer()
+{
+    pthread_key_create(&ring_key, ring_release);
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+        fprintf(stderr, "chilog: could not start the log writer thread\n");
+        exit(1);
+    }
+    atexit(stop_writer);
+}
+
+static void stop_writer()
+{
+    static atomic_bool stopped;
+    if (atomic_exchange(&stopped, true))
+        return;
+
+    atomic_store(&writer_stop, true);
+    pthread_mutex_lock(&writer_mutex);
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer, NULL);
+}
+
+static char *level_name(int level)
+{
     switch(level) {
     case CRITICAL:
-        levelstr = "CRITIC";
-        break;
+        return "CRITIC";
     case ERROR:
-        levelstr = "ERROR";
-        break;
+        return "ERROR";
     case WARNING:
-        levelstr = "WARN";
-        break;
+        return "WARN";
     case INFO:
-        levelstr = "INFO";
-        break;
+        return "INFO";
     case DEBUG:
-        levelstr = "DEBUG";
-        break;
+        return "DEBUG";
     case TRACE:
-        levelstr = "TRACE";
-        break;
+        return "TRACE";
     default:
-        levelstr = "UNKNOWN";
-        break;
+        return "UNKNOWN";
     }
+}
 
-    flockfile(stdout);
-    printf("[%s] %6s ", buf, levelstr);
+/* Formatting a timestamp is only done once per second */
+static char *timestamp(int64_t sec)
+{
+    static int64_t cached_sec = -1;
+    static char buf[80];
 
-    vprintf(fmt, argptr);
-    printf("\n");
-    funlockfile(stdout);
-    fflush(stdout);
+    if (sec != cached_sec) {
+        time_t t = sec;
+        struct tm tm;
+        strftime(buf, 80, "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+        cached_sec = sec;
+    }
+    return buf;
 }
 
-void chilog(loglevel_t level, char *fmt, ...)
+static void write_json_string(const char *s, int len)
 {
-    va_list argptr;
+    putchar('"');
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            putchar('\\');
+            putchar(c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
 
-    va_start(argptr, fmt);
-    __chilog(level, fmt, argptr);
-    va_end(argptr);
+static void write_line(int level, int64_t sec, unsigned int thread_num, char *msg, int len)
+{
+    if (logformat == LOG_FORMAT_JSON) {
+        printf("{\"time\":\"%s\",\"level\":\"%s\",\"thread\":%u,\"msg\":",
+               timestamp(sec), level_name(level), thread_num);
+        write_json_string(msg, len);
+        printf("}\n");
+    } else {
+        printf("[%s] %6s ", timestamp(sec), level_name(level));
+        fwrite(msg, 1, len, stdout);
+        putchar('\n');
+    }
+}
+
+/* Write everything pending in one ring, returns the number of entries */
+static int drain_ring(struct log_ring *ring)
+{
+    int count = 0;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail != head) {
+        struct log_entry *entry = (struct log_entry *) (ring->data + (tail & (LOG_RING_SIZE - 1)));
+        if (!entry->padding) {
+            write_line(entry->level, entry->sec, ring->thread_num, (char *) (entry + 1), entry->len);
+            count++;
+        }
+        tail += entry->size;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return count;
 }
 
+/* Write all pending entries and free the dead rings */
+static int drain_all()
+{
+    int count = 0;
+
+    // dead rings first: a thread that released a ring logs to a newer one,
+    // pushed after it was marked dead, so a ring that isn't dead yet in
+    // this pass can't have a newer one in the list either
+    struct log_ring *first = atomic_load(&rings);
+    for (struct log_ring *ring = first; ring != NULL; ring = ring->next) {
+        if (atomic_load(&ring->dead)) {
+            // nothing can be appended to a dead ring, so it is empty now
+            count += drain_ring(ring);
+            ring->reaped = true;
+        }
+    }
+    for (struct log_ring *ring = first; ring != NULL; ring = ring->next) {
+        if (!ring->reaped)
+            count += drain_ring(ring);
+    }
+
+    struct log_ring *prev = NULL;
+    struct log_ring *ring = atomic_load(&rings);
+
+    while (ring != NULL) {
+        struct log_ring *next = ring->next;
+
+        if (ring->reaped) {
+            struct log_ring *expected = ring;
+            if (prev == NULL && !atomic_compare_exchange_strong(&rings, &expected, next)) {
+                // new rings were pushed in front of this one
+                prev = atomic_load(&rings);
+                while (prev->next != ring)
+                    prev = prev->next;
+            }
+            if (prev != NULL)
+                prev->next = next;
+            free(ring);
+            STATS_SUB(log_ring_bytes, sizeof(struct log_ring));
+        } else {
+            prev = ring;
+        }
+        ring = next;
+    }
+
+    static unsigned long reported_drops = 0;
+    unsigned long drops = STATS_GET(log_dropped);
+    if (drops != reported_drops) {
+        char msg[LOG_MSG_MAX];
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        int len = snprintf(msg, LOG_MSG_MAX, "chilog: %lu log messages dropped", drops - reported_drops);
+        write_line(WARNING, now.tv_sec, 0, msg, len);
+        reported_drops = drops;
+        count++;
+    }
+
+    return count;
+}
+
+static bool rings_pending()
+{
+    for (struct log_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        if (atomic_load(&ring->head) != atomic_load(&ring->tail))
+            return true;
+    }
+    return false;
+}
+
+static void *writer_thread(void *args)
+{
+    while (true) {
+        bool stop = atomic_load(&writer_stop);
+        if (drain_all() > 0) {
+            fflush(stdout);
+            continue;
+        }
+        if (stop)
+            break;
+
+        pthread_mutex_lock(&writer_mutex);
+        // seq_cst: pairs with producers checking whether we are idle
+        atomic_store(&writer_idle, true);
+        if (!rings_pending() && !atomic_load(&writer_stop)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer_cond, &writer_mutex, &deadline);
+        }
+        atomic_store(&writer_idle, false);
+        pthread_mutex_unlock(&writer_mutex);
+    }
+    fflush(stdout);
+    return NULL;
+}
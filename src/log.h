@@ -14,6 +14,11 @@
  *  DEBUG: Lower-level information
  *  TRACE: Very low-level information.
  *
+ *  Messages are formatted by the calling thread into a per-thread
+ *  ring buffer and written to stdout by a background thread, so
+ *  logging never blocks. If a thread logs faster than the writer
+ *  can keep up, the excess messages are dropped and counted.
+ *
  */
 
 /*
@@ -51,6 +56,9 @@
 #ifndef CHIRC_LOG_H_
 #define CHIRC_LOG_H_
 
+#include <stdbool.h>
+#include <stdatomic.h>
+
 /* Log levels */
 typedef enum {
     QUIET    = 00,
@@ -62,6 +70,12 @@ typedef enum {
     TRACE    = 60
 } loglevel_t;
 
+/* Log output formats */
+typedef enum {
+    LOG_FORMAT_TEXT,
+    LOG_FORMAT_JSON
+} logformat_t;
+
 /*
  * chitcp_setloglevel - Sets the logging level
  *
@@ -76,6 +90,38 @@ typedef enum {
 void chirc_setloglevel(loglevel_t level);
 
 
+/*
+ * chirc_setlogformat - Sets the output format of the log
+ *
+ * LOG_FORMAT_TEXT prints "[timestamp] LEVEL message" lines,
+ * LOG_FORMAT_JSON prints one JSON object per line with the
+ * time, level, thread and msg fields.
+ *
+ * format: Output format
+ *
+ * Returns: Nothing.
+ */
+void chirc_setlogformat(logformat_t format);
+
+
+/*
+ * CHIRC_LOG_MAX_LEVEL - Most verbose level compiled into the binary
+ *
+ * chilog() calls above this level are removed at compile time,
+ * arguments included. It is set from CMake (see CHIRC_LOG_MAX_LEVEL
+ * in CMakeLists.txt); release builds default to INFO.
+ */
+#ifndef CHIRC_LOG_MAX_LEVEL
+#define CHIRC_LOG_MAX_LEVEL TRACE
+#endif
+
+/* Current runtime logging level, use chirc_setloglevel() to change it */
+extern int chirc_loglevel;
+
+/* Whether a message at this level would be printed */
+#define chilog_enabled(level) \
+    ((level) <= CHIRC_LOG_MAX_LEVEL && __builtin_expect((level) <= chirc_loglevel, 0))
+
 /*
  * chilog - Print a log message
  *
@@ -85,9 +131,91 @@ void chirc_setloglevel(loglevel_t level);
  *
  * ...: Extra parameters if needed by fmt
  *
+ * The level is checked before the arguments are evaluated, so
+ * disabled messages cost a single predicted branch (or nothing
+ * at all if compiled out by CHIRC_LOG_MAX_LEVEL).
+ *
+ * Returns: nothing.
+ */
+#define chilog(level, ...) \
+    do { \
+        if (chilog_enabled(level)) \
+            chilog_emit((level), __VA_ARGS__); \
+    } while (0)
+
+
+/* Per call-site state of chilog_ratelimited() */
+typedef struct {
+    atomic_long last;
+    atomic_ulong suppressed;
+} chilog_ratelimit_t;
+
+/*
+ * chilog_ratelimited - Print a log message at most once per interval
+ *
+ * Meant for messages that can be triggered by every single client
+ * message (e.g. unsupported commands). Messages suppressed in the
+ * meantime are counted and reported with the next one printed.
+ *
+ * level: Logging level of the message
+ *
+ * interval: Minimum number of seconds between two messages of
+ *           this call site
+ *
+ * fmt, ...: As in chilog()
+ *
+ * Returns: nothing.
+ */
+#define chilog_ratelimited(level, interval, ...) \
+    do { \
+        static chilog_ratelimit_t __chilog_rl; \
+        if (chilog_enabled(level) && chilog_ratelimit_pass(&__chilog_rl, (level), (interval))) \
+            chilog_emit((level), __VA_ARGS__); \
+    } while (0)
+
+
+/*
+ * chilog_emit - Unconditionally queue a log message
+ *
+ * Use chilog() instead, which checks the level first.
+ *
+ * Returns: nothing.
+ */
+void chilog_emit(loglevel_t level, char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+
+/*
+ * chilog_ratelimit_pass - Rate limiting check used by chilog_ratelimited()
+ *
+ * Returns: true if the message should be printed.
+ */
+bool chilog_ratelimit_pass(chilog_ratelimit_t *rl, loglevel_t level, int interval);
+
+
+/*
+ * chilog_release - Give back the calling thread's ring buffer
+ *
+ * For threads about to sit idle for a long time (e.g. a connection
+ * thread waiting for its client): the writer frees the ring once it
+ * has written it out, and the next message allocates a new one, so
+ * an idle thread holds no log memory.
+ *
+ * Returns: nothing.
+ */
+void chilog_release();
+
+
+/*
+ * chilog_flush - Write out all pending log messages
+ *
+ * Messages are queued by chilog() and written by a background
+ * thread. This waits until everything queued so far is written
+ * and stops the writer, so it must only be called on shutdown
+ * (it is also run automatically on exit()).
+ *
  * Returns: nothing.
  */
-void chilog(loglevel_t level, char *fmt, ...);
+void chilog_flush();
 
 
 #endif /* CHIRC_LOG_H_ */
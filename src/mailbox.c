@@ -0,0 +1,136 @@
+#include "mailbox.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+
+/*
+ * Intrusive MPSC queue after Dmitry Vyukov: a producer swaps itself in as
+ * the new head and then links the previous head to it, so posting is a
+ * single atomic exchange. Between those two steps the consumer may see
+ * the queue as empty; the producer wakes it up afterwards anyway.
+ */
+
+int mailbox_init(mailbox_t *mailbox)
+{
+    atomic_init(&mailbox->stub.next, NULL);
+    atomic_init(&mailbox->head, &mailbox->stub);
+    mailbox->tail = &mailbox->stub;
+    atomic_init(&mailbox->queued_bytes, 0);
+    atomic_init(&mailbox->wakeup_pending, false);
+
+    mailbox->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mailbox->wakeup_fd == -1) {
+        chilog(ERROR, "mailbox_init: could not create eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+static void push(mailbox_t *mailbox, struct mailbox_msg *msg)
+{
+    atomic_store_explicit(&msg->next, NULL, memory_order_relaxed);
+    struct mailbox_msg *prev = atomic_exchange_explicit(&mailbox->head, msg, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, msg, memory_order_release);
+}
+
+/**
+ * @brief take the oldest message, consumer only
+ *
+ * @param mailbox
+ * @return struct mailbox_msg*: NULL if empty (or a producer is halfway through)
+ */
+static struct mailbox_msg *pop(mailbox_t *mailbox)
+{
+    struct mailbox_msg *tail = mailbox->tail;
+    struct mailbox_msg *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &mailbox->stub) {
+        if (next == NULL)
+            return NULL;
+        mailbox->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next != NULL) {
+        mailbox->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&mailbox->head, memory_order_acquire))
+        return NULL;
+
+    // tail is the last message, put the stub behind it so it can be taken
+    push(mailbox, &mailbox->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        mailbox->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+long mailbox_post(mailbox_t *mailbox, const char *data, int len)
+{
+    struct mailbox_msg *msg = malloc(sizeof(struct mailbox_msg) + len);
+    if (msg == NULL) {
+        chilog(CRITICAL, "mailbox_post: fail to allocate memory");
+        exit(1);
+    }
+    msg->len = len;
+    msg->data = (char *) (msg + 1);
+    memcpy(msg->data, data, len);
+
+    long queued = atomic_fetch_add(&mailbox->queued_bytes, len) + len;
+    push(mailbox, msg);
+
+    // only the first post since the consumer last woke up needs to wake it
+    if (!atomic_exchange(&mailbox->wakeup_pending, true)) {
+        uint64_t one = 1;
+        if (write(mailbox->wakeup_fd, &one, sizeof(one)) == -1) {
+            chilog(ERROR, "mailbox_post: could not wake up the consumer");
+        }
+    }
+    return queued;
+}
+
+void mailbox_ack(mailbox_t *mailbox)
+{
+    uint64_t count;
+    // fails with EAGAIN if there was nothing to read, which is fine
+    ssize_t rv = read(mailbox->wakeup_fd, &count, sizeof(count));
+    (void) rv;
+    // posts from here on wake us up again
+    atomic_store(&mailbox->wakeup_pending, false);
+}
+
+sds mailbox_drain(mailbox_t *mailbox, sds buf, long *drained)
+{
+    long total = 0;
+    struct mailbox_msg *msg;
+    while ((msg = pop(mailbox)) != NULL) {
+        buf = sdscatlen(buf, msg->data, msg->len);
+        total += msg->len;
+        free(msg);
+    }
+    if (total > 0)
+        atomic_fetch_sub(&mailbox->queued_bytes, total);
+    *drained = total;
+    return buf;
+}
+
+void mailbox_destroy(mailbox_t *mailbox)
+{
+    struct mailbox_msg *msg;
+    while ((msg = pop(mailbox)) != NULL) {
+        free(msg);
+    }
+    if (mailbox->wakeup_fd != -1)
+        close(mailbox->wakeup_fd);
+    mailbox->wakeup_fd = -1;
+}
@@ -0,0 +1,82 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sds.h>
+
+/**
+ * @brief one queued message, the bytes follow the struct in the same allocation
+ *
+ */
+struct mailbox_msg {
+    _Atomic(struct mailbox_msg *) next;
+    int len;
+    char *data;
+};
+
+/**
+ * @brief a multi-producer single-consumer queue of outgoing messages
+ *
+ * Any thread can post to a connection's mailbox without taking a lock;
+ * only the thread that owns the connection takes messages out, and it
+ * is woken up through an eventfd when the mailbox stops being empty.
+ *
+ */
+struct mailbox {
+    // producers append at the head, the consumer takes from the tail
+    _Atomic(struct mailbox_msg *) head;
+    struct mailbox_msg *tail;
+    struct mailbox_msg stub;
+
+    atomic_long queued_bytes;
+    atomic_bool wakeup_pending;
+    int wakeup_fd;
+};
+
+typedef struct mailbox mailbox_t;
+
+/**
+ * @brief initialize an empty mailbox
+ *
+ * @param mailbox
+ * @return int -1: FAILURE 0: SUCCESS
+ */
+int mailbox_init(mailbox_t *mailbox);
+
+/**
+ * @brief free the messages left in a mailbox and close its eventfd
+ *
+ * @param mailbox
+ */
+void mailbox_destroy(mailbox_t *mailbox);
+
+/**
+ * @brief post a copy of a message, can be called from any thread
+ *
+ * @param mailbox
+ * @param data
+ * @param len
+ * @return long: the number of bytes queued after posting
+ */
+long mailbox_post(mailbox_t *mailbox, const char *data, int len);
+
+/**
+ * @brief acknowledge a wakeup, called by the consumer when wakeup_fd
+ *        becomes readable, before draining
+ *
+ * @param mailbox
+ */
+void mailbox_ack(mailbox_t *mailbox);
+
+/**
+ * @brief move every queued message to the end of buf, called by the consumer only
+ *
+ * @param mailbox
+ * @param buf
+ * @param drained: to store the number of bytes moved
+ * @return sds: the new buf
+ */
+sds mailbox_drain(mailbox_t *mailbox, sds buf, long *drained);
+
+#endif
@@ -53,27 +53,38 @@
 #include <signal.h>
 
 #include <sds.h>
-#include "uthash.h"
 #include "log.h"
 #include "user.h"
 #include "context.h"
 #include "single_service.h"
 #include "connection.h"
+#include "stats.h"
+#include "metrics.h"
+#include "probes.h"
+#include "lockprof.h"
+#include "fanout.h"
 
 #define BACKLOG 5
 #define MAX_BUFFER_SIZE 512
 #define HOST_NAME_LENGTH 1024
 
-void start_server(char *port, char * passwd, char * servername, char * network_file);
+// channels with at least this many recipients are delivered by the fan-out pool
+#define DEFAULT_FANOUT_THRESHOLD 1000
+#define MAX_FANOUT_THREADS 16
+
+void start_server(char *port, char * passwd, char * servername, char * network_file, char *metrics_addr);
+
+static void *signal_thread(void *args);
 
 int main(int argc, char *argv[])
 {
     // process command line arguments
     int opt;
-    char *port = "6667", *passwd = NULL, *servername = NULL, *network_file = NULL;
+    char *port = "6667", *passwd = NULL, *servername = NULL, *network_file = NULL, *metrics_addr = NULL;
     int verbosity = 0;
+    int fanout_threshold = DEFAULT_FANOUT_THRESHOLD;
 
-    while ((opt = getopt(argc, argv, "p:o:s:n:vqh")) != -1)
+    while ((opt = getopt(argc, argv, "p:o:s:n:m:l:f:vqh")) != -1)
         switch (opt) {
         case 'p':
             port = strdup(optarg);
@@ -91,6 +102,20 @@ int main(int argc, char *argv[])
             }
             network_file = strdup(optarg);
             break;
+        case 'm':
+            metrics_addr = strdup(optarg);
+            break;
+        case 'l':
+            if (strcmp(optarg, "json") == 0) {
+                chirc_setlogformat(LOG_FORMAT_JSON);
+            } else if (strcmp(optarg, "text") != 0) {
+                fprintf(stderr, "ERROR: Unknown log format %s (use text or json)\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'f':
+            fanout_threshold = atoi(optarg);
+            break;
         case 'v':
             verbosity++;
             break;
@@ -98,7 +123,7 @@ int main(int argc, char *argv[])
             verbosity = -1;
             break;
         case 'h':
-            printf("Usage: chirc -o OPER_PASSWD [-p PORT] [-s SERVERNAME] [-n NETWORK_FILE] [(-q|-v|-vv)]\n");
+            printf("Usage: chirc -o OPER_PASSWD [-p PORT] [-s SERVERNAME] [-n NETWORK_FILE] [-m METRICS_PORT|METRICS_SOCKET] [-l text|json] [-f FANOUT_THRESHOLD] [(-q|-v|-vv)]\n");
             exit(0);
             break;
         default:
@@ -137,21 +162,58 @@ int main(int argc, char *argv[])
 
     /* code starts here*/
 
+    // SIGUSR1 is blocked in every thread and handled by signal_thread()
     sigset_t new;
     sigemptyset(&new);
     sigaddset(&new, SIGPIPE);
+    sigaddset(&new, SIGUSR1);
     if (pthread_sigmask(SIG_BLOCK, &new, NULL) != 0) {
         perror("Unable to mask SIGPIPE");
         exit(-1);
     }
 
-    start_server(port, passwd, servername, network_file);
+    pthread_t signal_handler;
+    if (pthread_create(&signal_handler, NULL, signal_thread, NULL) != 0) {
+        perror("Unable to create the signal handling thread");
+        exit(-1);
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int fanout_threads = ncpus < 2 ? 2 : (ncpus > MAX_FANOUT_THREADS ? MAX_FANOUT_THREADS : ncpus);
+    if (start_fanout_pool(fanout_threshold, fanout_threads) == -1) {
+        fprintf(stderr, "ERROR: Unable to start the fan-out pool\n");
+        exit(-1);
+    }
+
+    start_server(port, passwd, servername, network_file, metrics_addr);
 
     return EXIT_SUCCESS;
 }
 
 
 
+/**
+ * @brief waits for SIGUSR1 and dumps the lock contention profile to the log
+ * 
+ * @param args unused
+ * @return void* 
+ */
+static void *signal_thread(void *args)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_detach(pthread_self());
+
+    while (true) {
+        int sig;
+        if (sigwait(&set, &sig) == 0 && sig == SIGUSR1) {
+            lockprof_log();
+        }
+    }
+    return NULL;
+}
+
 /**
  * @Start the server, set socket functions and accept client requests
  * Serve as a bridge between server process and a user thread
@@ -160,8 +222,9 @@ int main(int argc, char *argv[])
  * @param passwd 
  * @param servername 
  * @param network_file 
+ * @param metrics_addr port or unix socket path for the metrics endpoint, NULL to disable it
  */
-void start_server(char *port, char * passwd, char * servername, char * network_file){
+void start_server(char *port, char * passwd, char * servername, char * network_file, char *metrics_addr){
     // socket
     int server_fd, client_fd;
 
@@ -171,10 +234,6 @@ void start_server(char *port, char * passwd, char * servername, char * network_f
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
 
-    // TODO: sockaddr_storage
-    struct sockaddr_in *client_addr;
-    socklen_t sin_size = sizeof(struct sockaddr_in);
-
     int rv, yes = 1;
     if ((rv = getaddrinfo(NULL, port, &hints, &res)) != 0) {
         chilog(CRITICAL, "getaddrinfo: %s\n", gai_strerror(rv));
@@ -210,7 +269,7 @@ void start_server(char *port, char * passwd, char * servername, char * network_f
 
     if (p == NULL) {
         chilog(CRITICAL, "could not find a socket to bind to");
-        pthread_exit(NULL);
+        exit(1);
     }
 
     // create global context
@@ -218,7 +277,6 @@ void start_server(char *port, char * passwd, char * servername, char * network_f
 
     // multi-thread
     pthread_t worker_thread;
-    struct worker_args *wa;
 
     char *server_host_name = malloc(HOST_NAME_LENGTH);
     gethostname(server_host_name, HOST_NAME_LENGTH);
@@ -226,53 +284,50 @@ void start_server(char *port, char * passwd, char * servername, char * network_f
 
     freeaddrinfo(res);
 
+    if (metrics_addr != NULL && start_metrics_server(metrics_addr) == FAILURE) {
+        chilog(CRITICAL, "could not start the metrics endpoint on %s", metrics_addr);
+        exit(1);
+    }
+
     chilog(INFO, "server: waiting for connections...");
 
-    while (true) {
-        if ((client_addr = calloc(1, sin_size)) == NULL) {
-            // allocate client_addr for each thread
-            chilog(ERROR, "fail to allocate memory for client_addr");
-        }
+    pthread_attr_t worker_attr;
+    pthread_attr_init(&worker_attr);
+    pthread_attr_setstacksize(&worker_attr, WORKER_STACK_SIZE);
 
-        if ((client_fd = accept(server_fd, (struct sockaddr *)client_addr, &sin_size)) == -1) {
-            free(client_addr);
+    while (true) {
+        struct sockaddr_storage client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        if ((client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len)) == -1) {
             chilog(ERROR, "Could not accept connection");
             continue;
         }
-
-        if ((wa = calloc(1, sizeof(struct worker_args))) == NULL) {
-            // create thread function args for each thread
-            chilog(ERROR, "fail to allocate memory for wa");
+        STATS_ADD(accepts, 1);
+        CHIRC_PROBE1(accept, client_fd);
+
+        // resolved on the stack, the user only keeps as much as it needs
+        char client_host_name[NI_MAXHOST];
+        if (getnameinfo((struct sockaddr *)&client_addr, addr_len, client_host_name, sizeof(client_host_name),
+                        NULL, 0, 0) != 0) {
+            strcpy(client_host_name, "*");
         }
+        chilog(DEBUG, "client host name: %s", client_host_name);
 
-        //create a connection handle for each connection(thread)
-        connection_handle connection_info = create_connection(client_fd);
-        //add this connection_info into corresponding hash table
-        add_connection(ctx, connection_info);
-
-        user_handle user_info = create_user(); // create a user_handle for each thread
-        user_info->client_fd = client_fd;
-        char *client_host_name = malloc(HOST_NAME_LENGTH);
-        if (client_host_name == NULL) {
-            chilog(ERROR, "fail to allocate memory for client_host_name");
-        } else {
-            getnameinfo((struct sockaddr *)client_addr, sin_size, client_host_name, HOST_NAME_LENGTH,
-                        NULL, 0, 0);
-            chilog(DEBUG, "client host name: %s", client_host_name);
-            user_info->client_host_name = client_host_name;
+        // one allocation per connection: the user embeds its connection
+        // state, host name and everything its thread needs
+        user_handle user_info = create_user(ctx, client_fd, client_host_name);
+        if (user_info == NULL) {
+            close(client_fd);
+            continue;
         }
+        //add this connection into corresponding table
+        add_connection(ctx, &user_info->connection);
 
-        // construct arguments for thread function
-        wa->user_info = user_info;
-        wa->ctx = ctx;
-
-        if (pthread_create(&worker_thread, NULL, service_single_client, wa) != 0) {
+        if (pthread_create(&worker_thread, &worker_attr, service_single_client, user_info) != 0) {
             perror("could not create a worker thread");
             delete_connection(ctx, client_fd);
-            destroy_connection(connection_info);
             close(client_fd);
             destroy_user(user_info);
-            free(wa);
         }
     }
 
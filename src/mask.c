@@ -0,0 +1,79 @@
+#include "mask.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include "arena.h"
+
+bool mask_has_wildcards(const char *pattern)
+{
+    return strpbrk(pattern, "*?") != NULL;
+}
+
+void mask_compile(mask_t *mask, const char *pattern)
+{
+    size_t len = strlen(pattern);
+    mask->pattern = arena_alloc(len + 1);
+    int stars = 0;
+    for (size_t i = 0; i <= len; i++) {
+        mask->pattern[i] = tolower((unsigned char) pattern[i]);
+        stars += pattern[i] == '*';
+    }
+    mask->len = len;
+    mask->prefix_len = strcspn(pattern, "*?");
+    mask->wildcards = mask->prefix_len < len;
+    mask->star = stars > 0;
+
+    mask->nsegments = stars + 1;
+    mask->segments = arena_alloc(mask->nsegments * sizeof(struct mask_segment));
+    size_t start = 0;
+    for (int i = 0; i < mask->nsegments; i++) {
+        const char *end = strchr(mask->pattern + start, '*');
+        size_t seg_len = end == NULL ? len - start : (size_t) (end - mask->pattern) - start;
+        mask->segments[i].start = start;
+        mask->segments[i].len = seg_len;
+        start += seg_len + 1;
+    }
+}
+
+/**
+ * @brief whether a segment matches a name at some position
+ */
+static bool segment_match(const mask_t *mask, const struct mask_segment *segment, const char *name)
+{
+    const char *p = mask->pattern + segment->start;
+    for (size_t i = 0; i < segment->len; i++) {
+        if (p[i] != '?' && p[i] != tolower((unsigned char) name[i]))
+            return false;
+    }
+    return true;
+}
+
+bool mask_match(const mask_t *mask, const char *name)
+{
+    size_t name_len = strlen(name);
+    const struct mask_segment *first = &mask->segments[0];
+    if (!mask->star) {
+        return name_len == first->len && segment_match(mask, first, name);
+    }
+
+    const struct mask_segment *last = &mask->segments[mask->nsegments - 1];
+    if (name_len < first->len + last->len || !segment_match(mask, first, name)
+        || !segment_match(mask, last, name + name_len - last->len)) {
+        return false;
+    }
+
+    // the segments in between, each as early as it fits
+    size_t pos = first->len;
+    size_t end = name_len - last->len;
+    for (int i = 1; i < mask->nsegments - 1; i++) {
+        const struct mask_segment *segment = &mask->segments[i];
+        while (pos + segment->len <= end && !segment_match(mask, segment, name + pos)) {
+            pos++;
+        }
+        if (pos + segment->len > end)
+            return false;
+        pos += segment->len;
+    }
+    return true;
+}
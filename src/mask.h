@@ -0,0 +1,61 @@
+#ifndef MASK_H
+#define MASK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * IRC masks: '*' matches any run of characters (including none) and '?'
+ * any single one; everything else matches itself, ignoring ASCII case.
+ *
+ * A mask is compiled once before it is matched against many names: it is
+ * folded to lowercase and split at its '*'s into segments. The first
+ * segment has to match at the start of a name and the last one at its end,
+ * those in between are looked for left to right, so matching never
+ * backtracks. A mask without wildcards is a single comparison.
+ */
+
+struct mask_segment {
+    size_t start;           // in pattern
+    size_t len;
+};
+
+typedef struct mask {
+    char *pattern;          // folded
+    size_t len;
+    size_t prefix_len;      // before the first wildcard, which every
+                            // name the mask matches starts with
+    bool wildcards;
+    bool star;              // whether it has a '*'
+    int nsegments;          // the runs around the '*'s, some may be empty
+    struct mask_segment *segments;
+} mask_t;
+
+/**
+ * @brief whether a mask has any wildcards, i.e. matches more than a
+ * single name
+ *
+ * @param pattern
+ * @return bool
+ */
+bool mask_has_wildcards(const char *pattern);
+
+/**
+ * @brief compile a mask
+ *
+ * @param mask
+ * @param pattern
+ * (the compiled mask is carved from the caller's arena, see arena.h)
+ */
+void mask_compile(mask_t *mask, const char *pattern);
+
+/**
+ * @brief match a name against a compiled mask
+ *
+ * @param mask
+ * @param name
+ * @return bool
+ */
+bool mask_match(const mask_t *mask, const char *name);
+
+#endif
@@ -0,0 +1,251 @@
+#include "membership.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "alloc.h"
+
+#define MEMBER_SET_INITIAL_CAPACITY 4
+
+struct member {
+    user_handle user;
+    int line;
+    uint8_t modes;
+};
+
+#define MEMBER_BYTES (sizeof(user_handle) + sizeof(int) + sizeof(uint8_t))
+
+static unsigned slot_of(const member_set_t *set, user_handle user)
+{
+    // the low bits of an address are mostly alignment, mix them all in
+    uint64_t x = (uint64_t) (uintptr_t) user;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned) x & (set->capacity - 1);
+}
+
+/**
+ * @brief in a sorted set, the slot of a user or where it would go
+ *
+ * @param set
+ * @param user
+ * @param found: set to whether the user is there
+ * @return int
+ */
+static int sorted_position(const member_set_t *set, user_handle user, bool *found)
+{
+    int lo = 0, hi = set->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (set->users[mid] < user) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < set->count && set->users[lo] == user;
+    return lo;
+}
+
+static void allocate(member_set_t *set, int capacity)
+{
+    alloc_tag_t prev = alloc_set_tag(ALLOC_CHANNEL);
+    void *arrays = chirc_malloc(capacity * MEMBER_BYTES);
+    alloc_set_tag(prev);
+    if (arrays == NULL) {
+        chilog(CRITICAL, "member_set: fail to allocate memory");
+        exit(1);
+    }
+    memset(arrays, 0, capacity * MEMBER_BYTES);
+    set->users = arrays;
+    set->lines = (int *) (set->users + capacity);
+    set->modes = (uint8_t *) (set->lines + capacity);
+    set->capacity = capacity;
+}
+
+static void hashed_insert(member_set_t *set, user_handle user, int line, uint8_t modes)
+{
+    unsigned mask = set->capacity - 1;
+    unsigned i = slot_of(set, user);
+    while (set->users[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    set->users[i] = user;
+    set->lines[i] = line;
+    set->modes[i] = modes;
+}
+
+static int compare_members(const void *a, const void *b)
+{
+    user_handle x = ((const struct member *) a)->user;
+    user_handle y = ((const struct member *) b)->user;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief move the members to arrays of another capacity, hashed or sorted
+ *
+ * @param set
+ * @param capacity: a power of two if hashed
+ * @param hashed
+ */
+static void rebuild(member_set_t *set, int capacity, bool hashed)
+{
+    int count = set->count;
+    struct member *members = malloc((count > 0 ? count : 1) * sizeof(struct member));
+    if (members == NULL) {
+        chilog(CRITICAL, "member_set: fail to allocate memory");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; i < member_set_slots(set); i++) {
+        if (set->users[i] != NULL) {
+            members[n].user = set->users[i];
+            members[n].line = set->lines[i];
+            members[n].modes = set->modes[i];
+            n++;
+        }
+    }
+    if (!hashed && set->hashed) {
+        qsort(members, n, sizeof(struct member), compare_members);
+    }
+
+    chirc_free(set->users);
+    allocate(set, capacity);
+    set->hashed = hashed;
+    for (int i = 0; i < n; i++) {
+        if (hashed) {
+            hashed_insert(set, members[i].user, members[i].line, members[i].modes);
+        } else {
+            set->users[i] = members[i].user;
+            set->lines[i] = members[i].line;
+            set->modes[i] = members[i].modes;
+        }
+    }
+    free(members);
+}
+
+void member_set_init(member_set_t *set)
+{
+    set->count = 0;
+    set->capacity = 0;
+    set->hashed = false;
+    set->users = NULL;
+    set->lines = NULL;
+    set->modes = NULL;
+}
+
+void member_set_destroy(member_set_t *set)
+{
+    chirc_free(set->users);
+    member_set_init(set);
+}
+
+int member_set_find(const member_set_t *set, user_handle user)
+{
+    if (set->count == 0) {
+        return -1;
+    }
+
+    if (!set->hashed) {
+        bool found;
+        int i = sorted_position(set, user, &found);
+        return found ? i : -1;
+    }
+
+    unsigned mask = set->capacity - 1;
+    for (unsigned i = slot_of(set, user); set->users[i] != NULL; i = (i + 1) & mask) {
+        if (set->users[i] == user) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int member_set_add(member_set_t *set, user_handle user, uint8_t modes)
+{
+    if (member_set_find(set, user) != -1) {
+        return 1;
+    }
+
+    if (set->hashed) {
+        // keep the table at most 3/4 full
+        if (4 * (set->count + 1) > 3 * set->capacity) {
+            rebuild(set, 2 * set->capacity, true);
+        }
+        hashed_insert(set, user, -1, modes);
+        set->count++;
+        return 0;
+    }
+
+    if (set->count == MEMBER_SET_HASH_THRESHOLD) {
+        rebuild(set, 4 * MEMBER_SET_HASH_THRESHOLD, true);
+        hashed_insert(set, user, -1, modes);
+        set->count++;
+        return 0;
+    }
+
+    if (set->count == set->capacity) {
+        rebuild(set, set->capacity == 0 ? MEMBER_SET_INITIAL_CAPACITY : 2 * set->capacity, false);
+    }
+    bool found;
+    int i = sorted_position(set, user, &found);
+    memmove(set->users + i + 1, set->users + i, (set->count - i) * sizeof(user_handle));
+    memmove(set->lines + i + 1, set->lines + i, (set->count - i) * sizeof(int));
+    memmove(set->modes + i + 1, set->modes + i, (set->count - i) * sizeof(uint8_t));
+    set->users[i] = user;
+    set->lines[i] = -1;
+    set->modes[i] = modes;
+    set->count++;
+    return 0;
+}
+
+int member_set_remove(member_set_t *set, user_handle user)
+{
+    int i = member_set_find(set, user);
+    if (i == -1) {
+        return 1;
+    }
+    set->count--;
+
+    if (!set->hashed) {
+        memmove(set->users + i, set->users + i + 1, (set->count - i) * sizeof(user_handle));
+        memmove(set->lines + i, set->lines + i + 1, (set->count - i) * sizeof(int));
+        memmove(set->modes + i, set->modes + i + 1, (set->count - i) * sizeof(uint8_t));
+        set->users[set->count] = NULL;
+        if (set->count == 0) {
+            member_set_destroy(set);
+        } else if (set->capacity > MEMBER_SET_INITIAL_CAPACITY && 4 * set->count <= set->capacity) {
+            rebuild(set, set->capacity / 2, false);
+        }
+        return 0;
+    }
+
+    // backward-shift deletion: pull later entries of the probe run into
+    // the hole so that no lookup stops short of them
+    unsigned mask = set->capacity - 1;
+    unsigned hole = i;
+    for (unsigned j = (hole + 1) & mask; set->users[j] != NULL; j = (j + 1) & mask) {
+        unsigned home = slot_of(set, set->users[j]);
+        // j may move into the hole if its home isn't in (hole, j]
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            set->users[hole] = set->users[j];
+            set->lines[hole] = set->lines[j];
+            set->modes[hole] = set->modes[j];
+            hole = j;
+        }
+    }
+    set->users[hole] = NULL;
+    set->lines[hole] = 0;
+    set->modes[hole] = 0;
+
+    if (set->count < MEMBER_SET_HASH_THRESHOLD / 2) {
+        // small again, with some slack before it is hashed again
+        rebuild(set, MEMBER_SET_HASH_THRESHOLD, false);
+    } else if (set->capacity > 4 * MEMBER_SET_HASH_THRESHOLD && 8 * set->count < set->capacity) {
+        rebuild(set, set->capacity / 2, true);
+    }
+    return 0;
+}
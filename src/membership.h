@@ -1,25 +1,99 @@
 #ifndef MEMBERSHIP_H
 #define MEMBERSHIP_H
 
-#include <uthash.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "user.h"
+
+/* mode bits of a member */
+#define MEMBER_MODE_OPERATOR 0x01    // @, o
+#define MEMBER_MODE_VOICE 0x02       // +, v
+
+/* above this many members, a set is hashed rather than sorted */
+#define MEMBER_SET_HASH_THRESHOLD 32
 
 /**
- * @brief this struct is used to represent the relationship
- * between channel and user, nick is the nick of the user, is_channel_operator denotes 
- * whether a user is an operator of current channel, a channel will maintain a hashmap
- * of membership_t to store all users on this channel
- * 
+ * @brief the relationship between a channel and its users: a member is
+ * the user, its mode bits and the line of its NAMES entry, kept in
+ * parallel arrays so that walking the members (NAMES, fan-out) reads
+ * them sequentially
+ *
+ * A small set keeps its users sorted by address at the front of the
+ * arrays and finds them by binary search. Above MEMBER_SET_HASH_THRESHOLD
+ * members the arrays become an open-addressed table (linear probing, a
+ * NULL user is an empty slot). Either way every non-NULL slot is a member:
+ *
+ *     for (int i = 0; i < member_set_slots(set); i++)
+ *         if (set->users[i] != NULL) ...
+ *
+ * The set doesn't lock, the channel's member table lock protects it.
  */
-struct membership_t {
-    char * nick;    // key
-
-    bool is_channel_operator;
-    
-    UT_hash_handle hh; 
+struct member_set {
+    int count;
+    int capacity;           // slots in both arrays
+    bool hashed;
+    user_handle *users;
+    // where the member is in the channel's names cache, so that patching
+    // it only looks at one line (see namescache.h); -1 if it isn't there
+    int *lines;             // follows users in the same allocation
+    uint8_t *modes;         // and follows lines
 };
 
-typedef struct membership_t membership_t;
+typedef struct member_set member_set_t;
+
+/**
+ * @brief initialize an empty set
+ *
+ * @param set
+ */
+void member_set_init(member_set_t *set);
+
+/**
+ * @brief free the arrays of a set, not the users
+ *
+ * @param set
+ */
+void member_set_destroy(member_set_t *set);
+
+/**
+ * @brief the number of slots to walk to see every member
+ *
+ * @param set
+ * @return int
+ */
+static inline int member_set_slots(const member_set_t *set)
+{
+    return set->hashed ? set->capacity : set->count;
+}
+
+/**
+ * @brief find a member
+ *
+ * @param set
+ * @param user
+ * @return int: its slot, -1 if the user isn't a member
+ */
+int member_set_find(const member_set_t *set, user_handle user);
 
-typedef membership_t * membership_handle;
+/**
+ * @brief add a member
+ *
+ * @param set
+ * @param user
+ * @param modes: its initial mode bits
+ * @return int 0: added 1: already a member
+ *
+ * A new member isn't in the names cache (its line is -1).
+ */
+int member_set_add(member_set_t *set, user_handle user, uint8_t modes);
+
+/**
+ * @brief remove a member
+ *
+ * @param set
+ * @param user
+ * @return int 0: removed 1: not a member
+ */
+int member_set_remove(member_set_t *set, user_handle user);
 
-#endif
\ No newline at end of file
+#endif
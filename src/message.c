@@ -3,42 +3,46 @@
 #include <stdlib.h>
 #include <sds.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "log.h"
+#include "arena.h"
 
 bool empty_string(char *str);
 
-int message_from_string(message_handle msg, char *s)
+int message_from_string(message_handle msg, const char *s, int len)
 {
     if (msg == NULL) {
         chilog(ERROR, "message_from_string: empty message_handle");
         return -1;
     }
-    if (empty_string(s)) {
+    if (s == NULL || len == 0) {
         chilog(ERROR, "message_from_string: empty string");
         return -1;
     }
 
-    // first split the string by :
-    int count_1 = 0;
-    sds *split = sdssplitlen(s, sdslen(s), ":", 1, &count_1);
+    // everything after the first colon is a single parameter
+    const char *colon = memchr(s, ':', len);
+    const char *end = colon ? colon : s + len;
+    int max_params = colon ? MAX_PARAMS - 1 : MAX_PARAMS;
 
-    // then split the first part by " "
-    int count_2 = 0;
-    sds before_colon = split[0];
-    sds *tokens = sdssplitlen(before_colon, sdslen(before_colon), " ", 1, &count_2);
-
-    msg->cmd = tokens[0];
+    // then the part before it is split by " ", the first token being the command
+    const char *token = s;
+    const char *space = memchr(token, ' ', end - token);
+    const char *token_end = space ? space : end;
+    msg->cmd = arena_sds(token, token_end - token);
     msg->nparams = 0;
-    for (int i = 0; i < count_2 - 1; i++)
-        if (tokens[i + 1] != NULL && sdslen(tokens[i + 1]) > 0) {
-            msg->params[i] = tokens[i + 1];
-            msg->nparams += 1;
+    while (token_end < end) {
+        token = token_end + 1;
+        space = memchr(token, ' ', end - token);
+        token_end = space ? space : end;
+        if (token_end > token && msg->nparams < max_params) {
+            msg->params[msg->nparams++] = arena_sds(token, token_end - token);
         }
+    }
 
-    if (count_1 > 1) {
-        sdsrange(s, sdslen(before_colon) + 1, sdslen(s) - 1);
-        msg->params[msg->nparams++] = s;
+    if (colon) {
+        msg->params[msg->nparams++] = arena_sds(colon + 1, s + len - colon - 1);
         msg->longlast = true;
     } else {
         msg->longlast = false;
@@ -103,7 +107,7 @@ int message_add_parameter(message_handle msg, char *param, bool longlast)
         return -1;
     }
 
-    if (msg->nparams == 15) {
+    if (msg->nparams == MAX_PARAMS) {
         chilog(ERROR, "message_add_parameter: already 15 params, can't add more");
         return -1;
     }
@@ -3,10 +3,12 @@
 
 #include <stdbool.h>
 
+#define MAX_PARAMS 15
+
 struct message_t {
     char *prefix;
     char *cmd;
-    char *params[15];
+    char *params[MAX_PARAMS];
     unsigned int nparams;
     bool longlast;
 };
@@ -16,13 +18,16 @@ typedef struct message_t message_t;
 typedef message_t * message_handle;
 
 /**
- * @brief tokenize a string to a message object
+ * @brief tokenize a line to a message object, the command and parameters
+ * are read-only sds carved from the calling thread's arena (see arena.h),
+ * so the message needs no message_destroy()
  * 
  * @param msg 
- * @param s 
+ * @param s: the line, without its "\r\n"
+ * @param len 
  * @return int 
  */
-int message_from_string(message_handle msg, char *s);
+int message_from_string(message_handle msg, const char *s, int len);
 
 /**
  * @brief convert a message object to a string
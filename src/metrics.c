@@ -0,0 +1,263 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "log.h"
+#include "stats.h"
+#include "command.h"
+#include "context.h"
+#include "connection.h"
+#include "lockprof.h"
+#include "alloc.h"
+
+#define METRICS_BACKLOG 5
+#define METRICS_MAX_REQUEST 4096
+#define METRICS_MAX_COMMANDS 64
+
+// how long to wait before accepting again when out of descriptors (ms)
+#define METRICS_ACCEPT_BACKOFF_MS 100
+
+static void *metrics_thread(void *args);
+
+static int open_listener(char *addr);
+
+static sds add_family(sds s, char *name, char *type, char *unit, char *help)
+{
+    s = sdscatprintf(s, "# TYPE %s %s\n", name, type);
+    if (unit != NULL) {
+        s = sdscatprintf(s, "# UNIT %s %s\n", name, unit);
+    }
+    return sdscatprintf(s, "# HELP %s %s\n", name, help);
+}
+
+sds metrics_render()
+{
+    sds s = sdsempty();
+
+    s = add_family(s, "chirc_connections", "gauge", NULL, "Open client connections by registration state.");
+    s = sdscatprintf(s, "chirc_connections{state=\"unknown\"} %ld\n", STATS_GET(connections[UNKNOWN_CONNECTION]));
+    s = sdscatprintf(s, "chirc_connections{state=\"user\"} %ld\n", STATS_GET(connections[USER_CONNECTION]));
+    s = sdscatprintf(s, "chirc_connections{state=\"registered\"} %ld\n", STATS_GET(connections[REGISTERED_CONNECTION]));
+
+    s = add_family(s, "chirc_users", "gauge", NULL, "Users holding a nick.");
+    s = sdscatprintf(s, "chirc_users %ld\n", STATS_GET(users));
+
+    s = add_family(s, "chirc_channels", "gauge", NULL, "Channels formed.");
+    s = sdscatprintf(s, "chirc_channels %ld\n", STATS_GET(channels));
+
+    s = add_family(s, "chirc_operators", "gauge", NULL, "IRC operators online.");
+    s = sdscatprintf(s, "chirc_operators %ld\n", STATS_GET(operators));
+
+    s = add_family(s, "chirc_sendq_bytes", "gauge", "bytes", "Bytes queued for delivery to clients.");
+    s = sdscatprintf(s, "chirc_sendq_bytes %ld\n", STATS_GET(sendq_bytes));
+
+    s = add_family(s, "chirc_retired_objects", "gauge", NULL, "Removed objects waiting to be freed.");
+    s = sdscatprintf(s, "chirc_retired_objects %ld\n", STATS_GET(retired_pending));
+
+    s = add_family(s, "chirc_accepts", "counter", NULL, "Accepted client connections.");
+    s = sdscatprintf(s, "chirc_accepts_total %lu\n", STATS_GET(accepts));
+
+    s = add_family(s, "chirc_received_bytes", "counter", "bytes", "Bytes received from clients.");
+    s = sdscatprintf(s, "chirc_received_bytes_total %lu\n", STATS_GET(bytes_in));
+
+    s = add_family(s, "chirc_sent_bytes", "counter", "bytes", "Bytes sent to clients.");
+    s = sdscatprintf(s, "chirc_sent_bytes_total %lu\n", STATS_GET(bytes_out));
+
+    char *names[METRICS_MAX_COMMANDS];
+    unsigned long counts[METRICS_MAX_COMMANDS];
+    int n = get_command_stats(names, counts, METRICS_MAX_COMMANDS);
+    s = add_family(s, "chirc_commands", "counter", NULL, "Commands dispatched, by command.");
+    for (int i = 0; i < n; i++) {
+        s = sdscatprintf(s, "chirc_commands_total{command=\"%s\"} %lu\n", names[i], counts[i]);
+    }
+
+    s = add_family(s, "chirc_lock_acquisitions", "counter", NULL, "Lock acquisitions, by lock.");
+    for (lock_profile_t *p = lockprof_list(); p != NULL; p = p->next) {
+        s = sdscatprintf(s, "chirc_lock_acquisitions_total{lock=\"%s\"} %lu\n", p->name, atomic_load(&p->acquisitions));
+    }
+
+    s = add_family(s, "chirc_lock_contended", "counter", NULL, "Lock acquisitions that had to wait, by lock.");
+    for (lock_profile_t *p = lockprof_list(); p != NULL; p = p->next) {
+        s = sdscatprintf(s, "chirc_lock_contended_total{lock=\"%s\"} %lu\n", p->name, atomic_load(&p->contended));
+    }
+
+    s = add_family(s, "chirc_lock_wait_seconds", "counter", "seconds", "Time spent waiting for locks, by lock.");
+    for (lock_profile_t *p = lockprof_list(); p != NULL; p = p->next) {
+        s = sdscatprintf(s, "chirc_lock_wait_seconds_total{lock=\"%s\"} %.9f\n", p->name, atomic_load(&p->wait_ns) / 1e9);
+    }
+
+    s = add_family(s, "chirc_lock_hold_seconds", "counter", "seconds", "Time locks were held, by lock.");
+    for (lock_profile_t *p = lockprof_list(); p != NULL; p = p->next) {
+        s = sdscatprintf(s, "chirc_lock_hold_seconds_total{lock=\"%s\"} %.9f\n", p->name, atomic_load(&p->hold_ns) / 1e9);
+    }
+
+    s = add_family(s, "chirc_sds_live_bytes", "gauge", "bytes", "Bytes of sds strings in use, by subsystem.");
+    for (int tag = 0; tag < ALLOC_NTAGS; tag++) {
+        s = sdscatprintf(s, "chirc_sds_live_bytes{subsystem=\"%s\"} %ld\n", alloc_tag_name(tag), STATS_GET(alloc_live_bytes[tag]));
+    }
+
+    s = add_family(s, "chirc_sds_allocations", "counter", NULL, "sds allocations and reallocations, by subsystem.");
+    for (int tag = 0; tag < ALLOC_NTAGS; tag++) {
+        s = sdscatprintf(s, "chirc_sds_allocations_total{subsystem=\"%s\"} %lu\n", alloc_tag_name(tag), STATS_GET(alloc_count[tag]));
+    }
+
+    s = add_family(s, "chirc_sds_pool_hits", "counter", NULL, "sds allocations served from a size-class pool.");
+    s = sdscatprintf(s, "chirc_sds_pool_hits_total %lu\n", STATS_GET(alloc_pool_hits));
+
+    s = add_family(s, "chirc_log_dropped", "counter", NULL, "Log messages dropped because a log ring was full.");
+    s = sdscatprintf(s, "chirc_log_dropped_total %lu\n", STATS_GET(log_dropped));
+
+    s = sdscat(s, "# EOF\n");
+    return s;
+}
+
+int start_metrics_server(char *addr)
+{
+    int fd = open_listener(addr);
+    if (fd == -1) {
+        return FAILURE;
+    }
+
+    pthread_t thread;
+    int *args = malloc(sizeof(int));
+    if (args == NULL) {
+        chilog(CRITICAL, "start_metrics_server: fail to allocate memory");
+        exit(1);
+    }
+    *args = fd;
+    if (pthread_create(&thread, NULL, metrics_thread, args) != 0) {
+        chilog(ERROR, "start_metrics_server: could not create metrics thread");
+        close(fd);
+        free(args);
+        return FAILURE;
+    }
+    chilog(INFO, "metrics: serving OpenMetrics on %s", addr);
+    return SUCCESS;
+}
+
+static int open_listener(char *addr)
+{
+    int fd;
+    if (strchr(addr, '/') != NULL) {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(addr) >= sizeof(sun.sun_path)) {
+            chilog(ERROR, "metrics: unix socket path too long: %s", addr);
+            return -1;
+        }
+        strcpy(sun.sun_path, addr);
+        unlink(addr);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            chilog(ERROR, "metrics: could not open socket");
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1) {
+            chilog(ERROR, "metrics: bind to %s failed", addr);
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(atoi(addr));
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int yes = 1;
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+            chilog(ERROR, "metrics: could not open socket");
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+        if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) == -1) {
+            chilog(ERROR, "metrics: bind to port %s failed", addr);
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, METRICS_BACKLOG) == -1) {
+        chilog(ERROR, "metrics: listen failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *metrics_thread(void *args)
+{
+    int server_fd = *(int *) args;
+    free(args);
+    pthread_detach(pthread_self());
+
+    char request[METRICS_MAX_REQUEST];
+    struct timeval timeout = {1, 0};
+
+    while (true) {
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd == -1) {
+            int err = errno;
+            if (err == EINTR || err == ECONNABORTED)
+                continue;
+            chilog_ratelimited(WARNING, 10, "metrics: could not accept connection");
+            if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+                // the connection stays queued, accepting again right away
+                // would only fail again
+                poll(NULL, 0, METRICS_ACCEPT_BACKOFF_MS);
+            }
+            continue;
+        }
+        // a scraper that doesn't send or doesn't read can't hold us up
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // we serve the same document whatever is asked, just wait
+        // for the end of the request headers
+        int total = 0;
+        while (total < METRICS_MAX_REQUEST - 1) {
+            int n = recv(client_fd, request + total, METRICS_MAX_REQUEST - 1 - total, 0);
+            if (n <= 0) {
+                break;
+            }
+            total += n;
+            request[total] = '\0';
+            if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+                break;
+            }
+        }
+
+        sds body = metrics_render();
+        sds response = sdscatprintf(sdsempty(),
+                                    "HTTP/1.0 200 OK\r\n"
+                                    "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                    "Content-Length: %zu\r\n"
+                                    "Connection: close\r\n\r\n",
+                                    sdslen(body));
+        response = sdscatsds(response, body);
+
+        size_t sent = 0;
+        while (sent < sdslen(response)) {
+            ssize_t n = send(client_fd, response + sent, sdslen(response) - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+        sdsfree(body);
+        sdsfree(response);
+        close(client_fd);
+    }
+    return NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sds.h>
+
+/**
+ * @brief start the OpenMetrics listener in a background thread
+ * 
+ * @param addr: a port number, bound to the loopback interface only, or
+ *              the path of a unix socket if it contains a '/'
+ * @return int: SUCCESS, FAILURE
+ */
+int start_metrics_server(char *addr);
+
+/**
+ * @brief render the current stats snapshot in OpenMetrics text format
+ * 
+ * @return sds: caller need to free the return value
+ */
+sds metrics_render();
+
+#endif
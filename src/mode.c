@@ -0,0 +1,121 @@
+#include "mode.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "membership.h"
+
+/*
+ * The mode tables, indexed by letter. Channel and member modes share the
+ * channel's table since they are set by the same MODE command.
+ */
+
+static const struct mode_def channel_modes[128] = {
+    ['i'] = {'i', MODE_TARGET_CHANNEL, CHANNEL_MODE_INVITE_ONLY, MODE_PARAM_NONE},
+    ['k'] = {'k', MODE_TARGET_CHANNEL, CHANNEL_MODE_KEY, MODE_PARAM_ALWAYS},
+    ['l'] = {'l', MODE_TARGET_CHANNEL, CHANNEL_MODE_LIMIT, MODE_PARAM_WHEN_SET},
+    ['m'] = {'m', MODE_TARGET_CHANNEL, CHANNEL_MODE_MODERATED, MODE_PARAM_NONE},
+    ['n'] = {'n', MODE_TARGET_CHANNEL, CHANNEL_MODE_NO_EXTERNAL, MODE_PARAM_NONE},
+    ['o'] = {'o', MODE_TARGET_MEMBER, MEMBER_MODE_OPERATOR, MODE_PARAM_ALWAYS},
+    ['t'] = {'t', MODE_TARGET_CHANNEL, CHANNEL_MODE_TOPIC_LOCK, MODE_PARAM_NONE},
+    ['v'] = {'v', MODE_TARGET_MEMBER, MEMBER_MODE_VOICE, MODE_PARAM_ALWAYS},
+};
+
+static const struct mode_def user_modes[128] = {
+    ['a'] = {'a', MODE_TARGET_USER, USER_MODE_AWAY, MODE_PARAM_NONE},
+    ['o'] = {'o', MODE_TARGET_USER, USER_MODE_OPERATOR, MODE_PARAM_NONE},
+};
+
+static const struct mode_def *lookup(const struct mode_def *table, char letter)
+{
+    unsigned char c = letter;
+    return c < 128 && table[c].letter != '\0' ? &table[c] : NULL;
+}
+
+static int parse(const struct mode_def *table, const char *modes, char **params, int nparams,
+                 struct mode_change *changes)
+{
+    int n = 0;
+    int next_param = 0;
+    bool set = true;
+    for (const char *c = modes; *c != '\0' && n < MODE_MAX_CHANGES; c++) {
+        if (*c == '+' || *c == '-') {
+            set = *c == '+';
+            continue;
+        }
+
+        struct mode_change *change = &changes[n++];
+        change->letter = *c;
+        change->set = set;
+        change->def = lookup(table, *c);
+        change->param = NULL;
+        change->user = NULL;
+        change->status = MODE_PENDING;
+
+        const struct mode_def *def = change->def;
+        if (def == NULL) {
+            change->status = MODE_UNKNOWN;
+            continue;
+        }
+        if (def->param == MODE_PARAM_NONE || (def->param == MODE_PARAM_WHEN_SET && !set)) {
+            continue;
+        }
+        if (next_param == nparams) {
+            // "+o" alone is channel mode o, which doesn't exist
+            change->status = def->target == MODE_TARGET_MEMBER ? MODE_UNKNOWN : MODE_NEED_PARAM;
+            continue;
+        }
+        change->param = params[next_param++];
+
+        if (def->bit == CHANNEL_MODE_LIMIT && def->target == MODE_TARGET_CHANNEL) {
+            char *end;
+            long limit = strtol(change->param, &end, 10);
+            if (*end != '\0' || limit <= 0 || limit > INT_MAX) {
+                change->status = MODE_IGNORED;
+            }
+        }
+    }
+    return n;
+}
+
+int parse_channel_modes(const char *modes, char **params, int nparams, struct mode_change *changes)
+{
+    return parse(channel_modes, modes, params, nparams, changes);
+}
+
+int parse_user_modes(const char *modes, struct mode_change *changes)
+{
+    return parse(user_modes, modes, NULL, 0, changes);
+}
+
+sds cat_applied_modes(sds s, const struct mode_change *changes, int n)
+{
+    char sign = '\0';
+    for (int i = 0; i < n; i++) {
+        if (changes[i].status != MODE_APPLIED)
+            continue;
+        char c = changes[i].set ? '+' : '-';
+        if (c != sign) {
+            s = sdscatlen(s, &c, 1);
+            sign = c;
+        }
+        s = sdscatlen(s, &changes[i].letter, 1);
+    }
+    for (int i = 0; i < n; i++) {
+        if (changes[i].status == MODE_APPLIED && changes[i].param != NULL)
+            s = sdscatfmt(s, " %s", changes[i].param);
+    }
+    return s;
+}
+
+sds cat_mode_letters(sds s, enum mode_target target, uint8_t bits)
+{
+    const struct mode_def *table = target == MODE_TARGET_USER ? user_modes : channel_modes;
+    s = sdscatlen(s, "+", 1);
+    for (int c = 0; c < 128; c++) {
+        if (table[c].letter != '\0' && table[c].target == target && (bits & table[c].bit))
+            s = sdscatlen(s, &table[c].letter, 1);
+    }
+    return s;
+}
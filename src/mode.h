@@ -0,0 +1,117 @@
+#ifndef MODE_H
+#define MODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sds.h>
+#include "user.h"
+
+/*
+ * Modes are bits: a channel's modes in channel_t, a member's in its
+ * channel's member set (see membership.h) and a user's in user_t, so that
+ * a permission check is a single bit test. What a mode letter means, where
+ * its bit lives and whether it takes a parameter is looked up in a table
+ * (see mode.c), which is what parsing and printing mode strings go by.
+ */
+
+/* mode bits of a channel */
+#define CHANNEL_MODE_NO_EXTERNAL    0x01    // n
+#define CHANNEL_MODE_TOPIC_LOCK     0x02    // t
+#define CHANNEL_MODE_MODERATED      0x04    // m
+#define CHANNEL_MODE_INVITE_ONLY    0x08    // i
+#define CHANNEL_MODE_KEY            0x10    // k
+#define CHANNEL_MODE_LIMIT          0x20    // l
+
+/* mode bits of a user */
+#define USER_MODE_OPERATOR          0x01    // o
+#define USER_MODE_AWAY              0x02    // a
+
+/* what a mode applies to */
+enum mode_target {
+    MODE_TARGET_CHANNEL,
+    MODE_TARGET_MEMBER,
+    MODE_TARGET_USER
+};
+
+/* when a mode takes a parameter */
+enum mode_param {
+    MODE_PARAM_NONE,
+    MODE_PARAM_ALWAYS,
+    MODE_PARAM_WHEN_SET
+};
+
+struct mode_def {
+    char letter;
+    uint8_t target;         // enum mode_target
+    uint8_t bit;
+    uint8_t param;          // enum mode_param
+};
+
+/* what became of one change of a mode string */
+enum mode_status {
+    MODE_PENDING,
+    MODE_APPLIED,
+    MODE_UNKNOWN,           // no such mode: ERR_UNKNOWNMODE / ERR_UMODEUNKNOWNFLAG
+    MODE_NEED_PARAM,        // its parameter is missing: ERR_NEEDMOREPARAMS
+    MODE_NOT_ON_CHANNEL,    // the member isn't on the channel: ERR_USERNOTINCHANNEL
+    MODE_IGNORED            // dropped without a reply
+};
+
+/* changes a single MODE command can make, the rest are ignored */
+#define MODE_MAX_CHANGES 16
+
+struct mode_change {
+    char letter;
+    bool set;                       // '+' or '-'
+    const struct mode_def *def;     // NULL if the mode is unknown
+    char *param;                    // NULL if it takes none
+    user_handle user;               // the member, for a member mode
+    uint8_t status;                 // enum mode_status
+};
+
+/**
+ * @brief parse a channel mode string, e.g. "+ov-o a b c", with its
+ * parameters, in one pass
+ *
+ * A member mode without a nick is read as a channel mode, which o and v
+ * aren't: it is unknown. An invalid limit is ignored.
+ *
+ * @param modes: the mode string
+ * @param params: the parameters after it
+ * @param nparams
+ * @param changes: at least MODE_MAX_CHANGES
+ * @return int: the number of changes
+ */
+int parse_channel_modes(const char *modes, char **params, int nparams, struct mode_change *changes);
+
+/**
+ * @brief parse a user mode string, e.g. "-o", which takes no parameters
+ *
+ * @param modes
+ * @param changes: at least MODE_MAX_CHANGES
+ * @return int: the number of changes
+ */
+int parse_user_modes(const char *modes, struct mode_change *changes);
+
+/**
+ * @brief append the changes that were applied as one mode string with
+ * their parameters, e.g. "+ov-o a b c"
+ *
+ * @param s
+ * @param changes
+ * @param n
+ * @return sds: s, empty if nothing was applied
+ */
+sds cat_applied_modes(sds s, const struct mode_change *changes, int n);
+
+/**
+ * @brief append the letters of some channel or user mode bits, e.g. "+mt"
+ *
+ * @param s
+ * @param target: MODE_TARGET_CHANNEL or MODE_TARGET_USER
+ * @param bits
+ * @return sds: s
+ */
+sds cat_mode_letters(sds s, enum mode_target target, uint8_t bits);
+
+#endif
@@ -0,0 +1,172 @@
+#include "namescache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "alloc.h"
+
+void names_cache_init(names_cache_t *cache)
+{
+    cache->valid = false;
+    cache->budget = 0;
+    cache->count = 0;
+    cache->capacity = 0;
+    cache->bytes = 0;
+    cache->lines = NULL;
+}
+
+void names_cache_destroy(names_cache_t *cache)
+{
+    names_cache_invalidate(cache);
+    chirc_free(cache->lines);
+    names_cache_init(cache);
+}
+
+void names_cache_invalidate(names_cache_t *cache)
+{
+    for (int i = 0; i < cache->count; i++) {
+        sdsfree(cache->lines[i]);
+    }
+    cache->count = 0;
+    cache->bytes = 0;
+    cache->valid = false;
+}
+
+void names_cache_reset(names_cache_t *cache, size_t budget)
+{
+    names_cache_invalidate(cache);
+    cache->budget = budget;
+    cache->valid = true;
+}
+
+/**
+ * @brief find an entry in one line
+ *
+ * @param cache
+ * @param i: the line
+ * @param entry
+ * @param len
+ * @param offset: to store where it starts in the line
+ * @return bool: whether the line has it
+ */
+static bool find_entry(const names_cache_t *cache, int i, const char *entry, size_t len, size_t *offset)
+{
+    if (i < 0 || i >= cache->count) {
+        return false;
+    }
+    const char *line = cache->lines[i];
+    size_t line_len = sdslen(cache->lines[i]);
+    // entries are separated by single spaces
+    for (size_t p = 0; p + len <= line_len; ) {
+        const char *end = memchr(line + p, ' ', line_len - p);
+        size_t entry_end = end == NULL ? line_len : (size_t) (end - line);
+        if (entry_end - p == len && memcmp(line + p, entry, len) == 0) {
+            *offset = p;
+            return true;
+        }
+        p = entry_end + 1;
+    }
+    return false;
+}
+
+int names_cache_add(names_cache_t *cache, const char *entry, size_t len)
+{
+    if (!cache->valid) {
+        return -1;
+    }
+
+    alloc_tag_t prev = alloc_set_tag(ALLOC_CHANNEL);
+    size_t last_len = cache->count > 0 ? sdslen(cache->lines[cache->count - 1]) : 0;
+    if (cache->count > 0 && last_len == 0) {
+        // emptied by removals
+        cache->lines[cache->count - 1] = sdscatlen(cache->lines[cache->count - 1], entry, len);
+        cache->bytes += len;
+    } else if (cache->count > 0 && last_len + 1 + len <= cache->budget) {
+        sds *last = &cache->lines[cache->count - 1];
+        *last = sdscatlen(*last, " ", 1);
+        *last = sdscatlen(*last, entry, len);
+        cache->bytes += 1 + len;
+    } else {
+        if (cache->count == cache->capacity) {
+            int capacity = cache->capacity == 0 ? 4 : 2 * cache->capacity;
+            sds *lines = chirc_realloc(cache->lines, capacity * sizeof(sds));
+            if (lines == NULL) {
+                chilog(CRITICAL, "names_cache: fail to allocate memory");
+                exit(1);
+            }
+            cache->lines = lines;
+            cache->capacity = capacity;
+        }
+        cache->lines[cache->count++] = sdsnewlen(entry, len);
+        cache->bytes += len;
+    }
+    alloc_set_tag(prev);
+    return cache->count - 1;
+}
+
+void names_cache_remove(names_cache_t *cache, int i, const char *entry, size_t len)
+{
+    if (!cache->valid) {
+        return;
+    }
+
+    size_t p;
+    if (!find_entry(cache, i, entry, len, &p)) {
+        names_cache_invalidate(cache);
+        return;
+    }
+
+    sds line = cache->lines[i];
+    size_t line_len = sdslen(line);
+    if (len == line_len) {
+        // kept, so that the lines after it don't move
+        sdsclear(line);
+        cache->bytes -= len;
+    } else {
+        // take a separating space with it, the one after unless it's last
+        size_t start = p + len < line_len ? p : p - 1;
+        size_t removed = len + 1;
+        memmove(line + start, line + start + removed, line_len - start - removed + 1);
+        sdssetlen(line, line_len - removed);
+        cache->bytes -= removed;
+    }
+
+    // lines emptied by many removals: render it again rather than send
+    // twice as many lines as needed
+    if (cache->count > 1 && (size_t) cache->count * cache->budget > 2 * cache->bytes + 2 * cache->budget) {
+        names_cache_invalidate(cache);
+    }
+}
+
+int names_cache_replace(names_cache_t *cache, int i, const char *old, size_t old_len,
+                        const char *entry, size_t len)
+{
+    if (!cache->valid) {
+        return -1;
+    }
+
+    size_t p;
+    if (!find_entry(cache, i, old, old_len, &p)) {
+        names_cache_invalidate(cache);
+        return -1;
+    }
+
+    sds line = cache->lines[i];
+    size_t line_len = sdslen(line);
+    if (line_len - old_len + len > cache->budget) {
+        // doesn't fit where it was
+        names_cache_remove(cache, i, old, old_len);
+        return names_cache_add(cache, entry, len);
+    }
+
+    alloc_tag_t prev = alloc_set_tag(ALLOC_CHANNEL);
+    sds patched = sdsnewlen(line, p);
+    patched = sdscatlen(patched, entry, len);
+    patched = sdscatlen(patched, line + p + old_len, line_len - p - old_len);
+    alloc_set_tag(prev);
+    sdsfree(line);
+    cache->lines[i] = patched;
+    cache->bytes = cache->bytes - old_len + len;
+    return i;
+}
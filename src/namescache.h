@@ -0,0 +1,102 @@
+#ifndef NAMESCACHE_H
+#define NAMESCACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sds.h>
+
+/*
+ * A channel's NAMES, rendered: the members' prefixed nicks ("@op +voiced
+ * user") already split into lines short enough to be the last parameter
+ * of an RPL_NAMREPLY.
+ *
+ * Rather than being rendered again for every JOIN or NAMES, the cache is
+ * patched as the membership changes: a new member is appended to the last
+ * line, and a member leaving, or whose nick or prefix changes, is edited
+ * in the line it is in. The owner keeps the line of each entry (adding
+ * returns it), so a patch only looks at that one line; lines aren't
+ * removed or moved, a line whose entries all left stays, empty. When a
+ * patch can't be made (the cache is being rebuilt, or lost track of a
+ * member) the cache is invalidated instead, and its owner renders it
+ * from scratch the next time it is needed.
+ *
+ * The cache doesn't lock, the channel's member table lock protects it.
+ */
+
+typedef struct names_cache {
+    bool valid;
+    size_t budget;          // longest line
+    int count;              // lines, including empty ones
+    int capacity;
+    size_t bytes;           // of all the lines
+    sds *lines;
+} names_cache_t;
+
+/**
+ * @brief initialize an empty, invalid cache
+ *
+ * @param cache
+ */
+void names_cache_init(names_cache_t *cache);
+
+/**
+ * @brief free the lines of a cache
+ *
+ * @param cache
+ */
+void names_cache_destroy(names_cache_t *cache);
+
+/**
+ * @brief drop the lines, the cache has to be rebuilt before it is used
+ *
+ * @param cache
+ */
+void names_cache_invalidate(names_cache_t *cache);
+
+/**
+ * @brief empty the cache and make it valid, to rebuild it with
+ * names_cache_add()
+ *
+ * @param cache
+ * @param budget: longest line
+ */
+void names_cache_reset(names_cache_t *cache, size_t budget);
+
+/**
+ * @brief append an entry (a prefixed nick); nothing happens to an
+ * invalid cache
+ *
+ * @param cache
+ * @param entry
+ * @param len
+ * @return int: the line it is in, -1 if the cache is invalid
+ */
+int names_cache_add(names_cache_t *cache, const char *entry, size_t len);
+
+/**
+ * @brief remove an entry; a cache that doesn't have it in that line is
+ * invalidated
+ *
+ * @param cache
+ * @param line: where names_cache_add() put it
+ * @param entry
+ * @param len
+ */
+void names_cache_remove(names_cache_t *cache, int line, const char *entry, size_t len);
+
+/**
+ * @brief replace an entry, e.g. after a nick or prefix change; a cache
+ * that doesn't have it in that line is invalidated
+ *
+ * @param cache
+ * @param line: where the old entry is
+ * @param old
+ * @param old_len
+ * @param entry
+ * @param len
+ * @return int: the line the entry is in now, -1 if the cache is invalid
+ */
+int names_cache_replace(names_cache_t *cache, int line, const char *old, size_t old_len,
+                        const char *entry, size_t len);
+
+#endif
@@ -0,0 +1,253 @@
+#include "nametable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "log.h"
+
+#define GROUP_WIDTH 16
+
+// control bytes: full slots hold 7 bits of their hash, 0 to 127
+#define CTRL_EMPTY ((int8_t) -128)
+#define CTRL_DELETED ((int8_t) -2)
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((int8_t) ((hash) & 0x7f))
+
+static inline uint64_t mix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    return k;
+}
+
+uint64_t name_hash(const char *key, size_t len)
+{
+    // eight bytes at a time, names are short
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    const unsigned char *p = (const unsigned char *) key;
+    while (len >= 8) {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        h = (h ^ mix(k)) * 0xc2b2ae3d27d4eb4fULL;
+        p += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t k = 0;
+        memcpy(&k, p, len);
+        h = (h ^ mix(k)) * 0xc2b2ae3d27d4eb4fULL;
+    }
+    return mix(h);
+}
+
+/*
+ * The slots of a group matching some condition, one bit per slot.
+ */
+
+#ifdef __SSE2__
+
+static inline unsigned match_byte(const int8_t *group, int8_t byte)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+}
+
+static inline unsigned match_empty_or_deleted(const int8_t *group)
+{
+    // the only control bytes with the high bit set
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+}
+
+#else
+
+static inline unsigned match_byte(const int8_t *group, int8_t byte)
+{
+    unsigned mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (unsigned) (group[i] == byte) << i;
+    }
+    return mask;
+}
+
+static inline unsigned match_empty_or_deleted(const int8_t *group)
+{
+    unsigned mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (unsigned) (group[i] < 0) << i;
+    }
+    return mask;
+}
+
+#endif
+
+static inline bool key_equals(const char *stored, const char *key, size_t len)
+{
+    return strncmp(stored, key, len) == 0 && stored[len] == '\0';
+}
+
+/*
+ * Groups are probed quadratically (1, 2, 3... groups further each time),
+ * which visits every group of a power-of-two table; a lookup stops at the
+ * first group with an empty slot, nothing was ever inserted past it.
+ */
+
+static size_t find_slot(const name_table_t *table, const char *key, size_t len, uint64_t hash)
+{
+    size_t mask = table->capacity / GROUP_WIDTH - 1;
+    size_t group = H1(hash) & mask;
+    for (size_t step = 1; step <= mask + 1; step++) {
+        const int8_t *ctrl = table->ctrl + group * GROUP_WIDTH;
+        for (unsigned match = match_byte(ctrl, H2(hash)); match != 0; match &= match - 1) {
+            size_t slot = group * GROUP_WIDTH + __builtin_ctz(match);
+            if (key_equals(table->slots[slot].key, key, len)) {
+                return slot;
+            }
+        }
+        if (match_byte(ctrl, CTRL_EMPTY) != 0) {
+            break;
+        }
+        group = (group + step) & mask;
+    }
+    return SIZE_MAX;
+}
+
+/**
+ * @brief the first empty or deleted slot on a hash's probe sequence
+ */
+static size_t find_free_slot(const name_table_t *table, uint64_t hash)
+{
+    size_t mask = table->capacity / GROUP_WIDTH - 1;
+    size_t group = H1(hash) & mask;
+    for (size_t step = 1; ; step++) {
+        unsigned match = match_empty_or_deleted(table->ctrl + group * GROUP_WIDTH);
+        if (match != 0) {
+            return group * GROUP_WIDTH + __builtin_ctz(match);
+        }
+        group = (group + step) & mask;
+    }
+}
+
+static size_t max_load(size_t capacity)
+{
+    // 7/8
+    return capacity - capacity / 8;
+}
+
+static void allocate(name_table_t *table, size_t capacity)
+{
+    // one block: the slots, then the control bytes
+    char *block = malloc(capacity * (sizeof(struct name_table_slot) + 1));
+    if (block == NULL) {
+        chilog(CRITICAL, "name_table: fail to allocate memory");
+        exit(1);
+    }
+    table->slots = (struct name_table_slot *) block;
+    table->ctrl = (int8_t *) (table->slots + capacity);
+    memset(table->ctrl, CTRL_EMPTY, capacity);
+    table->capacity = capacity;
+    table->growth_left = max_load(capacity);
+}
+
+/**
+ * @brief move the entries to a table of another capacity, which also
+ * clears the deleted slots
+ */
+static void rehash(name_table_t *table, size_t capacity)
+{
+    name_table_t old = *table;
+    allocate(table, capacity);
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.ctrl[i] < 0) {
+            continue;
+        }
+        const char *key = old.slots[i].key;
+        uint64_t hash = name_hash(key, strlen(key));
+        size_t slot = find_free_slot(table, hash);
+        table->ctrl[slot] = H2(hash);
+        table->slots[slot] = old.slots[i];
+    }
+    table->growth_left -= table->count;
+    free(old.slots);
+}
+
+void name_table_init(name_table_t *table)
+{
+    table->capacity = 0;
+    table->count = 0;
+    table->growth_left = 0;
+    table->ctrl = NULL;
+    table->slots = NULL;
+}
+
+void name_table_destroy(name_table_t *table)
+{
+    free(table->slots);
+    name_table_init(table);
+}
+
+void *name_table_find(const name_table_t *table, const char *key, size_t len)
+{
+    if (table->count == 0) {
+        return NULL;
+    }
+    size_t slot = find_slot(table, key, len, name_hash(key, len));
+    return slot == SIZE_MAX ? NULL : table->slots[slot].value;
+}
+
+int name_table_insert(name_table_t *table, const char *key, size_t len, void *value)
+{
+    uint64_t hash = name_hash(key, len);
+    if (table->count > 0 && find_slot(table, key, len, hash) != SIZE_MAX) {
+        return 1;
+    }
+
+    if (table->capacity == 0) {
+        allocate(table, GROUP_WIDTH);
+    }
+    size_t slot = find_free_slot(table, hash);
+    if (table->ctrl[slot] == CTRL_EMPTY && table->growth_left == 0) {
+        // full of entries, or of deleted slots that a rehash gets back
+        size_t capacity = table->count >= max_load(table->capacity) / 2 ?
+                          2 * table->capacity : table->capacity;
+        rehash(table, capacity);
+        slot = find_free_slot(table, hash);
+    }
+
+    if (table->ctrl[slot] == CTRL_EMPTY) {
+        table->growth_left--;
+    }
+    table->ctrl[slot] = H2(hash);
+    table->slots[slot].key = key;
+    table->slots[slot].value = value;
+    table->count++;
+    return 0;
+}
+
+void *name_table_remove(name_table_t *table, const char *key, size_t len)
+{
+    if (table->count == 0) {
+        return NULL;
+    }
+    size_t slot = find_slot(table, key, len, name_hash(key, len));
+    if (slot == SIZE_MAX) {
+        return NULL;
+    }
+
+    void *value = table->slots[slot].value;
+    table->count--;
+    const int8_t *group = table->ctrl + slot / GROUP_WIDTH * GROUP_WIDTH;
+    if (match_byte(group, CTRL_EMPTY) != 0) {
+        // lookups stop at this group anyway, the slot can be reused as empty
+        table->ctrl[slot] = CTRL_EMPTY;
+        table->growth_left++;
+    } else {
+        table->ctrl[slot] = CTRL_DELETED;
+    }
+    return value;
+}
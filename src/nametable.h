@@ -0,0 +1,116 @@
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * An open-addressing hash table of named objects (users by nick,
+ * channels by name), after Google's Swiss tables.
+ *
+ * The table is two parallel arrays: one control byte per slot, and the
+ * slots themselves (a key and its value, which share a cache line). A
+ * control byte says whether its slot is empty, deleted, or full, and for
+ * a full slot holds 7 bits of the key's hash. Slots are probed 16 at a
+ * time: a lookup compares the control bytes of a whole group against
+ * those 7 bits at once (with SSE2 where available), and only looks at
+ * the keys that match, which is almost always just the one it is after.
+ *
+ * The table doesn't own its keys: a key is the name stored in its value
+ * (e.g. the user's nick) and must not change while it is in the table;
+ * to rename an object, remove it and insert it again.
+ *
+ * The table doesn't lock, see the context's table locks. Entries can be
+ * removed while walking the table:
+ *
+ *     for (size_t i = 0; i < table->capacity; i++) {
+ *         channel_handle channel = name_table_at(table, i);
+ *         if (channel == NULL)
+ *             continue;
+ *         ...
+ *     }
+ */
+
+struct name_table_slot {
+    const char *key;
+    void *value;
+};
+
+typedef struct name_table {
+    size_t capacity;        // number of slots, 0 or a power of two >= 16
+    size_t count;           // full slots
+    size_t growth_left;     // empty slots that can still be filled before growing
+    int8_t *ctrl;
+    struct name_table_slot *slots;
+} name_table_t;
+
+/**
+ * @brief hash a name, the table's hash function
+ *
+ * @param key
+ * @param len
+ * @return uint64_t
+ */
+uint64_t name_hash(const char *key, size_t len);
+
+/**
+ * @brief initialize an empty table, nothing is allocated until the first
+ * insert
+ *
+ * @param table
+ */
+void name_table_init(name_table_t *table);
+
+/**
+ * @brief free a table, but not its values
+ *
+ * @param table
+ */
+void name_table_destroy(name_table_t *table);
+
+/**
+ * @brief find the value stored under a name
+ *
+ * @param table
+ * @param key
+ * @param len: length of key
+ * @return void*: NULL if there is none
+ */
+void *name_table_find(const name_table_t *table, const char *key, size_t len);
+
+/**
+ * @brief store a value under a name
+ *
+ * @param table
+ * @param key: must stay valid and unchanged while the value is stored
+ * @param len: length of key
+ * @param value: not NULL
+ * @return int 0: inserted 1: the name is taken, nothing was changed
+ */
+int name_table_insert(name_table_t *table, const char *key, size_t len, void *value);
+
+/**
+ * @brief remove the value stored under a name
+ *
+ * @param table
+ * @param key
+ * @param len: length of key
+ * @return void*: the value removed, NULL if there was none
+ */
+void *name_table_remove(name_table_t *table, const char *key, size_t len);
+
+/**
+ * @brief the value in a slot, to walk the table
+ *
+ * @param table
+ * @param slot: below table->capacity
+ * @return void*: NULL if the slot is empty
+ */
+static inline void *name_table_at(const name_table_t *table, size_t slot)
+{
+    // full slots have the high bit of their control byte clear
+    return table->ctrl[slot] >= 0 ? table->slots[slot].value : NULL;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT (user-level statically defined tracing) probes of provider "chirc".
+ *
+ * They are only compiled in when configured with -DCHIRC_ENABLE_USDT=ON,
+ * which needs sys/sdt.h (systemtap-sdt-dev). An inactive probe costs a
+ * single nop, so they can stay enabled in production builds and be
+ * attached to with bpftrace or perf when needed, e.g.
+ *
+ *     bpftrace -e 'usdt:./chirc:chirc:command_entry { @[str(arg1)] = count(); }'
+ *
+ * See tools/bpftrace/ for more complete examples.
+ *
+ * Probes and their arguments:
+ *
+ * accept(int fd)
+ * line_received(int fd, char *line, int len)
+ * command_entry(int fd, char *cmd)
+ * command_exit(int fd, char *cmd, int rv)
+ * reply_queued(int fd, int len)
+ * fanout_start(char *channel, int members)
+ * fanout_end(char *channel, int delivered)
+ * lock_acquire(char *lock)      about to wait for a global table lock
+ * lock_acquired(char *lock)     got it
+ * lock_release(char *lock)
+ */
+
+#ifdef CHIRC_USDT
+
+#include <sys/sdt.h>
+
+#define CHIRC_PROBE1(name, a1) DTRACE_PROBE1(chirc, name, a1)
+#define CHIRC_PROBE2(name, a1, a2) DTRACE_PROBE2(chirc, name, a1, a2)
+#define CHIRC_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(chirc, name, a1, a2, a3)
+
+#else
+
+// the arguments are still evaluated, so that a value only a probe reads
+// isn't reported unused
+#define CHIRC_PROBE1(name, a1) do { (void) (a1); } while (0)
+#define CHIRC_PROBE2(name, a1, a2) do { (void) (a1); (void) (a2); } while (0)
+#define CHIRC_PROBE3(name, a1, a2, a3) do { (void) (a1); (void) (a2); (void) (a3); } while (0)
+
+#endif
+
+#endif
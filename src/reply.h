@@ -51,7 +51,13 @@
 #define RPL_LUSERCHANNELS       "254"
 #define RPL_LUSERME             "255"
 
+#define RPL_ENDOFSTATS          "219"
+#define RPL_UMODEIS             "221"
+#define RPL_STATSDEBUG          "249"
+
 #define RPL_AWAY                "301"
+#define RPL_USERHOST            "302"
+#define RPL_ISON                "303"
 #define RPL_UNAWAY              "305"
 #define RPL_NOWAWAY             "306"
 
@@ -62,8 +68,12 @@
 #define RPL_ENDOFWHOIS          "318"
 #define RPL_WHOISCHANNELS       "319"
 
+#define RPL_WHOWASUSER          "314"
+#define RPL_ENDOFWHOWAS         "369"
+
 #define RPL_WHOREPLY            "352"
 #define RPL_ENDOFWHO            "315"
+#define RPL_WHOSPCRPL           "354"
 
 #define RPL_LIST                "322"
 #define RPL_LISTEND             "323"
@@ -86,6 +96,7 @@
 #define ERR_NOSUCHSERVER        "402"
 #define ERR_NOSUCHCHANNEL       "403"
 #define ERR_CANNOTSENDTOCHAN    "404"
+#define ERR_WASNOSUCHNICK       "406"
 #define ERR_NORECIPIENT         "411"
 #define ERR_NOTEXTTOSEND        "412"
 #define ERR_UNKNOWNCOMMAND      "421"
@@ -98,11 +109,20 @@
 #define ERR_NEEDMOREPARAMS      "461"
 #define ERR_ALREADYREGISTRED    "462"
 #define ERR_PASSWDMISMATCH      "464"
+#define ERR_CHANNELISFULL       "471"
 #define ERR_UNKNOWNMODE         "472"
+#define ERR_INVITEONLYCHAN      "473"
+#define ERR_BADCHANNELKEY       "475"
 #define ERR_NOPRIVILEGES        "481"
 #define ERR_CHANOPRIVSNEEDED    "482"
 #define ERR_UMODEUNKNOWNFLAG    "501"
 #define ERR_USERSDONTMATCH      "502"
 
+#define RPL_MONONLINE           "730"
+#define RPL_MONOFFLINE          "731"
+#define RPL_MONLIST             "732"
+#define RPL_ENDOFMONLIST        "733"
+#define ERR_MONLISTFULL         "734"
+
 
 #endif /* REPLY_H_ */
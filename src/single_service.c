@@ -4,68 +4,117 @@
 #include <pthread.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "log.h"
 #include "message.h"
 #include "command.h"
+#include "stats.h"
+#include "probes.h"
+#include "epoch.h"
+#include "handler.h"
+#include "arena.h"
 
 #define MAX_BUFFER_SIZE 512
+// how long a connection waits before giving back its arena and log ring
+#define IDLE_RELEASE_MS 1000
 
-void free_data(worker_args *args);
+void free_data(user_handle user_info);
 
 /* see single_service.h */
 void *service_single_client(void *args)
 {
-    // extract arguments
-    struct worker_args *wa = (struct worker_args *)args;
-    context_handle ctx = wa->ctx;
-    user_handle user_info = wa->user_info;
+    user_handle user_info = args;
+    context_handle ctx = user_info->ctx;
 
     pthread_detach(pthread_self());
+    epoch_register();
 
     char recv_msg[MAX_BUFFER_SIZE];
     char buffer[MAX_BUFFER_SIZE];
     int ptr = 0;
     bool flag = false;
+    // the arena and log ring were given back, no need to wake up for them
+    bool idle = false;
+
+    // only this thread writes to the client, other threads post to its mailbox
+    own_connection(user_info);
+    struct pollfd fds[2] = {
+        { .fd = user_info->client_fd, .events = POLLIN },
+        { .fd = user_info->mailbox.wakeup_fd, .events = POLLIN },
+    };
 
     while (true) {
+        // don't hold up reclamation while waiting for the client
+        epoch_offline();
+        int ready = poll(fds, 2, idle ? -1 : IDLE_RELEASE_MS);
+        epoch_online();
+
+        if (ready == 0) {
+            // a busy connection keeps them from one read to the next,
+            // an idle one doesn't keep them at all
+            chilog_release();
+            arena_release();
+            idle = true;
+            continue;
+        }
+        idle = false;
+
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            chilog(ERROR, "poll for %s fail", user_info->client_host_name);
+            free_data(user_info);
+            pthread_exit(NULL);
+        }
+
+        if (fds[1].revents & POLLIN) {
+            mailbox_ack(&user_info->mailbox);
+        }
+
+        if (fds[0].revents == 0) {
+            // only woken up to deliver what other threads posted
+            if (flush_replies(user_info) == -1) {
+                free_data(user_info);
+                pthread_exit(NULL);
+            }
+            continue;
+        }
+
         int len = recv(user_info->client_fd, recv_msg, MAX_BUFFER_SIZE, 0);
 
         if (len == 0) {
             chilog(INFO, "client %s disconnected", user_info->client_host_name);
-            close(user_info->client_fd);
-            free_data(wa);
+            free_data(user_info);
             pthread_exit(NULL);
         }
 
         if (len == -1) {
             chilog(ERROR, "recv from %s fail", user_info->client_host_name);
-            close(user_info->client_fd);
-            free_data(wa);
+            free_data(user_info);
             pthread_exit(NULL);
         }
 
-        chilog(DEBUG, "recv_msg: %s", recv_msg);
+        STATS_ADD(bytes_in, len);
+        chilog(DEBUG, "recv_msg: %.*s", len, recv_msg);
 
         for (int i = 0; i < len; i++) {
             char c = recv_msg[i];
             if (c == '\n' && flag) {
-                sds command = sdscpylen(sdsempty(), buffer, ptr - 1);
-                message_handle msg = calloc(1, sizeof(message_t));
-                if (msg == NULL) {
-                    chilog(CRITICAL, "single_service: fail to allocate new memory");
-                    exit(1);
-                }
-                message_from_string(msg, command);
-                if (process_cmd(ctx, user_info, msg) == -1) {
+                CHIRC_PROBE3(line_received, user_info->client_fd, buffer, ptr - 1);
+                // the message only lives until the arena is reset below
+                message_handle msg = arena_alloc(sizeof(message_t));
+                // an empty line is ignored
+                if (message_from_string(msg, buffer, ptr - 1) == 0 && process_cmd(ctx, user_info, msg) == -1) {
                     // if there's an error during processing this command , then kill this thread
                     // if receive "QUIT", also kill th thread
-                    close(user_info->client_fd);
-                    free_data(wa);
+                    free_data(user_info);
                     pthread_exit(NULL);
                 }
-                // free message
-                message_destroy(msg);
+                arena_reset();
+                // nothing looked up for this command is used after it
+                epoch_quiescent();
                 // after processing a command, continue to analyze the next command
                 flag = false;
                 ptr = 0;
@@ -74,13 +123,41 @@ void *service_single_client(void *args)
             buffer[ptr++] = c;
             flag = c == '\r';
         }
+
+        // replies to everything in this read go out together
+        if (flush_replies(user_info) == -1) {
+            free_data(user_info);
+            pthread_exit(NULL);
+        }
     }
 }
 
-void free_data(worker_args *args)
+static void free_retired_user(void *user)
+{
+    // the descriptor is only closed now, so that its number can't be reused
+    // by a new connection while another thread may still send to this user
+    close(((user_handle) user)->client_fd);
+    destroy_user(user);
+}
+
+void free_data(user_handle user_info)
 {
-    delete_connection(args->ctx, args->user_info->client_fd);
-    delete_user(args->ctx, args->user_info);
-    destroy_user(args->user_info);
-    free(args);
-}
\ No newline at end of file
+    context_handle ctx = user_info->ctx;
+
+    // e.g. the reply to QUIT
+    flush_replies(user_info);
+    shutdown(user_info->client_fd, SHUT_RDWR);
+    delete_connection(ctx, user_info->client_fd);
+    if (user_info->nick != NULL) {
+        part_all_channels(ctx, user_info);
+    }
+    delete_user(ctx, user_info);
+    clear_monitors(ctx, user_info);
+    if (user_info->registered) {
+        record_whowas(ctx, user_info, user_info->nick);
+        notify_monitors(ctx, user_info, user_info->nick, false);
+    }
+    epoch_retire(user_info, free_retired_user);
+    arena_release();
+    epoch_unregister();
+}
@@ -1,23 +1,19 @@
 #include "context.h"
 #include "user.h"
 
-
-struct worker_args {
-
-    context_handle ctx;
-
-    user_handle user_info;
-
-};
-
-typedef struct worker_args worker_args;
+/**
+ * @brief stack of a worker thread: the deepest path (a command handled
+ * in place, with its replies and log lines) needs a small fraction of
+ * this, the default of 8 MiB would only be reserved address space
+ */
+#define WORKER_STACK_SIZE (256 * 1024)
 
 /**
  * @brief This is the function that is run by the "worker thread".
    It is in charge of "handling" an individual connection, also parsing the message received 
    from the client side
  * 
- * @param args arguments passed from the process(start_server() function) to this particular thread
+ * @param args the user of the connection, see create_user()
  * @return void* 
  */
 void * service_single_client(void *args);
@@ -0,0 +1,13 @@
+#include "stats.h"
+
+stats_t chirc_stats;
+
+void stats_connection_state(int old_state, int new_state)
+{
+    if (old_state >= 0 && old_state < 3) {
+        STATS_SUB(connections[old_state], 1);
+    }
+    if (new_state >= 0 && new_state < 3) {
+        STATS_ADD(connections[new_state], 1);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "alloc.h"
+
+/**
+ * @brief server-wide counters and gauges
+ *
+ * Every field is updated with relaxed atomics by the code that owns the
+ * corresponding state, so a reader (e.g. the metrics endpoint) can take a
+ * snapshot without touching any of the context mutexes.
+ *
+ */
+struct stats_t {
+    // gauges
+    atomic_long connections[3];     // indexed by UNKNOWN/USER/REGISTERED_CONNECTION
+    atomic_long users;
+    atomic_long channels;
+    atomic_long operators;
+    atomic_long sendq_bytes;
+    atomic_long user_bytes;         // user objects, which include their connection
+    atomic_long log_ring_bytes;     // per-thread log rings, see log.c
+    atomic_long retired_pending;    // objects waiting for their grace period, see epoch.h
+    atomic_long alloc_live_bytes[ALLOC_NTAGS];  // by subsystem, see alloc.h
+
+    // counters
+    atomic_ulong accepts;
+    atomic_ulong bytes_in;
+    atomic_ulong bytes_out;
+    atomic_ulong log_dropped;
+    atomic_ulong alloc_count[ALLOC_NTAGS];
+    atomic_ulong alloc_pool_hits;
+};
+
+typedef struct stats_t stats_t;
+
+extern stats_t chirc_stats;
+
+#define STATS_ADD(field, n) \
+    atomic_fetch_add_explicit(&chirc_stats.field, (n), memory_order_relaxed)
+
+#define STATS_SUB(field, n) \
+    atomic_fetch_sub_explicit(&chirc_stats.field, (n), memory_order_relaxed)
+
+#define STATS_GET(field) \
+    atomic_load_explicit(&chirc_stats.field, memory_order_relaxed)
+
+/**
+ * @brief monotonic clock in nanoseconds
+ *
+ * @return uint64_t
+ */
+static inline uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief move a connection from one state gauge to another
+ *
+ * @param old_state: UNKNOWN/USER/REGISTERED_CONNECTION, -1 for a new connection
+ * @param new_state: UNKNOWN/USER/REGISTERED_CONNECTION, -1 for a closed connection
+ */
+void stats_connection_state(int old_state, int new_state);
+
+#endif
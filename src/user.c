@@ -7,19 +7,36 @@
 #include <stdbool.h>
 #include "reply.h"
 #include "log.h"
+#include "stats.h"
+#include "alloc.h"
 
-user_handle create_user()
+user_handle create_user(struct context_t *ctx, int client_fd, const char *client_host_name)
 {
-    user_handle user = calloc(1, sizeof(user_t));
+    size_t host_len = strlen(client_host_name);
+    user_handle user = calloc(1, sizeof(user_t) + host_len + 1);
     if (user == NULL) {
         chilog(ERROR, "fail to create user: no enough memory");
         return NULL;
     }
+    user->client_fd = client_fd;
+    memcpy(user->host_buf, client_host_name, host_len + 1);
+    user->client_host_name = user->host_buf;
+    user->ctx = ctx;
+    init_connection(&user->connection, client_fd);
     user->nick = NULL;
     user->username = NULL;
-    user->username = NULL;
+    user->fullname = NULL;
     user->registered = false;
-    user->is_irc_operator = false;
+    user->modes = 0;
+    user->monitors = NULL;
+    user->nmonitors = 0;
+    // allocated with the first reply
+    user->outbuf = NULL;
+    if (mailbox_init(&user->mailbox) == -1) {
+        free(user);
+        return NULL;
+    }
+    STATS_ADD(user_bytes, sizeof(user_t) + host_len + 1);
     return user;
 }
 
@@ -29,7 +46,12 @@ void destroy_user(user_handle user)
         sdsfree(user->nick);
         sdsfree(user->username);
         sdsfree(user->fullname);
-        free(user->client_host_name);
+        // the user's own thread cleared its monitors before retiring it
+        chirc_free(user->monitors);
+        STATS_SUB(sendq_bytes, (user->outbuf ? sdslen(user->outbuf) : 0) + atomic_load(&user->mailbox.queued_bytes));
+        sdsfree(user->outbuf);
+        mailbox_destroy(&user->mailbox);
+        STATS_SUB(user_bytes, sizeof(user_t) + strlen(user->host_buf) + 1);
     }
     free(user);
 }
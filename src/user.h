@@ -2,37 +2,71 @@
 #define USER_H
 
 #include <stdbool.h>
-#include <uthash.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sds.h>
+#include "mailbox.h"
+#include "connection.h"
+
+struct context_t;
 
 /**
  * @brief Store the relevant information about user,
    also contains the socket file descriptor of the connection
  *
+ * Everything a connection needs lives in this one allocation: its entry
+ * in the connection table, the context its thread works on and the
+ * client's host name, which follows the struct.
  */
 typedef struct user_t
 {
   // the socket of connection
   int client_fd;
+  // points into host_buf
   char *client_host_name;
 
+  struct context_t *ctx;
+  connection_t connection;
+
   char *nick;
   char *username;
   char *fullname;
   bool registered;
-  bool is_irc_operator;
+  // mode bits, USER_MODE_* (see mode.h), changed only by its own thread
+  uint8_t modes;
+
+  // replies waiting to be sent by the thread that owns this connection,
+  // other threads post to the mailbox instead, see send_reply();
+  // NULL while there is nothing to send
+  sds outbuf;
+  mailbox_t mailbox;
+
+  // messages from this user still queued in the fan-out pool, see fanout.h
+  atomic_int fanout_pending;
+
+  // the nicks this user MONITORs (see add_monitor()), changed only by its
+  // own thread; NULL until it monitors any
+  sds *monitors;
+  int nmonitors;
+
+  // generation of the last recipient set this user was added to,
+  // see get_channels_recipients()
+  atomic_ulong visit_mark;
 
-  // makes this structure hashable
-  UT_hash_handle hh;
+  char host_buf[];
 } user_t;
 
 typedef user_t *user_handle;
 
 /**
- * @brief Create a user object
+ * @brief Create a user object for a new connection
  *
- * @return user_handle
+ * @param ctx
+ * @param client_fd
+ * @param client_host_name: copied
+ * @return user_handle: NULL if out of memory
  */
-user_handle create_user();
+user_handle create_user(struct context_t *ctx, int client_fd, const char *client_host_name);
 
 /**
  * @brief free the memory
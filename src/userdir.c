@@ -0,0 +1,77 @@
+#include "userdir.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "log.h"
+#include "alloc.h"
+
+static int by_folded_key(const void *a, const void *b)
+{
+    const char *x = ((const struct user_dir_entry *) a)->key;
+    const char *y = ((const struct user_dir_entry *) b)->key;
+    int cmp = strcasecmp(x, y);
+    return cmp != 0 ? cmp : strcmp(x, y);
+}
+
+user_dir_t *user_dir_create(unsigned long generation, const struct user_dir_entry *users, int count)
+{
+    alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
+    user_dir_t *dir = chirc_malloc(sizeof(user_dir_t) + 2 * count * sizeof(struct user_dir_entry));
+    alloc_set_tag(prev);
+    if (dir == NULL) {
+        chilog(CRITICAL, "user_dir_create: fail to allocate memory");
+        exit(1);
+    }
+    dir->generation = generation;
+    dir->count = count;
+    dir->by_host = &dir->by_nick[count];
+
+    memcpy(dir->by_nick, users, count * sizeof(struct user_dir_entry));
+    qsort(dir->by_nick, count, sizeof(struct user_dir_entry), by_folded_key);
+    for (int i = 0; i < count; i++) {
+        // a host never changes
+        dir->by_host[i].user = users[i].user;
+        dir->by_host[i].key = users[i].user->client_host_name;
+    }
+    qsort(dir->by_host, count, sizeof(struct user_dir_entry), by_folded_key);
+    return dir;
+}
+
+void user_dir_destroy(user_dir_t *dir)
+{
+    chirc_free(dir);
+}
+
+/**
+ * @brief the first user in a sorted array whose key's first len
+ * characters are past the prefix, or aren't before it
+ */
+static int prefix_bound(const struct user_dir_entry *users, int count,
+                        const char *prefix, size_t len, bool past)
+{
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strncasecmp(users[mid].key, prefix, len);
+        if (cmp < 0 || (past && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int user_dir_nick_range(const user_dir_t *dir, const char *prefix, size_t len, int *end)
+{
+    *end = prefix_bound(dir->by_nick, dir->count, prefix, len, true);
+    return prefix_bound(dir->by_nick, dir->count, prefix, len, false);
+}
+
+int user_dir_host_range(const user_dir_t *dir, const char *prefix, size_t len, int *end)
+{
+    *end = prefix_bound(dir->by_host, dir->count, prefix, len, true);
+    return prefix_bound(dir->by_host, dir->count, prefix, len, false);
+}
@@ -0,0 +1,78 @@
+#ifndef USERDIR_H
+#define USERDIR_H
+
+#include <stddef.h>
+#include "user.h"
+
+/*
+ * The user directory: every user in the user table, sorted by nick and by
+ * host, ignoring ASCII case, for WHO. The users matching a nick or host
+ * mask with a literal prefix ("guest*", "*.example.com" doesn't have one)
+ * are then a binary-searched range rather than a walk of every user.
+ *
+ * Like the channel directory (see chandir.h), the context keeps the latest
+ * one and only takes a new one once users have come, gone or changed nicks
+ * since (see get_user_dir()). A directory holds pointers to the users, so
+ * it is only good until its reader's next quiescent state (see epoch.h);
+ * a replaced directory is retired like the users are.
+ *
+ * Each entry keeps the key it is sorted by, the nick as it was when the
+ * directory was taken (nicks are retired like the users are), so a user
+ * renamed since doesn't break the order; it is found under its old nick
+ * until the directory is replaced.
+ */
+
+struct user_dir_entry {
+    user_handle user;
+    const char *key;                // its nick, or its host
+};
+
+typedef struct user_dir {
+    unsigned long generation;       // of the user table it was taken from
+    int count;
+    struct user_dir_entry *by_host;
+    struct user_dir_entry by_nick[];    // by_host follows
+} user_dir_t;
+
+/**
+ * @brief make a directory out of the users
+ *
+ * @param generation
+ * @param users: in any order, with their nicks as the keys
+ * @param count
+ * @return user_dir_t*
+ */
+user_dir_t *user_dir_create(unsigned long generation, const struct user_dir_entry *users, int count);
+
+/**
+ * @brief free a directory, not the users
+ *
+ * @param dir
+ */
+void user_dir_destroy(user_dir_t *dir);
+
+/**
+ * @brief where the users whose nicks start with a prefix are in
+ * dir->by_nick, ignoring ASCII case
+ *
+ * @param dir
+ * @param prefix
+ * @param len
+ * @param end: to store where they end
+ * @return int: where they start
+ */
+int user_dir_nick_range(const user_dir_t *dir, const char *prefix, size_t len, int *end);
+
+/**
+ * @brief where the users whose hosts start with a prefix are in
+ * dir->by_host, ignoring ASCII case
+ *
+ * @param dir
+ * @param prefix
+ * @param len
+ * @param end: to store where they end
+ * @return int: where they start
+ */
+int user_dir_host_range(const user_dir_t *dir, const char *prefix, size_t len, int *end);
+
+#endif
@@ -0,0 +1,61 @@
+#include "watch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "alloc.h"
+
+watch_t *create_watch(const char *nick)
+{
+    alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
+    watch_t *watch = chirc_malloc(sizeof(watch_t));
+    if (watch == NULL) {
+        chilog(CRITICAL, "create_watch: fail to allocate memory");
+        exit(1);
+    }
+    watch->nick = sdsnew(nick);
+    alloc_set_tag(prev);
+    watch->count = 0;
+    watch->capacity = 0;
+    watch->watchers = NULL;
+    return watch;
+}
+
+void destroy_watch(watch_t *watch)
+{
+    if (watch != NULL) {
+        sdsfree(watch->nick);
+        chirc_free(watch->watchers);
+    }
+    chirc_free(watch);
+}
+
+void watch_add(watch_t *watch, user_handle user)
+{
+    if (watch->count == watch->capacity) {
+        int capacity = watch->capacity == 0 ? 2 : 2 * watch->capacity;
+        alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
+        user_handle *watchers = chirc_realloc(watch->watchers, capacity * sizeof(user_handle));
+        alloc_set_tag(prev);
+        if (watchers == NULL) {
+            chilog(CRITICAL, "watch_add: fail to allocate memory");
+            exit(1);
+        }
+        watch->watchers = watchers;
+        watch->capacity = capacity;
+    }
+    watch->watchers[watch->count++] = user;
+}
+
+bool watch_remove(watch_t *watch, user_handle user)
+{
+    for (int i = 0; i < watch->count; i++) {
+        if (watch->watchers[i] == user) {
+            // order doesn't matter
+            watch->watchers[i] = watch->watchers[--watch->count];
+            return true;
+        }
+    }
+    return false;
+}
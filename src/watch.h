@@ -0,0 +1,57 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <sds.h>
+#include "user.h"
+
+/*
+ * The watchers of a nick: the users that MONITOR it, who are told when a
+ * user with that nick comes online or goes offline. The context keeps a
+ * watch for every nick someone monitors, by nick (see add_monitor()),
+ * which is the inverse of the users' own lists of the nicks they monitor.
+ *
+ * A watch doesn't lock, the context's watch table lock protects it.
+ */
+
+typedef struct watch {
+    sds nick;
+    int count;
+    int capacity;
+    user_handle *watchers;
+} watch_t;
+
+/**
+ * @brief a watch of a nick, with no watchers yet
+ *
+ * @param nick
+ * @return watch_t*
+ */
+watch_t *create_watch(const char *nick);
+
+/**
+ * @brief free a watch, not its watchers
+ *
+ * @param watch
+ */
+void destroy_watch(watch_t *watch);
+
+/**
+ * @brief add a watcher, which mustn't be one already (the watcher's own
+ * list of nicks is the shorter one to check)
+ *
+ * @param watch
+ * @param user
+ */
+void watch_add(watch_t *watch, user_handle user);
+
+/**
+ * @brief remove a watcher
+ *
+ * @param watch
+ * @param user
+ * @return bool: false if it wasn't one
+ */
+bool watch_remove(watch_t *watch, user_handle user);
+
+#endif
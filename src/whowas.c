@@ -0,0 +1,111 @@
+#include "whowas.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "alloc.h"
+#include "nametable.h"
+
+void whowas_init(whowas_t *history, int capacity)
+{
+    history->capacity = capacity;
+    history->next = 0;
+    history->seq = 0;
+    history->nbuckets = 1;
+    while (history->nbuckets < capacity) {
+        history->nbuckets *= 2;
+    }
+
+    alloc_tag_t prev = alloc_set_tag(ALLOC_USER);
+    history->buckets = chirc_malloc(history->nbuckets * sizeof(struct whowas_link));
+    history->entries = chirc_malloc(capacity * sizeof(struct whowas_entry));
+    alloc_set_tag(prev);
+    if (history->buckets == NULL || history->entries == NULL) {
+        chilog(CRITICAL, "whowas_init: fail to allocate memory");
+        exit(1);
+    }
+    for (int i = 0; i < history->nbuckets; i++) {
+        history->buckets[i].slot = -1;
+        history->buckets[i].seq = 0;
+    }
+    memset(history->entries, 0, capacity * sizeof(struct whowas_entry));
+}
+
+void whowas_destroy(whowas_t *history)
+{
+    chirc_free(history->buckets);
+    chirc_free(history->entries);
+    history->buckets = NULL;
+    history->entries = NULL;
+}
+
+static struct whowas_link *bucket_of(const whowas_t *history, const char *nick, size_t len)
+{
+    return &history->buckets[name_hash(nick, len) & (history->nbuckets - 1)];
+}
+
+/**
+ * @brief copy a string into a field, cut short if it doesn't fit
+ *
+ * @return bool: whether it fit
+ */
+static bool copy_field(char *field, size_t size, const char *s)
+{
+    size_t len = s != NULL ? strlen(s) : 0;
+    bool fits = len < size;
+    if (!fits) {
+        len = size - 1;
+    }
+    memcpy(field, s != NULL ? s : "", len);
+    field[len] = '\0';
+    return fits;
+}
+
+void whowas_add(whowas_t *history, const char *nick, const char *username,
+                const char *host, const char *realname, int64_t signoff)
+{
+    size_t nick_len = strlen(nick);
+    if (nick_len >= WHOWAS_NICK_LEN || (username != NULL && strlen(username) >= WHOWAS_USER_LEN)
+        || strlen(host) >= WHOWAS_HOST_LEN) {
+        return;
+    }
+
+    int slot = history->next;
+    history->next = (history->next + 1) % history->capacity;
+    // 0 is never a record's number
+    if (++history->seq == 0) {
+        history->seq = 1;
+    }
+
+    struct whowas_entry *entry = &history->entries[slot];
+    struct whowas_link *bucket = bucket_of(history, nick, nick_len);
+    entry->seq = history->seq;
+    entry->older = *bucket;
+    entry->signoff = signoff;
+    copy_field(entry->nick, sizeof(entry->nick), nick);
+    copy_field(entry->username, sizeof(entry->username), username);
+    copy_field(entry->host, sizeof(entry->host), host);
+    copy_field(entry->realname, sizeof(entry->realname), realname);
+    bucket->slot = slot;
+    bucket->seq = entry->seq;
+}
+
+int whowas_find(const whowas_t *history, const char *nick, int max, struct whowas_entry *out)
+{
+    int n = 0;
+    struct whowas_link link = *bucket_of(history, nick, strlen(nick));
+    while (n < max && link.slot != -1) {
+        const struct whowas_entry *entry = &history->entries[link.slot];
+        if (entry->seq != link.seq) {
+            // overwritten, and so is everything older
+            break;
+        }
+        if (strcmp(entry->nick, nick) == 0) {
+            out[n++] = *entry;
+        }
+        link = entry->older;
+    }
+    return n;
+}
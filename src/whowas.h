@@ -0,0 +1,95 @@
+#ifndef WHOWAS_H
+#define WHOWAS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * The WHOWAS history: what users looked like when they quit or changed
+ * nicks, kept for as long as there is room.
+ *
+ * The history is a ring of fixed-size records allocated once, so it takes
+ * the same memory however many users come and go: a new record overwrites
+ * the oldest one. The records of a nick are found through a hash index of
+ * chains, each bucket pointing at the newest record of its nicks and each
+ * record at the next older one. Records are never unlinked: a link also
+ * holds the sequence number of the record it points to, and once that
+ * slot has been overwritten (its number changed) the rest of the chain is
+ * older still, and gone too. A lookup only looks at the records of nicks
+ * in the same bucket.
+ *
+ * A nick, username or host too long for its field isn't recorded, a long
+ * real name is cut short.
+ *
+ * The history doesn't lock, see the context's whowas lock.
+ */
+
+#define WHOWAS_NICK_LEN     32
+#define WHOWAS_USER_LEN     32
+#define WHOWAS_HOST_LEN     64
+#define WHOWAS_REALNAME_LEN 104
+
+struct whowas_link {
+    int32_t slot;           // -1 for none
+    uint32_t seq;
+};
+
+struct whowas_entry {
+    uint32_t seq;                   // when it was written, 0 if never
+    struct whowas_link older;       // the next older record in its bucket
+    int64_t signoff;                // time()
+    char nick[WHOWAS_NICK_LEN];
+    char username[WHOWAS_USER_LEN];
+    char host[WHOWAS_HOST_LEN];
+    char realname[WHOWAS_REALNAME_LEN];
+};
+
+typedef struct whowas {
+    int capacity;                   // records
+    int next;                       // the slot to write next
+    uint32_t seq;                   // of the last record written
+    int nbuckets;                   // a power of 2
+    struct whowas_link *buckets;
+    struct whowas_entry *entries;
+} whowas_t;
+
+/**
+ * @brief allocate an empty history
+ *
+ * @param history
+ * @param capacity: records
+ */
+void whowas_init(whowas_t *history, int capacity);
+
+/**
+ * @brief free a history
+ *
+ * @param history
+ */
+void whowas_destroy(whowas_t *history);
+
+/**
+ * @brief record a user, overwriting the oldest record if the history is full
+ *
+ * @param history
+ * @param nick
+ * @param username
+ * @param host
+ * @param realname
+ * @param signoff
+ */
+void whowas_add(whowas_t *history, const char *nick, const char *username,
+                const char *host, const char *realname, int64_t signoff);
+
+/**
+ * @brief the records of a nick, newest first
+ *
+ * @param history
+ * @param nick
+ * @param max: the most records to return
+ * @param out: room for max records, which are copied
+ * @return int: the number of records
+ */
+int whowas_find(const whowas_t *history, const char *nick, int max, struct whowas_entry *out);
+
+#endif
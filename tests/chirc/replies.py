@@ -7,7 +7,12 @@ RPL_LUSEROP = "252"
 RPL_LUSERUNKNOWN = "253"
 RPL_LUSERCHANNELS = "254"
 RPL_LUSERME = "255"
+RPL_ENDOFSTATS = "219"
+RPL_UMODEIS = "221"
+RPL_STATSDEBUG = "249"
 RPL_AWAY = "301"
+RPL_USERHOST = "302"
+RPL_ISON = "303"
 RPL_UNAWAY = "305"
 RPL_NOWAWAY = "306"
 RPL_WHOISUSER = "311"
@@ -16,8 +21,11 @@ RPL_WHOISOPERATOR = "313"
 RPL_WHOISIDLE = "317"
 RPL_ENDOFWHOIS = "318"
 RPL_WHOISCHANNELS = "319"
+RPL_WHOWASUSER = "314"
+RPL_ENDOFWHOWAS = "369"
 RPL_WHOREPLY = "352"
 RPL_ENDOFWHO = "315"
+RPL_WHOSPCRPL = "354"
 RPL_LIST = "322"
 RPL_LISTEND = "323"
 RPL_CHANNELMODEIS = "324"
@@ -32,6 +40,7 @@ RPL_YOUREOPER = "381"
 ERR_NOSUCHNICK = "401"
 ERR_NOSUCHCHANNEL = "403"
 ERR_CANNOTSENDTOCHAN = "404"
+ERR_WASNOSUCHNICK = "406"
 ERR_NORECIPIENT = "411"
 ERR_NOTEXTTOSEND = "412"
 ERR_UNKNOWNCOMMAND = "421"
@@ -44,7 +53,16 @@ ERR_NOTREGISTERED = "451"
 ERR_NEEDMOREPARAMS = "461"
 ERR_ALREADYREGISTRED = "462"
 ERR_PASSWDMISMATCH = "464"
+ERR_CHANNELISFULL = "471"
 ERR_UNKNOWNMODE = "472"
+ERR_INVITEONLYCHAN = "473"
+ERR_BADCHANNELKEY = "475"
+ERR_NOPRIVILEGES = "481"
 ERR_CHANOPRIVSNEEDED = "482"
 ERR_UMODEUNKNOWNFLAG = "501"
-ERR_USERSDONTMATCH = "502"
\ No newline at end of file
+ERR_USERSDONTMATCH = "502"
+RPL_MONONLINE = "730"
+RPL_MONOFFLINE = "731"
+RPL_MONLIST = "732"
+RPL_ENDOFMONLIST = "733"
+ERR_MONLISTFULL = "734"
\ No newline at end of file
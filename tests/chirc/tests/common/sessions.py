@@ -725,14 +725,15 @@ class SingleIRCSession:
         self.get_reply(client, expect_code = replies.RPL_ENDOFNAMES, expect_nick = nick,
                        expect_short_params = expect_short_params, expect_nparams = 2)
 
-    def verify_list(self, channels, client, nick, expect_topics = None):
+    def verify_list(self, channels, client, nick, expect_topics = None, command = "LIST"):
         """
         User `nick` sends a LIST command and we verify the replies.
         `channels` is a dictionary mapping channel names to users in each channel.
         `expect_topics` is a dictionary mapping channel names to their topics
+        `command` is the LIST command to send, with any filters
         """
 
-        client.send_cmd("LIST")
+        client.send_cmd(command)
 
         channelsl = set([k for k in channels.keys() if k is not None])
         numchannels = len(channelsl)
@@ -318,6 +318,15 @@ class TestPART(object):
         self._test_join_and_part_and_join_and_part(irc_session, 10)
 
 
+    def test_channel_part_large(self, irc_session):
+        """
+        Forty clients connect to the server, join a channel, then leave it,
+        then join it again, and leave it again. The channel grows past the
+        size at which its members are hashed, and shrinks back.
+        """        
+        self._test_join_and_part_and_join_and_part(irc_session, 40)
+
+
     def test_channel_part_nochannel1(self, irc_session):
         """
         A client connects to the server and tries to leave a channel
@@ -865,6 +874,38 @@ class TestNAMES(object):
                    expect_nparams = 2)                
 
 
+    def test_names12(self, irc_session):
+        """
+        Twenty users with long nicks join #test, more than fit in a single
+        RPL_NAMREPLY. Another user (not in the channel) sends NAMES #test
+        and gets the members split over several replies, none of them
+        longer than 512 bytes, and the first user prefixed with '@'.
+        """
+
+        nicks = ["user%02d_with_a_rather_long_nick" % i for i in range(20)]
+        for nick in nicks:
+            client = irc_session.connect_user(nick, nick)
+            client.send_cmd("JOIN #test")
+            irc_session.verify_relayed_join(client, nick, "#test")
+
+        client = irc_session.connect_user("user1", "User One")
+        client.send_cmd("NAMES #test")
+
+        names = []
+        nreplies = 0
+        while True:
+            reply = irc_session.get_reply(client, expect_nick = "user1")
+            if reply.cmd == replies.RPL_ENDOFNAMES:
+                break
+            irc_session.verify_names_single(reply, "user1", expect_channel = "#test")
+            assert len(reply._s) + 2 <= 512, "RPL_NAMREPLY longer than 512 bytes: {}".format(reply._s)
+            names += reply.params[3][1:].split(" ")
+            nreplies += 1
+
+        assert nreplies > 1, "Expected the names to be split over several RPL_NAMREPLY"
+        assert sorted(names) == sorted(["@" + nicks[0]] + nicks[1:]), "Unexpected names: {}".format(names)
+
+
 @pytest.mark.category("LIST")                
 class TestLIST(object):
 
@@ -971,6 +1012,56 @@ class TestLIST(object):
                                          "#test3": "Topic Three"})      
 
 
+    def test_list6(self, irc_session):
+        """
+        Connects eleven users to the server, and has them join
+        the following channels, and set the following privileges:
+        (@ denotes channel operators, and + denotes a user with voice privileges):
+
+        #test1: @user1, user2, user3
+        #test2: @user2
+        #test3: @user3, @user4, user5, user6
+        #test4: @user7, +user8, +user9, user1, user2
+        #test5: @user1, @user5
+
+        Not in a channel: user10, user11
+
+        user1 then lists the channels with more than two users, then
+        those with fewer than three users that aren't #test5, then those
+        with three to four users whose names match a mask, then those
+        with more users than there can be.
+        """
+        users = irc_session.connect_and_join_channels(channels3)
+
+        more_than_two = {k: v for k, v in channels3.items() if k is not None and len(v) > 2}
+        irc_session.verify_list(more_than_two, users["user1"], "user1", command = "LIST >2")
+
+        irc_session.verify_list({"#test2": channels3["#test2"]}, users["user1"], "user1",
+                                command = "LIST <3,!*5")
+
+        irc_session.verify_list({"#test3": channels3["#test3"]}, users["user1"], "user1",
+                                command = "LIST >2,<5,#TEST?,!#test1")
+
+        irc_session.verify_list({}, users["user1"], "user1", command = "LIST >2147483647")
+
+
+    def test_list7(self, irc_session):
+        """
+        Connects eleven users to the server, and has them join
+        the channels of test_list6.
+
+        user1 then lists the channels matching overlapping masks, in a
+        different case than the channel names, and should get each
+        channel once.
+        """
+        users = irc_session.connect_and_join_channels(channels3)
+
+        irc_session.verify_list(channels3, users["user1"], "user1", command = "LIST #TEST*,#test1*,#tes?4")
+
+        irc_session.verify_list({"#test4": channels3["#test4"]}, users["user1"], "user1",
+                                command = "LIST #test4,#test5,>4")
+
+
 @pytest.mark.category("WHO")
 class TestWHO(object):
             
@@ -1218,6 +1309,45 @@ class TestWHO(object):
                  
                  
 
+    def test_who7(self, irc_session):
+        """
+        Connects nine users to the server, and has them join
+        the following channels, and set the following privileges:
+        (@ denotes channel operators):
+
+        #test1: @user1, user2, user3
+        #test2: @user4, user5, user6
+        #test3: @user7, user8, user9
+
+        user1 then sends a WHOX for the nicks matching a mask, with a
+        token, and one for a channel.
+        """
+        users = irc_session.connect_and_join_channels(channels1)
+        client = users["user1"]
+
+        client.send_cmd("WHO USER* n%tnf,42")
+        nicks = set()
+        for i in range(9):
+            reply = irc_session.get_reply(client, expect_code = replies.RPL_WHOSPCRPL, expect_nick = "user1",
+                                          expect_nparams = 3, expect_short_params = ["42"])
+            nicks.add(reply.params[2])
+        assert nicks == set("user%i" % i for i in range(1, 10)), "Unexpected nicks: {}".format(nicks)
+        irc_session.get_reply(client, expect_code = replies.RPL_ENDOFWHO, expect_nick = "user1",
+                              expect_nparams = 2, expect_short_params = ["USER*"],
+                              long_param_re = "End of WHO list")
+
+        client.send_cmd("WHO #test2 %cnf")
+        members = set()
+        for i in range(3):
+            reply = irc_session.get_reply(client, expect_code = replies.RPL_WHOSPCRPL, expect_nick = "user1",
+                                          expect_nparams = 3, expect_short_params = ["#test2"])
+            members.add(reply.params[3][1:] + reply.params[2])
+        assert members == {"@user4", "user5", "user6"}, "Unexpected members: {}".format(members)
+        irc_session.get_reply(client, expect_code = replies.RPL_ENDOFWHO, expect_nick = "user1",
+                              expect_nparams = 2, expect_short_params = ["#test2"],
+                              long_param_re = "End of WHO list")
+
+
 class TestChannelUPDATEAssignment2(object):
 
     @pytest.mark.category("NICK_CHANNEL")
@@ -1272,4 +1402,55 @@ class TestChannelUPDATEAssignment2(object):
                                 long_param_re = r"Closing Link: .* \(I'm outta here\)")
                     
         irc_session.verify_disconnect(client1)
+
+    @pytest.mark.category("NICK_CHANNEL")
+    def test_update1b_nick_shared_channels(self, irc_session):
+        """
+        Ensure that a nick change is relayed only once to a user
+        who shares several channels with the user changing nick.
+        """
+        clients = irc_session.connect_clients(3, join_channel = "#test1")
+
+        for nick, client in clients:
+            client.send_cmd("JOIN #test2")
+            irc_session.verify_join(client, nick, "#test2")
+            for other_nick, other in clients:
+                if other is not client and int(other_nick[4:]) < int(nick[4:]):
+                    irc_session.verify_relayed_join(other, from_nick=nick, channel="#test2")
+
+        nick1, client1 = clients[0]
+
+        client1.send_cmd("NICK userfoo")
+
+        for nick, client in clients:
+            irc_session.verify_relayed_nick(client, from_nick=nick1, newnick="userfoo")
+            irc_session.get_reply(client, expect_timeout = True)
+
+    @pytest.mark.category("QUIT_CHANNEL")
+    def test_update1b_quit_shared_channels(self, irc_session):
+        """
+        Ensure that a QUIT is relayed only once to a user who shares
+        several channels with the user quitting.
+        """
+        clients = irc_session.connect_clients(3, join_channel = "#test1")
+
+        for nick, client in clients:
+            client.send_cmd("JOIN #test2")
+            irc_session.verify_join(client, nick, "#test2")
+            for other_nick, other in clients:
+                if other is not client and int(other_nick[4:]) < int(nick[4:]):
+                    irc_session.verify_relayed_join(other, from_nick=nick, channel="#test2")
+
+        nick1, client1 = clients[0]
+
+        client1.send_cmd("QUIT")
+
+        for nick, client in clients[1:]:
+            irc_session.verify_relayed_quit(client, from_nick=nick1, msg = "Client Quit")
+            irc_session.get_reply(client, expect_timeout = True)
+
+        irc_session.get_message(client1, expect_cmd = "ERROR", expect_nparams = 1,
+                                long_param_re = r"Closing Link: .* \(Client Quit\)")
+
+        irc_session.verify_disconnect(client1)
                                                                                                       
\ No newline at end of file
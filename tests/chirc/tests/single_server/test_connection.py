@@ -379,6 +379,40 @@ class TestBasicConnection(object):
 
         irc_session.get_reply(client, expect_timeout = True)
 
+    def test_connect_nick_replaced(self, irc_session):
+        """
+        Sends two NICK commands before USER. The user registers with the
+        second nick, and the first one is free, also once the user has
+        quit.
+        """
+
+        client2 = irc_session.connect_user("user9", "User Nine")
+        client2.send_cmd("MONITOR + user2")
+        irc_session.get_reply(client2, expect_code = replies.RPL_MONOFFLINE, expect_nick = "user9",
+                              expect_nparams = 1, long_param_re = "user2")
+
+        client1 = irc_session.get_client()
+        client1.send_cmd("NICK user1")
+        client1.send_cmd("NICK user2")
+        client1.send_cmd("USER user2 * * :User Two")
+        irc_session.verify_welcome_messages(client1, "user2")
+        irc_session.get_reply(client2, expect_code = replies.RPL_MONONLINE, expect_nick = "user9",
+                              expect_nparams = 1, long_param_re = r"user2!user2@.+")
+
+        client2.send_cmd("WHOIS user1")
+        irc_session.get_reply(client2, expect_code = replies.ERR_NOSUCHNICK, expect_nick = "user9",
+                              expect_nparams = 2, expect_short_params = ["user1"],
+                              long_param_re = "No such nick/channel")
+
+        irc_session.disconnect_client(client1)
+        irc_session.get_reply(client2, expect_code = replies.RPL_MONOFFLINE, expect_nick = "user9",
+                              expect_nparams = 1, long_param_re = "user2")
+
+        client2.send_cmd("WHOIS user1")
+        irc_session.get_reply(client2, expect_code = replies.ERR_NOSUCHNICK, expect_nick = "user9",
+                              expect_nparams = 2, expect_short_params = ["user1"],
+                              long_param_re = "No such nick/channel")
+
 
 @pytest.mark.category("CONNECTION_REGISTRATION")
 class TestFullConnection(object):
@@ -482,7 +516,7 @@ class TestConnectionNotRegistered(object):
         client = irc_session.get_client()
         
         client.send_cmd("NICK user1")        
-        client.send_cmd("WHOWAS user2")
+        client.send_cmd("SUMMON user2")
         
         irc_session.get_reply(client, expect_timeout = True)        
 
@@ -494,7 +528,7 @@ class TestConnectionNotRegistered(object):
                 
         client = irc_session.get_client()
         
-        client.send_cmd("WHOWAS user2")
+        client.send_cmd("SUMMON user2")
         
         irc_session.get_reply(client, expect_timeout = True)    
 
@@ -507,7 +541,7 @@ class TestConnectionNotRegistered(object):
         client = irc_session.get_client()
         
         client.send_cmd("USER user1 * * :User One")        
-        client.send_cmd("WHOWAS user2")
+        client.send_cmd("SUMMON user2")
         
         irc_session.get_reply(client, expect_timeout = True)            
 
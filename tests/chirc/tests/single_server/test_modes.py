@@ -753,6 +753,36 @@ class TestChannelMODE(object):
         irc_session.set_channel_mode(client2, nick2, "#test", "+m", expect_ops_needed = True)
 
 
+    def test_channel_mode19(self, irc_session):
+        """
+        Two clients connect to the server. The first one joins a channel and
+        sets a key (+k) and a limit of one member (+l) with a single MODE.
+
+        The second user can't join without the key, and can't join with it
+        either because the channel is full.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        client2 = irc_session.connect_user("user2", "User Two")
+
+        client1.send_cmd("JOIN #test")
+        irc_session.verify_join(client1, "user1", "#test")
+
+        client1.send_cmd("MODE #test +kl secret 1")
+        irc_session.get_message(client1, expect_prefix = True, expect_cmd = "MODE",
+                                expect_nparams = 4, expect_short_params = ["#test", "+kl", "secret", "1"])
+
+        client2.send_cmd("JOIN #test")
+        irc_session.get_reply(client2, expect_code = replies.ERR_BADCHANNELKEY, expect_nick = "user2",
+                              expect_nparams = 2, expect_short_params = ["#test"],
+                              long_param_re = "Cannot join channel \\(\\+k\\)")
+
+        client2.send_cmd("JOIN #test secret")
+        irc_session.get_reply(client2, expect_code = replies.ERR_CHANNELISFULL, expect_nick = "user2",
+                              expect_nparams = 2, expect_short_params = ["#test"],
+                              long_param_re = "Cannot join channel \\(\\+l\\)")
+
+
 @pytest.mark.category("MODES")
 class TestChannelMembershipMODE(object):
 
@@ -865,6 +895,35 @@ class TestChannelMembershipMODE(object):
         irc_session.connect_and_join_channels(channels3)
 
 
+    def test_channel_membership_mode06(self, irc_session):
+        """
+        Five users connect to the server and they all join the #test channel.
+
+        The operator gives user2 operator privileges and user3 voice, and
+        takes operator privileges away from itself, all in one MODE.
+
+        We check that everyone receives a single relay of the combined MODE,
+        and that user1 can no longer change modes while user2 can.
+        """
+
+        clients = irc_session.connect_clients(5, join_channel = "#test")
+
+        nick1, client1 = clients[0]
+        nick2, client2 = clients[1]
+
+        client1.send_cmd("MODE #test +ov-o user2 user3 user1")
+        for nick, client in clients:
+            reply = irc_session.get_message(client, expect_prefix = True, expect_cmd = "MODE",
+                                            expect_nparams = 5,
+                                            expect_short_params = ["#test", "+ov-o", "user2", "user3", "user1"])
+
+        irc_session.set_channel_mode(client1, nick1, "#test", "+m", expect_ops_needed = True)
+
+        irc_session.set_channel_mode(client2, nick2, "#test", "+m")
+        for nick, client in clients:
+            irc_session.verify_relayed_mode(client, from_nick=nick2, channel="#test", mode="+m")
+
+
 @pytest.mark.category("MODES")
 class TestPermissionsPRIVMSG(BaseTestPermissions):
 
@@ -0,0 +1,61 @@
+import pytest
+
+from chirc import replies
+
+@pytest.mark.category("MONITOR")
+class TestMONITOR(object):
+
+    def test_monitor_presence(self, irc_session):
+        """
+        Test user1 monitoring user2 before it connects: user1 is told
+        user2 is offline, then when it registers, changes its nick (the
+        old nick goes offline) and quits.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+
+        client1.send_cmd("MONITOR + user2,user3")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONOFFLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "user2,user3")
+
+        client2 = irc_session.connect_user("user2", "User Two")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONONLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = r"user2!user2@.+")
+
+        client2.send_cmd("NICK user3")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONOFFLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "user2")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONONLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = r"user3!user2@.+")
+
+        client2.send_cmd("QUIT")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONOFFLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "user3")
+
+        client1.send_cmd("MONITOR - user2")
+        client1.send_cmd("MONITOR L")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONLIST, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "user3")
+        irc_session.get_reply(client1, expect_code = replies.RPL_ENDOFMONLIST, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "End of MONITOR list")
+
+    def test_ison_userhost(self, irc_session):
+        """
+        Test ISON and USERHOST on two users, one of them an IRCop, and a
+        nick nobody has.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        client2 = irc_session.connect_user("user2", "User Two")
+
+        client2.send_cmd("OPER user2 %s" % irc_session.oper_password)
+        irc_session.get_reply(client2, expect_code = replies.RPL_YOUREOPER, expect_nick = "user2")
+
+        client1.send_cmd("ISON user1 user9 :user2")
+        irc_session.get_reply(client1, expect_code = replies.RPL_ISON, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "user1 user2")
+
+        client1.send_cmd("USERHOST user2 user9 user1")
+        irc_session.get_reply(client1, expect_code = replies.RPL_USERHOST, expect_nick = "user1",
+                              expect_nparams = 1,
+                              long_param_re = r"user2\*=\+user2@\S+ user1=\+user1@\S+")
@@ -1,4 +1,7 @@
 import pytest
+import socket
+import threading
+import time
 from chirc import replies
 
 @pytest.mark.category("ROBUST")
@@ -167,3 +170,43 @@ class TestRobustness(object):
             assert msg.startswith(relayed_msg[1:])               
            
 
+    def test_stalled_member(self, irc_session):
+        """
+        Test that a member who stops reading from its socket does not block
+        unrelated commands: flood a channel with a stalled member until the
+        server can no longer deliver to it, have another member PART, and
+        check LIST on a new connection still gets answered.
+        """
+
+        clients = irc_session.connect_clients(3, join_channel = "#stall")
+        _, flooder = clients[1]
+        _, client3 = clients[2]
+
+        # Keep the flooder's own socket drained so the server only ever
+        # blocks on the stalled member (user1).
+        sock = flooder.client.sock
+        def drain():
+            try:
+                while sock.recv(65536):
+                    pass
+            except OSError:
+                pass
+        threading.Thread(target = drain, daemon = True).start()
+
+        sock.settimeout(0.5)
+        line = str.encode("PRIVMSG #stall :%s\r\n" % ("x" * 400))
+        sent = 0
+        try:
+            while sent < 16 * 1024 * 1024:
+                sent += sock.send(line)
+        except socket.timeout:
+            pass
+
+        client3.send_cmd("PART #stall")
+        time.sleep(0.3)
+
+        client4 = irc_session.connect_user("user4", "User Four")
+        client4.send_cmd("LIST")
+
+        irc_session.get_reply(client4, expect_code = replies.RPL_LIST, expect_nick = "user4")
+        irc_session.get_reply(client4, expect_code = replies.RPL_LISTEND, expect_nick = "user4")
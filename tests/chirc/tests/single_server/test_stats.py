@@ -0,0 +1,161 @@
+import pytest
+import time
+
+from chirc import replies
+
+@pytest.mark.category("STATS")
+class TestSTATS(object):
+
+    def test_stats_locks(self, irc_session):
+        """
+        Test an IRCop requesting the lock contention profile: there must
+        be one line per global table lock.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        irc_session.join_channel([("user1", client1)], "#test")
+
+        client1.send_cmd("OPER user1 %s" % irc_session.oper_password)
+        irc_session.get_reply(client1, expect_code = replies.RPL_YOUREOPER, expect_nick = "user1")
+
+        client1.send_cmd("STATS locks")
+
+        locks = set()
+        while True:
+            reply = irc_session.get_reply(client1, expect_nick = "user1")
+            if reply.cmd == replies.RPL_ENDOFSTATS:
+                irc_session.verify_reply(reply, expect_code = replies.RPL_ENDOFSTATS,
+                                         expect_nparams = 2, expect_short_params = ["locks"],
+                                         long_param_re = "End of STATS report")
+                break
+            irc_session.verify_reply(reply, expect_code = replies.RPL_STATSDEBUG, expect_nparams = 1)
+            locks.add(reply.params[-1].lstrip(":").split(":")[0])
+
+        for lock in ("user_table", "channel_table", "connection_table", "channel_member_table"):
+            assert lock in locks, "No STATS line for lock {}".format(lock)
+
+    def test_stats_memory(self, irc_session):
+        """
+        Test an IRCop requesting the sds memory report: there must be one
+        line per subsystem, and the user and channel subsystems must hold
+        the nicks and channel names created so far, followed by what the
+        connections cost.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        irc_session.join_channel([("user1", client1)], "#test")
+
+        client1.send_cmd("OPER user1 %s" % irc_session.oper_password)
+        irc_session.get_reply(client1, expect_code = replies.RPL_YOUREOPER, expect_nick = "user1")
+
+        client1.send_cmd("STATS memory")
+
+        live = {}
+        connections = None
+        while True:
+            reply = irc_session.get_reply(client1, expect_nick = "user1")
+            if reply.cmd == replies.RPL_ENDOFSTATS:
+                irc_session.verify_reply(reply, expect_code = replies.RPL_ENDOFSTATS,
+                                         expect_nparams = 2, expect_short_params = ["memory"],
+                                         long_param_re = "End of STATS report")
+                break
+            if reply.params[-1].lstrip(":").startswith("retired"):
+                irc_session.verify_reply(reply, expect_code = replies.RPL_STATSDEBUG, expect_nparams = 1,
+                                         long_param_re = r"retired \d+ objects waiting to be freed")
+                continue
+            if reply.params[-1].lstrip(":").startswith("connections"):
+                irc_session.verify_reply(reply, expect_code = replies.RPL_STATSDEBUG, expect_nparams = 1,
+                                         long_param_re = r"connections \d+, \d+ bytes of user state, \d+ bytes of log rings, \d+ bytes of stack reserved each")
+                connections = int(reply.params[-1].lstrip(":").split()[1].rstrip(","))
+                continue
+            irc_session.verify_reply(reply, expect_code = replies.RPL_STATSDEBUG, expect_nparams = 1,
+                                     long_param_re = r"\w+ live -?\d+ bytes, \d+ allocations")
+            subsystem, _, nbytes = reply.params[-1].lstrip(":").split()[:3]
+            live[subsystem] = int(nbytes)
+
+        for subsystem in ("reply", "sendq", "user", "channel"):
+            assert subsystem in live, "No STATS line for subsystem {}".format(subsystem)
+        assert live["user"] > 0 and live["channel"] > 0
+        assert connections >= 1
+
+    def _stall(self, client):
+        """
+        Make the server block sending to a client that doesn't read: send
+        it PINGs, without reading the PONGs, until the server stops taking
+        them.
+        """
+        sock = client.client.sock
+        sock.setblocking(False)
+        chunk = str.encode("PING :%s\r\n" % ("x" * 400)) * 64
+        sent = 0
+        blocked = 0
+        while blocked < 10 and sent < 256 * 1024 * 1024:
+            try:
+                # whole lines only, what's left of a chunk goes first
+                sent += sock.send(chunk[sent % len(chunk):])
+                blocked = 0
+            except BlockingIOError:
+                blocked += 1
+                time.sleep(0.05)
+        assert blocked == 10, "The server kept reading from a client that doesn't read"
+
+    def test_stats_stalled_reader(self, irc_session):
+        """
+        Test that a client that stops reading, alone in a quiet channel,
+        doesn't keep the server from freeing what other users retire:
+        while it is stalled, another user changes nicks and creates and
+        leaves channels, and the objects waiting to be freed must not pile
+        up.
+        """
+
+        stalled = irc_session.get_client()
+        stalled.send_cmd("NICK stalled")
+        stalled.send_cmd("USER stalled * * :Stalled")
+        stalled.send_cmd("JOIN #quiet")
+        self._stall(stalled)
+
+        client1 = irc_session.connect_user("user1", "User One")
+        client1.send_cmd("OPER user1 %s" % irc_session.oper_password)
+        irc_session.get_reply(client1, expect_code = replies.RPL_YOUREOPER, expect_nick = "user1")
+
+        for i in range(200):
+            client1.send_cmd("NICK churn%d" % i)
+            client1.send_cmd("JOIN #churn%d" % i)
+            client1.send_cmd("PART #churn%d" % i)
+        client1.send_cmd("NICK user1")
+        client1.send_cmd("STATS memory")
+
+        retired = None
+        while True:
+            msg = client1.get_message()
+            if msg.cmd == replies.RPL_ENDOFSTATS:
+                break
+            if msg.cmd == replies.RPL_STATSDEBUG and msg.params[-1].lstrip(":").startswith("retired"):
+                retired = int(msg.params[-1].lstrip(":").split()[1])
+
+        assert retired is not None, "No STATS line for retired objects"
+        assert retired < 100, "{} retired objects weren't freed".format(retired)
+
+    def test_stats_not_oper(self, irc_session):
+        """
+        Test a regular user requesting the lock contention profile.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+
+        client1.send_cmd("STATS locks")
+
+        irc_session.get_reply(client1, expect_code = replies.ERR_NOPRIVILEGES, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "Permission Denied.*")
+
+    def test_stats_params(self, irc_session):
+        """
+        Test ERR_NEEDMOREPARAMS reply
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+
+        client1.send_cmd("STATS")
+
+        irc_session.get_ERR_NEEDMOREPARAMS_reply(client1,
+                                                 expect_nick="user1", expect_cmd="STATS")
@@ -25,10 +25,10 @@ class TestUnknownCommands(object):
 
         client1 = irc_session.connect_user("user1", "User One")
         
-        client1.send_cmd("WHOWAS user2")
+        client1.send_cmd("SUMMON user2")
         
         reply = irc_session.get_reply(client1, expect_code = replies.ERR_UNKNOWNCOMMAND, expect_nick = "user1", 
-                                      expect_nparams = 2, expect_short_params = ["WHOWAS"],
+                                      expect_nparams = 2, expect_short_params = ["SUMMON"],
                                       long_param_re = "Unknown command")            
 
 
@@ -0,0 +1,72 @@
+import pytest
+
+from chirc import replies
+
+@pytest.mark.category("WHOWAS")
+class TestWHOWAS(object):
+
+    def _wait_offline(self, irc_session, client, nick):
+        irc_session.get_reply(client, expect_code = replies.RPL_MONOFFLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = nick)
+
+    def _get_whowas(self, irc_session, client, realname):
+        irc_session.get_reply(client, expect_code = replies.RPL_WHOWASUSER, expect_nick = "user1",
+                              expect_nparams = 5, long_param_re = realname)
+        irc_session.get_reply(client, expect_code = replies.RPL_WHOISSERVER, expect_nick = "user1",
+                              expect_nparams = 3)
+
+    def test_whowas1(self, irc_session):
+        """
+        Test WHOWAS of a user that changed its nick and then quit: the
+        newest record comes first, and a count limits them.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        client1.send_cmd("MONITOR + user2,user3")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONOFFLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "user2,user3")
+
+        client2 = irc_session.connect_user("user2", "User Two")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONONLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = r"user2!user2@.+")
+        client2.send_cmd("NICK user3")
+        self._wait_offline(irc_session, client1, "user2")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONONLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = r"user3!user2@.+")
+        client2.send_cmd("NICK user2")
+        self._wait_offline(irc_session, client1, "user3")
+        irc_session.get_reply(client1, expect_code = replies.RPL_MONONLINE, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = r"user2!user2@.+")
+        client2.send_cmd("QUIT")
+        self._wait_offline(irc_session, client1, "user2")
+
+        client1.send_cmd("WHOWAS user2")
+        for _ in range(2):
+            self._get_whowas(irc_session, client1, "User Two")
+        irc_session.get_reply(client1, expect_code = replies.RPL_ENDOFWHOWAS, expect_nick = "user1",
+                              expect_nparams = 2, long_param_re = "End of WHOWAS")
+
+        client1.send_cmd("WHOWAS user2,user3 1")
+        self._get_whowas(irc_session, client1, "User Two")
+        irc_session.get_reply(client1, expect_code = replies.RPL_ENDOFWHOWAS, expect_nick = "user1",
+                              expect_nparams = 2, long_param_re = "End of WHOWAS")
+        self._get_whowas(irc_session, client1, "User Two")
+        irc_session.get_reply(client1, expect_code = replies.RPL_ENDOFWHOWAS, expect_nick = "user1",
+                              expect_nparams = 2, long_param_re = "End of WHOWAS")
+
+    def test_whowas2(self, irc_session):
+        """
+        Test WHOWAS of a nick nobody had, and without a nick.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+
+        client1.send_cmd("WHOWAS user9")
+        irc_session.get_reply(client1, expect_code = replies.ERR_WASNOSUCHNICK, expect_nick = "user1",
+                              expect_nparams = 2, long_param_re = "There was no such nickname")
+        irc_session.get_reply(client1, expect_code = replies.RPL_ENDOFWHOWAS, expect_nick = "user1",
+                              expect_nparams = 2, long_param_re = "End of WHOWAS")
+
+        client1.send_cmd("WHOWAS")
+        irc_session.get_reply(client1, expect_code = replies.ERR_NONICKNAMEGIVEN, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "No nickname given")
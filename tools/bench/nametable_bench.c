@@ -0,0 +1,155 @@
+/*
+ * Microbenchmark of the name table (src/nametable.h) against uthash, the
+ * table it replaced for users and channels, at 10k, 100k and 1M names.
+ *
+ * Build and run:
+ *     cmake --build build --target bench_nametable
+ *     build/bench_nametable
+ *
+ * For each size, every name is inserted, looked up once in random order
+ * (hits), a name of the same shape that isn't there is looked up as many
+ * times (misses), and every name is removed. Times are in nanoseconds per
+ * operation. uthash removes an entry it is handed, the name table has to find
+ * it first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <uthash.h>
+
+#include "nametable.h"
+
+struct entry {
+    char name[24];
+    UT_hash_handle hh;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// keeps the compiler from dropping the lookups
+static volatile size_t sink;
+
+static void bench_uthash(struct entry *entries, size_t *order, struct entry *missing, size_t n)
+{
+    struct entry *table = NULL, *found;
+    size_t hits = 0;
+
+    double t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        HASH_ADD_STR(table, name, &entries[i]);
+    }
+    double t1 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        HASH_FIND_STR(table, entries[order[i]].name, found);
+        hits += found != NULL;
+    }
+    double t2 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        HASH_FIND_STR(table, missing[i].name, found);
+        hits += found != NULL;
+    }
+    double t3 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        HASH_DEL(table, &entries[i]);
+    }
+    double t4 = now_ns();
+    HASH_CLEAR(hh, table);
+
+    sink = hits;
+    printf("%-10s %8zu %10.1f %10.1f %10.1f %10.1f\n", "uthash", n,
+           (t1 - t0) / n, (t2 - t1) / n, (t3 - t2) / n, (t4 - t3) / n);
+}
+
+static void bench_name_table(struct entry *entries, size_t *order, struct entry *missing, size_t n)
+{
+    name_table_t table;
+    name_table_init(&table);
+    size_t hits = 0;
+
+    double t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        name_table_insert(&table, entries[i].name, strlen(entries[i].name), &entries[i]);
+    }
+    double t1 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        const char *name = entries[order[i]].name;
+        hits += name_table_find(&table, name, strlen(name)) != NULL;
+    }
+    double t2 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        hits += name_table_find(&table, missing[i].name, strlen(missing[i].name)) != NULL;
+    }
+    double t3 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        name_table_remove(&table, entries[i].name, strlen(entries[i].name));
+    }
+    double t4 = now_ns();
+    name_table_destroy(&table);
+
+    sink = hits;
+    printf("%-10s %8zu %10.1f %10.1f %10.1f %10.1f\n", "nametable", n,
+           (t1 - t0) / n, (t2 - t1) / n, (t3 - t2) / n, (t4 - t3) / n);
+}
+
+/**
+ * @brief nick-like names, looked up in an order unrelated to insertion
+ */
+static void make_names(struct entry *entries, size_t n, const char *prefix)
+{
+    for (size_t i = 0; i < n; i++) {
+        snprintf(entries[i].name, sizeof(entries[i].name), "%s%zu", prefix, i * 2654435761u % 1000000007u);
+    }
+}
+
+static size_t *random_order(size_t n)
+{
+    size_t *order = malloc(n * sizeof(size_t));
+    if (order == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (size_t i = n - 1; i > 0; i--) {
+        size_t j = (size_t) rand() % (i + 1);
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    return order;
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {10000, 100000, 1000000};
+
+    printf("%-10s %8s %10s %10s %10s %10s\n", "table", "names", "insert", "hit", "miss", "remove");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        struct entry *entries = calloc(n, sizeof(struct entry));
+        struct entry *missing = calloc(n, sizeof(struct entry));
+        size_t *order = random_order(n);
+        if (entries == NULL || missing == NULL || order == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        make_names(entries, n, "nick");
+        make_names(missing, n, "gone");
+
+        bench_uthash(entries, order, missing, n);
+        bench_name_table(entries, order, missing, n);
+
+        free(entries);
+        free(missing);
+        free(order);
+    }
+    return 0;
+}